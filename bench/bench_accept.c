@@ -0,0 +1,183 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file bench_accept.c
+ *
+ *  Accept rate benchmark. Client threads connect to the loopback interface
+ *  as fast as they can, the connections are accepted either by a single
+ *  listener thread or by SO_REUSEPORT listener shards, one accept thread
+ *  per shard pinned to one cpu (see listen_shards setting).
+ *
+ *  Usage: bench_accept [-p port] [-s shards] [-c clients] [-d seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "cthreads.h"
+
+#define BENCH_MAX_THREADS 256
+
+typedef struct {
+    int fd;                     /* listen socket */
+    volatile int *stop;
+    unsigned long accepted;
+} accept_thread_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    volatile int *stop;
+    unsigned long connected;
+} client_thread_t;
+
+static CTHREAD_RETURN accept_thread( CTHREAD_ARG arg )
+{
+    accept_thread_t *at = (accept_thread_t*)arg;
+    struct pollfd pfd;
+
+    pfd.fd = at->fd;
+    pfd.events = POLLIN;
+    while( !*at->stop ) {
+        int fd;
+        if( poll( &pfd, 1, 100 ) <= 0 ) continue;
+        if( (fd = accept( at->fd, NULL, NULL )) >= 0 ) {
+            ++at->accepted;
+            close( fd );
+        }
+    }
+    return (CTHREAD_RETURN) 0;
+}
+
+static CTHREAD_RETURN client_thread( CTHREAD_ARG arg )
+{
+    client_thread_t *ct = (client_thread_t*)arg;
+    struct linger lin;
+
+    /* reset the connections on close, no TIME_WAIT sockets pile up */
+    lin.l_onoff = 1;
+    lin.l_linger = 0;
+    while( !*ct->stop ) {
+        int fd = (int)socket( AF_INET, SOCK_STREAM, 0 );
+        if( fd < 0 ) break;
+        setsockopt( fd, SOL_SOCKET, SO_LINGER, (char*)&lin, sizeof(lin) );
+        if( connect( fd, (struct sockaddr*)&ct->addr, sizeof(ct->addr) ) == 0 )
+            ++ct->connected;
+        close( fd );
+    }
+    return (CTHREAD_RETURN) 0;
+}
+
+static int bench_listen( int port, int reuseport )
+{
+    int vTrue = 1;
+    struct sockaddr_in addr;
+    int fd = (int)socket( AF_INET, SOCK_STREAM, 0 );
+    if( fd < 0 ) return -1;
+
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, (char*)&vTrue, sizeof(int) );
+    #ifdef SO_REUSEPORT
+    if( reuseport ) setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, (char*)&vTrue, sizeof(int) );
+    #endif
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( (unsigned short)port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 || listen( fd, 1024 ) < 0 ) {
+        fprintf( stderr, "bind/listen error: %s\n", strerror(errno) );
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+/* Runs one benchmark round, returns the accepted connections per second. */
+static double bench_run( int port, unsigned int shards, unsigned int clients, unsigned int seconds )
+{
+    static accept_thread_t at[BENCH_MAX_THREADS];
+    static client_thread_t ct[BENCH_MAX_THREADS];
+    c_thread athreads[BENCH_MAX_THREADS], cthreads[BENCH_MAX_THREADS];
+    volatile int stop_accept = 0, stop_clients = 0;
+    unsigned long accepted = 0;
+    unsigned int i, cpus[BENCH_MAX_THREADS];
+    const unsigned int num_cpus = cthread_cpu_list( cpus, BENCH_MAX_THREADS );
+
+    memset( at, 0, sizeof(at) );
+    memset( ct, 0, sizeof(ct) );
+    for( i = 0; i < shards; ++i ) {
+        at[i].stop = &stop_accept;
+        if( (at[i].fd = bench_listen( port, shards > 1 )) < 0 ) {
+            while( i-- ) close( at[i].fd );
+            return -1.0;
+        }
+    }
+    for( i = 0; i < shards; ++i ) {
+        cthread_create( &athreads[i], accept_thread, &at[i] );
+        if( shards > 1 ) cthread_set_affinity( &athreads[i], cpus[i % num_cpus] );
+    }
+    for( i = 0; i < clients; ++i ) {
+        ct[i].stop = &stop_clients;
+        ct[i].addr.sin_family = AF_INET;
+        ct[i].addr.sin_port = htons( (unsigned short)port );
+        ct[i].addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        cthread_create( &cthreads[i], client_thread, &ct[i] );
+    }
+
+    cthread_sleep( seconds * 1000 );
+    stop_clients = 1;
+    for( i = 0; i < clients; ++i ) cthread_join( &cthreads[i] );
+    /* let the accept threads drain the backlog */
+    cthread_sleep( 200 );
+    stop_accept = 1;
+    for( i = 0; i < shards; ++i ) {
+        cthread_join( &athreads[i] );
+        close( at[i].fd );
+        accepted += at[i].accepted;
+    }
+    return (double)accepted / seconds;
+}
+
+int main( int argc, char **argv )
+{
+    int port = 8282, i;
+    unsigned int shards = cthread_cpu_count(), clients = 0, seconds = 5;
+    double single, sharded;
+
+    for( i = 1; i + 1 < argc; i += 2 ) {
+        if( !strcmp( argv[i], "-p" ) ) port = atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-s" ) ) shards = (unsigned int)atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-c" ) ) clients = (unsigned int)atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-d" ) ) seconds = (unsigned int)atoi( argv[i+1] );
+        else {
+            fprintf( stderr, "usage: %s [-p port] [-s shards] [-c clients] [-d seconds]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if( shards < 1 ) shards = 1;
+    if( shards > BENCH_MAX_THREADS ) shards = BENCH_MAX_THREADS;
+    if( !clients ) clients = 2 * shards;
+    if( clients > BENCH_MAX_THREADS ) clients = BENCH_MAX_THREADS;
+    if( !seconds ) seconds = 1;
+
+    #ifndef SO_REUSEPORT
+    fprintf( stderr, "SO_REUSEPORT is not supported on this system\n" );
+    shards = 1;
+    #endif
+
+    printf( "accept benchmark: %u client threads, %u s per run\n", clients, seconds );
+    if( (single = bench_run( port, 1, clients, seconds )) < 0 ) return EXIT_FAILURE;
+    printf( "  single listener:      %12.0f accepts/s\n", single );
+    if( (sharded = bench_run( port, shards, clients, seconds )) < 0 ) return EXIT_FAILURE;
+    printf( "  %3u listener shards:  %12.0f accepts/s (%.2fx)\n", shards, sharded,
+            single > 0 ? sharded / single : 0.0 );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file bench_http_parser.c
+ *
+ *  Request header parsing benchmark. Compares the header parsing that was
+ *  used by http_request_read() before the http_parser module (strstr() per
+ *  line, three allocations and copies per header field) with the parser,
+ *  that scans the header once and copies the fields into one allocation.
+ *  The request is a typical browser request, the parser is also run with
+ *  the request arriving in three parts.
+ *
+ *  Usage: bench_http_parser [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "char_defines.h"
+#include "http_parser.h"
+#include "kvlist.h"
+
+static const char request[] =
+    "GET /static/css/site.css?v=3 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Referer: http://www.example.com/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: SESSIONID=4f1c2a9e8b7d6c5a; theme=dark; _ga=GA1.2.123456789.1700000000\r\n"
+    "If-None-Match: \"5f2a1c-1a2b\"\r\n"
+    "If-Modified-Since: Tue, 14 Nov 2023 08:12:31 GMT\r\n"
+    "\r\n";
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The header loop of the previous http_request_read(), the request line is
+ * split off with strchr()/strstr() before. Returns the number of fields. */
+static int parse_strstr( char *buf, kv_item **header_info )
+{
+    kv_item *lcurr = NULL, *ltemp;
+    char *pbuf = strchr( buf, ASCII_SPACE ), *pch;
+    int n = 0;
+
+    if( !pbuf || !(pbuf = strchr( pbuf + 1, ASCII_SPACE )) || !(pch = strstr( pbuf, ASCII_CRLF )) )
+        return -1;
+    pbuf = pch + 2;
+
+    while( pbuf && pbuf[0] ) {
+        char *pdblp;
+        if( (pch = strstr( pbuf, ASCII_CRLF )) == NULL ) return -1;
+        if( pch == pbuf ) break;
+        pch[0] = 0;
+        if( (pdblp = strchr( pbuf, ASCII_COLON )) ) {
+            pdblp[0] = 0;
+            ltemp = (kv_item*)malloc( sizeof(kv_item) );
+            if( !lcurr ) *header_info = ltemp;
+            else lcurr->next = ltemp;
+            lcurr = ltemp;
+            lcurr->next = NULL;
+            lcurr->key = (char*)malloc( strlen( pbuf ) + 1 );
+            strcpy( lcurr->key, pbuf );
+            pbuf = pdblp + 1;
+            if( pbuf[0] == ASCII_SPACE ) pbuf += 1;
+            lcurr->value = (char*)malloc( strlen( pbuf ) + 1 );
+            strcpy( lcurr->value, pbuf );
+            ++n;
+        }
+        pbuf = pch + 2;
+    }
+    return n;
+}
+
+/* The parser and the single allocation of the fields as in http_request_read(). */
+static int parse_incremental( const char *buf, size_t len, size_t parts, kv_item **header_info )
+{
+    http_parser_t parser;
+    size_t size, i, received = 0;
+    kv_item *items;
+    char *strings;
+    int ret = HTTP_PARSER_AGAIN;
+
+    http_parser_init( &parser );
+    for( i = 1; i <= parts && ret == HTTP_PARSER_AGAIN; ++i ) {
+        received = len * i / parts;
+        ret = http_parser_execute( &parser, buf, received );
+    }
+    if( ret != HTTP_PARSER_DONE ) return -1;
+
+    size = parser.num_fields * sizeof(kv_item);
+    for( i = 0; i < parser.num_fields; ++i )
+        size += parser.fields[i].name.len + parser.fields[i].value.len + 2;
+    *header_info = items = (kv_item*)malloc( size );
+    strings = (char*)&items[parser.num_fields];
+    for( i = 0; i < parser.num_fields; ++i ) {
+        const http_field_t *field = &parser.fields[i];
+        items[i].key = strings;
+        memcpy( strings, &buf[field->name.off], field->name.len );
+        strings += field->name.len;
+        *strings++ = 0;
+        items[i].value = strings;
+        memcpy( strings, &buf[field->value.off], field->value.len );
+        strings += field->value.len;
+        *strings++ = 0;
+        items[i].next = (i + 1 < parser.num_fields) ? &items[i + 1] : NULL;
+    }
+    return (int)parser.num_fields;
+}
+
+int main( int argc, char **argv )
+{
+    unsigned long iterations = 1000000, i;
+    char buf[sizeof(request)];
+    kv_item *header_info = NULL;
+    double start, t_strstr, t_single, t_parts;
+    int fields = 0;
+
+    for( i = 1; i + 1 < (unsigned long)argc; i += 2 ) {
+        if( !strcmp( argv[i], "-n" ) ) iterations = strtoul( argv[i+1], NULL, 10 );
+        else {
+            fprintf( stderr, "usage: %s [-n iterations]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if( !iterations ) iterations = 1;
+
+    start = now();
+    for( i = 0; i < iterations; ++i ) {
+        /* the previous parser writes into the buffer */
+        memcpy( buf, request, sizeof(request) );
+        fields += parse_strstr( buf, &header_info );
+        kvlist_free( header_info );
+        header_info = NULL;
+    }
+    t_strstr = now() - start;
+
+    start = now();
+    for( i = 0; i < iterations; ++i ) {
+        memcpy( buf, request, sizeof(request) );
+        fields -= parse_incremental( buf, sizeof(request) - 1, 1, &header_info );
+        free( header_info );
+    }
+    t_single = now() - start;
+
+    start = now();
+    for( i = 0; i < iterations; ++i ) {
+        memcpy( buf, request, sizeof(request) );
+        parse_incremental( buf, sizeof(request) - 1, 3, &header_info );
+        free( header_info );
+    }
+    t_parts = now() - start;
+
+    if( fields != 0 ) {
+        fprintf( stderr, "the parsers found different numbers of header fields\n" );
+        return EXIT_FAILURE;
+    }
+
+    printf( "header parsing benchmark: %lu requests of %u bytes\n", iterations,
+            (unsigned)sizeof(request) - 1 );
+    printf( "  strstr, malloc per field: %8.0f ns/request\n", t_strstr * 1e9 / iterations );
+    printf( "  http_parser:              %8.0f ns/request (%.2fx)\n", t_single * 1e9 / iterations,
+            t_single > 0 ? t_strstr / t_single : 0.0 );
+    printf( "  http_parser, 3 parts:     %8.0f ns/request (%.2fx)\n", t_parts * 1e9 / iterations,
+            t_parts > 0 ? t_strstr / t_parts : 0.0 );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file stress_connections.c
+ *
+ *  Concurrent connection stress test against a running server. All
+ *  connections are opened first and held open at the same time, then a
+ *  request is sent on every connection, at most window requests at once.
+ *  Fails if a connection cannot be opened or a request gets no reply.
+ *
+ *  Usage: stress_connections [-a address] [-p port] [-n connections]
+ *                            [-w window] [-u url]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+
+typedef struct {
+    int fd;
+    int status;                 /* http status of the reply, 0 if none yet */
+} stress_conn_t;
+
+static double _now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read the status of the reply */
+static void _read_status( stress_conn_t *conn )
+{
+    char buf[4096];
+    int len = (int)recv( conn->fd, buf, sizeof(buf) - 1, 0 );
+    if( len <= 0 ) return;
+    buf[len] = 0;
+    if( sscanf( buf, "HTTP/%*d.%*d %d", &conn->status ) != 1 )
+        conn->status = -1;
+}
+
+int main( int argc, char **argv )
+{
+    const char *address = "127.0.0.1", *url = "/index.html";
+    int port = 8181, count = 10000, window = 64, i;
+    int opened = 0, next = 0, ok = 0, unavailable = 0, failed = 0;
+    stress_conn_t *conns;
+    int *active_idx;
+    nfds_t active = 0, j;
+    struct pollfd *pfds;
+    struct sockaddr_in addr;
+    struct rlimit rl;
+    char request[512];
+    int reqlen;
+    double start;
+
+    for( i = 1; i + 1 < argc; i += 2 ) {
+        if( !strcmp( argv[i], "-a" ) ) address = argv[i+1];
+        else if( !strcmp( argv[i], "-p" ) ) port = atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-n" ) ) count = atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-w" ) ) window = atoi( argv[i+1] );
+        else if( !strcmp( argv[i], "-u" ) ) url = argv[i+1];
+        else {
+            fprintf( stderr, "usage: %s [-a address] [-p port] [-n connections] [-w window] [-u url]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if( count < 1 ) count = 1;
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+    if( window < 1 ) window = 1;
+
+    /* one descriptor per connection */
+    if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < (rlim_t)count + 16 ) {
+        rl.rlim_cur = (rlim_t)count + 16;
+        if( rl.rlim_max < rl.rlim_cur ) rl.rlim_max = rl.rlim_cur;
+        if( setrlimit( RLIMIT_NOFILE, &rl ) != 0 ) {
+            fprintf( stderr, "cannot raise open file limit to %d: %s\n", count + 16, strerror(errno) );
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( (unsigned short)port );
+    if( inet_pton( AF_INET, address, &addr.sin_addr ) != 1 ) {
+        fprintf( stderr, "invalid address %s\n", address );
+        return EXIT_FAILURE;
+    }
+    reqlen = snprintf( request, sizeof(request),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", url, address );
+
+    conns = (stress_conn_t*)calloc( count, sizeof(stress_conn_t) );
+    pfds = (struct pollfd*)calloc( window, sizeof(struct pollfd) );
+    active_idx = (int*)calloc( window, sizeof(int) );
+    if( !conns || !pfds || !active_idx ) return EXIT_FAILURE;
+
+    /* open all connections */
+    start = _now();
+    for( i = 0; i < count; ++i ) {
+        conns[i].fd = (int)socket( AF_INET, SOCK_STREAM, 0 );
+        if( conns[i].fd < 0 || connect( conns[i].fd, (struct sockaddr*)&addr, sizeof(addr) ) != 0 ) {
+            fprintf( stderr, "connection %d: %s\n", i, strerror(errno) );
+            if( conns[i].fd >= 0 ) close( conns[i].fd );
+            conns[i].fd = -1;
+            continue;
+        }
+        ++opened;
+    }
+    printf( "%d/%d connections open after %.2f s\n", opened, count, _now() - start );
+
+    /* send the requests, at most window at a time */
+    start = _now();
+    while( next < count || active ) {
+        while( next < count && active < (nfds_t)window ) {
+            stress_conn_t *conn = &conns[next];
+            if( conn->fd >= 0 ) {
+                if( send( conn->fd, request, reqlen, 0 ) == reqlen ) active_idx[active++] = next;
+                else ++failed;
+            }
+            ++next;
+        }
+        if( !active ) continue;
+        for( j = 0; j < active; ++j ) {
+            pfds[j].fd = conns[active_idx[j]].fd;
+            pfds[j].events = POLLIN;
+            pfds[j].revents = 0;
+        }
+        if( poll( pfds, active, 15000 ) <= 0 ) {
+            fprintf( stderr, "no reply within 15 s\n" );
+            break;
+        }
+        for( j = active; j-- > 0; ) {
+            stress_conn_t *conn;
+            if( !pfds[j].revents ) continue;
+            conn = &conns[active_idx[j]];
+            _read_status( conn );
+            if( conn->status >= 200 && conn->status < 400 ) ++ok;
+            else if( conn->status == 503 ) ++unavailable;
+            else ++failed;
+            close( conn->fd );
+            conn->fd = -1;
+            active_idx[j] = active_idx[--active];
+        }
+    }
+    printf( "%d replies in %.2f s: %d ok, %d service unavailable, %d failed, %d missing\n",
+            ok + unavailable + failed, _now() - start, ok, unavailable, failed,
+            opened - ok - unavailable - failed );
+
+    for( i = 0; i < count; ++i ) {
+        if( conns[i].fd >= 0 ) close( conns[i].fd );
+    }
+    free( conns );
+    free( pfds );
+    free( active_idx );
+    return (opened == count && ok + unavailable == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,47 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file block_deflate.h
+ *
+ *  Parallel deflate compression of large files. A file is split into blocks
+ *  of a fixed size that are compressed independently by a pool of
+ *  compression threads. Every block but the last one ends with a sync flush,
+ *  i.e. on a byte boundary without the final block bit, so the concatenated
+ *  blocks form one valid raw deflate stream.
+ *
+ *  The thread that compresses a file reads the blocks, queues them for the
+ *  compression threads and passes the compressed blocks on in order. Only a
+ *  small window of blocks is in memory at a time. If the queue of the pool
+ *  is full the thread compresses a block itself.
+ */
+
+#ifndef BLOCK_DEFLATE_H_
+#define BLOCK_DEFLATE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Called with the compressed blocks in order, returns 0 to stop. */
+typedef int (*block_deflate_write_t)( void *ctx, const char *data, size_t len );
+
+/** Start threads compression threads for the deflate level, files are split
+ * into blocks of block_size bytes. With 0 threads nothing is compressed in
+ * parallel. Returns NULL on error. */
+void * block_deflate_init( unsigned int threads, int level, size_t block_size );
+
+/** Returns 1 if a file of the given size is large enough to be compressed
+ * in parallel, smaller files are compressed faster in one go. */
+int block_deflate_parallel( void *bd, off_t size );
+
+/** Compress size bytes of a file into a raw deflate stream, the compressed
+ * blocks are passed to writer in order. Returns 0 if reading, compressing or
+ * writing failed. */
+int block_deflate_file( void *bd, int fd, off_t size, block_deflate_write_t writer, void *ctx );
+
+/** Stop the compression threads, all files have to be done before. */
+void block_deflate_free( void *bd );
+
+#endif /* BLOCK_DEFLATE_H_ */
@@ -14,6 +14,7 @@
  */
 
 #include <stddef.h>
+#include <time.h>
 #include <sys/types.h>
 
 #ifdef _WIN32
@@ -59,6 +60,7 @@ enum _CFILE_ACCESS {
 typedef struct {
     off_t size;
     short type;
+    time_t mtime;   /**< Time of the last modification. */
 } cfile_stat_t;
 
 /** File item. @see struct cfile_item_t */
@@ -89,6 +91,17 @@ const char * cfile_get_homedir();
 /** Return file information. */
 int cfile_getstat( const char *filename, cfile_stat_t *st );
 
+/** Open a file for reading. Returns a file descriptor or -1 on error. */
+int cfile_open_read( const char *filename );
+
+/** Read up to len bytes at offset from a file descriptor without using the
+ * file position, threads can share a descriptor. Returns the number of bytes
+ * read, 0 at the end of the file and -1 on error. */
+long cfile_pread( int fd, void *buf, size_t len, off_t offset );
+
+/** Close a file descriptor that was opened with cfile_open_read(). */
+void cfile_close( int fd );
+
 /** Frees the given file item, all the next items and children (but NOT the parent) */
 void cfile_item_free( cfile_item_t *cf_item );
 
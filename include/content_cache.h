@@ -0,0 +1,86 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file content_cache.h
+ *
+ *  In memory cache of small static files. An entry holds the content of a
+ *  file together with the pre-rendered header fields of its reply, so that
+ *  a hit is answered without any file I/O (see send_buffer_cached_reply()).
+ *
+ *  The cache is bounded by the total size of the cached content and by a
+ *  maximum file size. It is split into stripes by path hash, every stripe has
+ *  its own lock and evicts with the CLOCK algorithm: a hit only sets the
+ *  referenced bit of an entry, the clock hand skips (and clears) referenced
+ *  entries once and evicts the first unreferenced one. Cached content is only
+ *  returned if the modification time and size of the file still match.
+ *
+ *  Besides plain file content any content made from a file can be cached with
+ *  content_cache_put(), e.g. the compressed variant of a file.
+ */
+
+#ifndef CONTENT_CACHE_H_
+#define CONTENT_CACHE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+typedef struct content_cache_entry_s content_cache_entry_t;
+struct content_cache_entry_s {
+    const char *fields;     /**< pre-rendered header fields, each one starts with CRLF */
+    size_t fields_len;      /**< length of fields */
+    const char *data;       /**< file content */
+    size_t size;            /**< length of the file content */
+    time_t mtime;           /**< modification time of the file */
+    off_t file_size;        /**< size of the file */
+
+    /* cache internals */
+    char *path;
+    unsigned long hash;
+    long refs;              /**< number of users, protected by the stripe lock */
+    int cached;             /**< the entry is in the cache */
+    int referenced;         /**< used since the clock hand passed the last time */
+    content_cache_entry_t *next;         /**< next entry in the hash chain */
+    content_cache_entry_t *clock_prev;   /**< previous entry in the clock ring */
+    content_cache_entry_t *clock_next;   /**< next entry in the clock ring */
+};
+
+/** Initialize a content cache for up to max_memory bytes of content, files
+ * larger than max_file_size are not cached. A cache with max_memory 0 never
+ * caches anything. Returns NULL on error. */
+void * content_cache_init( size_t max_memory, size_t max_file_size );
+
+/** Returns 1 if a file of the given size can be cached. */
+int content_cache_fits( void *cache, off_t size );
+
+/** Look up the cached content of a file. Returns NULL if the file is not
+ * cached or if it was modified since, i.e. mtime or size differ. A returned
+ * entry has to be released with content_cache_release(). */
+content_cache_entry_t * content_cache_get( void *cache, const char *path, time_t mtime, off_t size );
+
+/** Returns 1 if the current content of a file is cached, without using it. */
+int content_cache_contains( void *cache, const char *path, time_t mtime, off_t size );
+
+/** Read size bytes of a file from a descriptor into the cache, together with
+ * the header fields of its reply. Returns the new entry, which has to be
+ * released, or NULL if the file can't be cached. */
+content_cache_entry_t * content_cache_add( void *cache, const char *path, int fd, time_t mtime,
+                                           off_t size, const char *fields, size_t fields_len );
+
+/** Cache content that was made from a file, e.g. compressed, together with
+ * the header fields of its reply. The content is copied. Returns the new
+ * entry, which has to be released, or NULL if the content can't be cached. */
+content_cache_entry_t * content_cache_put( void *cache, const char *path, time_t mtime, off_t file_size,
+                                           const char *fields, size_t fields_len,
+                                           const void *data, size_t size );
+
+/** Release an entry, NULL is ignored. */
+void content_cache_release( void *cache, content_cache_entry_t *entry );
+
+/** Free a content cache, all entries have to be released before. */
+void content_cache_free( void *cache );
+
+#endif /* CONTENT_CACHE_H_ */
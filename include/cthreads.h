@@ -6,7 +6,8 @@
 
 /** @file cthreads.h
  *
- *  CThreads wraps simple threads, mutexes, semaphores and a readers-writer_lock
+ *  CThreads wraps simple threads, mutexes, semaphores, a readers-writer_lock,
+ *  a bounded lock-free ring buffer and a pool of worker threads fed by it
  *  that can be used on both Posix and MS Windows systems.
  */
 
@@ -51,6 +52,38 @@ typedef struct {
     unsigned int max_readers;
 } c_rwlock;
 
+/** Size of a cache line, used to keep the ring positions apart. */
+#define CTHREAD_CACHE_LINE 64
+
+/** Ring buffer cell. */
+typedef struct {
+    volatile size_t seq;
+    void *data;
+} c_ring_cell;
+
+/** A bounded lock-free multi-producer multi-consumer ring buffer of pointers. */
+typedef struct {
+    c_ring_cell *cells;
+    size_t mask;
+    char pad0[CTHREAD_CACHE_LINE];
+    volatile size_t enqueue_pos;
+    char pad1[CTHREAD_CACHE_LINE];
+    volatile size_t dequeue_pos;
+    char pad2[CTHREAD_CACHE_LINE];
+} c_ring;
+
+/** Worker threads that are fed by a bounded queue (see cthread_pool_init()). */
+typedef struct c_pool_s c_pool;
+struct c_pool_s {
+    unsigned int num_workers;
+    c_thread *workers;          /**< worker threads */
+    c_ring queue;               /**< items waiting for a worker */
+    c_semaphore queue_items;    /**< number of queued items */
+    volatile int stop;
+    void (*run)( c_pool *pool );  /**< main function of the workers */
+    void *data;                 /**< user data of the pool */
+};
+
 /** The function starts a new thread in the calling process.
  * The new thread starts execution by invoking function();
  * parameter is passed as the sole argument of function().
@@ -111,6 +144,22 @@ size_t cthread_attr_getstacksize();
 /** Get the default stack size (only for posix threads). */
 int cthread_attr_setstacksize(size_t stacksize);
 
+/** Get the number of processors the calling thread may run on, i.e. the
+ * ones in its affinity mask, or the number of online processors if the
+ * mask is unknown. At least 1. */
+unsigned int cthread_cpu_count( void );
+
+/** Store the ids of up to max processors the calling thread may run on in
+ * cpus, in ascending order. Returns the number of stored ids. */
+unsigned int cthread_cpu_list( unsigned int *cpus, unsigned int max );
+
+/** Pin a thread to a single processor. Returns 0 on error or
+ * if setting the thread affinity is not supported on this system. */
+int cthread_set_affinity( c_thread *thread, unsigned int cpu );
+
+/** Atomically add delta to a value, returns the new value. */
+long cthread_atomic_add( volatile long *value, long delta );
+
 /** Initialize a semaphore. */
 int cthread_sem_init( c_semaphore *sem, unsigned int init_val );
 
@@ -167,4 +216,42 @@ int cthread_rwlock_write_trywait( c_rwlock *rwlock );
 /** Increments (unlocks) the writer semaphore in rwlock. */
 int cthread_rwlock_write_post( c_rwlock *rwlock );
 
+/** Initialize a ring buffer that can hold at least capacity elements,
+ * the capacity is rounded up to the next power of two. Returns 0 on error. */
+int cthread_ring_init( c_ring *ring, size_t capacity );
+
+/** Destroy a previously initialized ring buffer. */
+void cthread_ring_destroy( c_ring *ring );
+
+/** Returns the number of elements the ring buffer can hold. */
+size_t cthread_ring_capacity( const c_ring *ring );
+
+/** Add data to the ring buffer, data must not be NULL.
+ * Returns 0 if the ring buffer is full, never blocks. */
+int cthread_ring_push( c_ring *ring, void *data );
+
+/** Remove the oldest element from the ring buffer.
+ * Returns NULL if the ring buffer is empty, never blocks. */
+void * cthread_ring_pop( c_ring *ring );
+
+/** Start a pool of workers that are fed by a queue of at least queue_size
+ * items. Signals are left to the main thread, the workers block them and
+ * call run( pool ), which takes items with cthread_pool_pop() until it
+ * returns NULL. Returns 0 on error, the pool is destroyed then. */
+int cthread_pool_init( c_pool *pool, unsigned int workers, size_t queue_size,
+                       void (*run)( c_pool *pool ), void *data );
+
+/** Queue an item for the workers, item must not be NULL. Returns 0 if
+ * the queue is full or the pool is stopped, never blocks. */
+int cthread_pool_push( c_pool *pool, void *item );
+
+/** Take the next item from the queue (by a worker), blocks until an item
+ * is available. Returns NULL once the pool is stopped. */
+void * cthread_pool_pop( c_pool *pool );
+
+/** Stop and join the workers of a pool and destroy it. Items that are still
+ * queued are passed to discard, unless it is NULL. A zeroed pool that was
+ * never started is ignored. */
+void cthread_pool_destroy( c_pool *pool, void (*discard)( void *item ) );
+
 #endif /* CTHREADS_H_ */
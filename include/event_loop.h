@@ -0,0 +1,83 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file event_loop.h
+ *
+ *  The event loop (reactor) owns the listen sockets and all client
+ *  connections that are waiting for a request. As soon as a client
+ *  connection becomes readable it is handed over to the web thread
+ *  workers (see webthread.h). On Linux the loop is backed by io_uring
+ *  or epoll, other systems use a poll() based fallback (select() on
+ *  windows).
+ *
+ *  The deadlines of all connections are kept in a timer wheel owned by
+ *  the loop: idle connections are closed after the keep-alive timeout (or
+ *  the header timeout for new connections), and connections that are
+ *  handled by a worker have to deliver their request header and body in
+ *  time. A worker receives with blocking calls, when a deadline passes the
+ *  loop shuts the socket down for reading, which makes the receive return.
+ */
+
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include "webthread.h"
+
+/** Receive deadlines of a connection that is handled by a worker. */
+enum {
+    EVENT_DEADLINE_NONE = 0,  /**< nothing is received, no deadline */
+    EVENT_DEADLINE_HEADER,    /**< the request header has to be complete, set on dispatch */
+    EVENT_DEADLINE_BODY       /**< the request body has to make progress */
+};
+
+/** Maximum number of listen sockets the event loop can handle. */
+#define EVENT_LOOP_MAX_LISTENERS 8
+
+/** Initialize the event loop module. The base arguments are copied
+ * for every accepted connection. Returns NULL on error. */
+void * event_loop_init( thread_arg_t *baseargs );
+
+/** Add a listen socket to the event loop. Returns 0 on error. */
+int event_loop_add_listener( void *loop, int fd );
+
+/** Run the event loop until event_loop_stop() is called.
+ * Returns 0 if the loop was left because of an error. */
+int event_loop_run( void *loop );
+
+/** Stop a running event loop. This function is async-signal-safe. */
+void event_loop_stop( void *loop );
+
+/** Hand a client connection (back) to the event loop. The connection
+ * is dispatched to a worker once it is readable again. Returns 0 on error,
+ * in which case the caller still owns the connection. */
+int event_loop_watch( void *loop, thread_arg_t *conn );
+
+/** Send what is left of the replies on a connection, the buffered data and a
+ * deferred body (see SBF_DEFER), and hand the connection back to the event
+ * loop afterwards if keep_alive is set, or close it. The io_uring backend
+ * queues the reply on its ring, the file body is spliced through a pipe of the
+ * connection. Everything that is queued is submitted with one call and the
+ * next request is received once the reply is sent. Other backends send right
+ * away. The connection must not be used by the caller afterwards. */
+void event_loop_reply( void *loop, thread_arg_t *conn, send_buffer_t *sendbuf, int keep_alive );
+
+/** Set the receive deadline of a connection that is handled by a worker,
+ * the timeout starts now. A connection that misses its deadline is marked
+ * as timed out (thread_arg_t.timed_out) and shut down for reading. The
+ * body deadline is set again whenever a part of the body was received. */
+void event_loop_deadline( thread_arg_t *conn, int deadline );
+
+/** Returns the network address of a client connection. Connections accepted
+ * by the io_uring backend look up their address and port on the first call. */
+const char * event_loop_client_addr( thread_arg_t *conn );
+
+/** Close a client connection and free its thread arguments. */
+void event_loop_close( thread_arg_t *conn );
+
+/** Deinitialize the event loop module. */
+void event_loop_free( void *loop );
+
+#endif /* EVENT_LOOP_H_ */
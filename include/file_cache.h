@@ -0,0 +1,68 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file file_cache.h
+ *
+ *  Cache of stat results and open read only descriptors of the files in the
+ *  www root, keyed by the request path. Missing files are cached as well, so
+ *  repeated requests for a file that does not exist don't hit the file system.
+ *
+ *  Entries are valid for a fixed time (ttl) and are looked up again afterwards.
+ *  The number of entries and of cached descriptors is bounded, least recently
+ *  used entries are dropped first. An entry that is in use is reference counted,
+ *  its descriptor stays open until it is released even if the entry is dropped
+ *  in the meantime. The cache is split into stripes with their own lock, so
+ *  threads only contend for the same stripe.
+ */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <time.h>
+
+#include "cfile.h"
+
+typedef struct file_cache_entry_s file_cache_entry_t;
+struct file_cache_entry_s {
+    int status;             /**< CFILE_SUCCESS or CFILE_DOES_NOT_EXIST */
+    cfile_stat_t st;        /**< file information if the file exists */
+    int fd;                 /**< read only descriptor of a regular file, -1 if
+                                 the file could not be opened. Shared between
+                                 threads, use cfile_pread() or sendfile(). */
+
+    /* cache internals */
+    char *path;
+    unsigned long hash;
+    time_t expires;         /**< the entry is looked up again at this time */
+    long refs;              /**< number of users, protected by the stripe lock */
+    int cached;             /**< the entry is in the cache */
+    file_cache_entry_t *next;        /**< next entry in the hash chain */
+    file_cache_entry_t *lru_prev;    /**< more recently used entry */
+    file_cache_entry_t *lru_next;    /**< less recently used entry */
+};
+
+/** Initialize a file cache with up to max_entries entries and max_fds open
+ * descriptors, entries are valid for ttl_sec seconds. With max_entries 0
+ * nothing is cached, every lookup hits the file system. Returns NULL on error. */
+void * file_cache_init( unsigned int max_entries, unsigned int max_fds, unsigned int ttl_sec );
+
+/** Look up a file. The entry has to be released with file_cache_release().
+ * Returns NULL if no memory could be allocated. */
+file_cache_entry_t * file_cache_get( void *cache, const char *path );
+
+/** Look up a file in the cache only, the file system is not accessed. Returns
+ * NULL if the file is not cached or its entry expired, an entry has to be
+ * released with file_cache_release(). */
+file_cache_entry_t * file_cache_peek( void *cache, const char *path );
+
+/** Release an entry that was returned by file_cache_get() or file_cache_peek(),
+ * NULL is ignored. */
+void file_cache_release( void *cache, file_cache_entry_t *entry );
+
+/** Free a file cache, all entries have to be released before. */
+void file_cache_free( void *cache );
+
+#endif /* FILE_CACHE_H_ */
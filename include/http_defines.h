@@ -11,6 +11,7 @@
 /** @{ */
 #define HTTP_STATUS_OK                      200
 #define HTTP_STATUS_NO_CONTENT              204
+#define HTTP_STATUS_PARTIAL_CONTENT         206
 
 #define HTTP_STATUS_FOUND                   302
 #define HTTP_STATUS_SEE_OTHER               303  /* HTTP/1.1 */
@@ -25,8 +26,11 @@
 #define HTTP_STATUS_LENGTH_REQUIRED         411
 #define HTTP_STATUS_REQUEST_ENT_TOO_LARGE   413 /* request entity too large */
 #define HTTP_STATUS_REQUEST_URI_TOO_LONG    414
+#define HTTP_STATUS_RANGE_NOT_SATISFIABLE   416
+#define HTTP_STATUS_HEADER_FIELDS_TOO_LARGE 431 /* RFC 6585 */
 
 #define HTTP_STATUS_INTERNAL_SERVER_ERROR   500
+#define HTTP_STATUS_SERVICE_UNAVAILABLE     503
 #define HTTP_STATUS_VERSION_NOT_SUPPORTED   505
 /* @} */
 
@@ -39,11 +43,19 @@
 #define HTTP_HEADER_EXPIRES             "Expires"
 #define HTTP_HEADER_PRAGMA              "Pragma"
 #define HTTP_HEADER_IF_MODIFIED_SINCE   "If-Modified-Since"
+#define HTTP_HEADER_IF_NONE_MATCH       "If-None-Match"
+#define HTTP_HEADER_LAST_MODIFIED       "Last-Modified"
+#define HTTP_HEADER_ETAG                "ETag"
 #define HTTP_HEADER_TRANSER_ENCODING    "Transfer-Encoding"
 #define HTTP_HEADER_CONTENT_ENCODING    "Content-Encoding"
 #define HTTP_HEADER_CONNECTION          "Connection"
 #define HTTP_HEADER_DATE                "Date"
+#define HTTP_HEADER_RETRY_AFTER         "Retry-After"
 #define HTTP_HEADER_ACCEPT_RANGES       "Accept-Ranges"
+#define HTTP_HEADER_RANGE               "Range"
+#define HTTP_HEADER_IF_RANGE            "If-Range"
+#define HTTP_HEADER_CONTENT_RANGE       "Content-Range"
+#define HTTP_HEADER_VARY                "Vary"
 
 /* The Content-Disposition header can be used to 'force' a browser to open
  * a save-as dialog for the retrieved file instead of showing it
@@ -97,6 +109,7 @@
 
 #define HTTP_CONTENT_TYPE_POST_WWW_FORM  "application/x-www-form-urlencoded"
 #define HTTP_CONTENT_TYPE_MULTIPART_FORM "multipart/form-data"
+#define HTTP_CONTENT_TYPE_MULTIPART_BYTERANGES "multipart/byteranges"
 
 /* HTTP versions */
 #define HTTP_VERSION_1_0    0
@@ -0,0 +1,78 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file http_parser.h
+ *
+ *  Incremental parser for the header of a HTTP request. The parser does not
+ *  allocate or copy anything, it records the parts of the request line and
+ *  the header fields as slices (offset and length) of the receive buffer.
+ *
+ *  The buffer holds all bytes that were received so far. Every call continues
+ *  where the last one stopped, so a header that arrives in several parts is
+ *  only scanned once. As only offsets are stored, the buffer may be moved
+ *  between calls, e.g. by realloc().
+ *
+ *  @code{.c}
+ *  http_parser_t parser;
+ *  http_parser_init( &parser );
+ *  while( (ret = http_parser_execute( &parser, buf, len )) == HTTP_PARSER_AGAIN )
+ *      len += recv( fd, &buf[len], size - len, 0 );
+ *  @endcode
+ */
+
+#ifndef HTTP_PARSER_H_
+#define HTTP_PARSER_H_
+
+#include <stddef.h>
+
+/** Maximum number of header fields of a request. */
+#define HTTP_PARSER_MAX_FIELDS 64
+
+/** Results of http_parser_execute(). */
+enum _HTTP_PARSER_RESULTS {
+    HTTP_PARSER_AGAIN = 0,          /**< the header is incomplete, more bytes are needed */
+    HTTP_PARSER_DONE,               /**< the header is complete */
+    HTTP_PARSER_MALFORMED,          /**< the request is malformed */
+    HTTP_PARSER_TOO_MANY_FIELDS     /**< more than HTTP_PARSER_MAX_FIELDS header fields */
+};
+
+/** Part of the receive buffer. */
+typedef struct {
+    size_t off;
+    size_t len;
+} http_slice_t;
+
+/** Header field, the value is without leading and trailing whitespace. */
+typedef struct {
+    http_slice_t name;
+    http_slice_t value;
+} http_field_t;
+
+/** Parser state and the parts of the request that were found so far. */
+typedef struct {
+    int state;
+    size_t pos;                 /**< number of bytes parsed */
+    size_t value_end;           /**< end of the value without trailing whitespace */
+    http_slice_t method;
+    http_slice_t target;        /**< request target (url) */
+    http_slice_t version;       /**< protocol version, empty if not sent */
+    unsigned int num_fields;
+    http_field_t fields[HTTP_PARSER_MAX_FIELDS];
+} http_parser_t;
+
+/** Prepare a parser for a new request. */
+void http_parser_init( http_parser_t *parser );
+
+/** Continue parsing the header in the first len bytes of buf. Returns one
+ * of the _HTTP_PARSER_RESULTS. Once the header is complete, parser->pos is
+ * the length of the header including the empty line, bytes behind it belong
+ * to the body or to the next request. */
+int http_parser_execute( http_parser_t *parser, const char *buf, size_t len );
+
+/** Returns non-zero once the request line was parsed completely. */
+int http_parser_line_done( const http_parser_t *parser );
+
+#endif /* HTTP_PARSER_H_ */
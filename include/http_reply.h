@@ -7,16 +7,36 @@
 #ifndef HTTP_REPLY_H_
 #define HTTP_REPLY_H_
 
+#include <sys/types.h>
+
 #include "kvlist.h"
 
 /** Send buffer flags. */
 enum {
-	SBF_NONE    = 0,             /**< No option. */
-	SBF_CHUNKED = 1 << 0         /**< Chunked send buffer */
-	// SBF_OTHERFLAG = 1 << 1,
-	// SBF_ANOTHER   = 1 << 2,
+	SBF_NONE       = 0,          /**< No option. */
+	SBF_CHUNKED    = 1 << 0,     /**< Chunked send buffer */
+	SBF_KEEP_ALIVE = 1 << 1,     /**< Keep the connection open after the reply. Cleared
+	                                  by the http header functions if the reply is not
+	                                  framed with a Content-Length or chunked encoding. */
+	SBF_HEAD       = 1 << 2,     /**< Reply to a HEAD request, only the header is sent. */
+	SBF_NO_BODY    = 1 << 3,     /**< Set by the http header functions for HEAD replies,
+	                                  all following data is discarded. */
+	SBF_DEFER      = 1 << 4      /**< Last reply on the connection, the body of a file or
+	                                  cached reply is not sent right away but left to the
+	                                  event loop (see send_buffer_hold()). */
 };
 
+/** Body of a reply that was deferred (SBF_DEFER), it follows the buffered data. */
+typedef struct {
+	const char *data;	/**< Body in memory, NULL for a file. */
+	int fd;				/**< File descriptor of a file body. */
+	off_t offset;		/**< Offset of a file body. */
+	off_t len;			/**< Length of the body, 0 if none is deferred. */
+	void (*release)( void *owner, void *ref );	/**< Called once the body is sent, or NULL. */
+	void *owner;
+	void *ref;
+} send_body_t;
+
 /** Send buffer. */
 typedef struct {
 	int sockdesc;		/**< Socket descriptor. */
@@ -24,6 +44,7 @@ typedef struct {
 	int flags;			/**< Buffer flags. */
 	size_t bufsize;		/**< Buffer size. */
 	size_t curpos;		/**< Current position in buffer. */
+	send_body_t body;	/**< Deferred body. */
 } send_buffer_t;
 
 /** Returns pointer to a http status message for a given http status code. */
@@ -36,17 +57,49 @@ void send_buffer_init( send_buffer_t *sendbuf, const int fd, char *buf,
 /** Flush send buffer (for in-between calls ). */
 int send_buffer_flush( send_buffer_t *sendbuf );
 
+/** Send len bytes of an open file descriptor starting at offset, after the data
+ * in the send buffer. On Linux the file is sent with sendfile() without copying
+ * it through user space, the buffered data (i.e. the http header) is sent with
+ * MSG_MORE so that it goes out together with the first bytes of the file.
+ * Elsewhere the file is read into the send buffer. The file position is not
+ * used, the descriptor can be shared between threads. With SBF_DEFER the file
+ * is only noted as body of the reply. Returns 0 on error. */
+int send_buffer_file( send_buffer_t *sendbuf, int fd, off_t offset, off_t len );
+
 /** Flush send buffer ( for last send (call this just before closing the socket) ) */
 int send_buffer_flush_last( send_buffer_t *sendbuf );
 
+/** Keeps a reference for the body of the last file or cached reply if it was
+ * deferred (SBF_DEFER), release( owner, ref ) is called once the body is sent.
+ * Has to be called right after the reply. Returns 0 if nothing was deferred,
+ * the caller keeps the reference then. */
+int send_buffer_hold( send_buffer_t *sendbuf, void (*release)( void *owner, void *ref ),
+                      void *owner, void *ref );
+
+/** Send the buffered data and a deferred body right away. Data that is added
+ * to a send buffer with a deferred body sends them first. Returns 0 on error. */
+int send_buffer_flush_body( send_buffer_t *sendbuf );
+
 /** Sends a simple http header with a content type field to a send buffer. */
 void send_buffer_simple_http_header(send_buffer_t *sendbuf, const int http_status, 
                                     const char* content_type, const int version);
                                     
-/** Sends a http header with all fields in header_info to a send buffer */
+/** Sends a http header with all fields in header_info to a send buffer.
+ * The Connection header field is chosen depending on the SBF_KEEP_ALIVE flag
+ * and the framing of the reply. */
 void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status, 
                              const kv_item *header_info, const int version);
                              
+/** Send a complete reply with pre-rendered header fields and a body, together
+ * with the data that is still in the send buffer, in one writev() call. Every
+ * header field in fields has to start with CRLF, the Content-Length field has
+ * to be included. The body is left out for HEAD requests (SBF_HEAD). With
+ * SBF_DEFER the header is buffered and the body deferred, if the header fits.
+ * Returns the number of bytes sent (or buffered) or -1 on error. */
+int send_buffer_cached_reply( send_buffer_t *sendbuf, const int http_status, const char *fields,
+                              const size_t fields_len, const void *body, const size_t body_len,
+                              const int version );
+
 /** Send data with given len to a send buffer */
 void send_buffer_data(send_buffer_t *sendbuf, const void *data, const size_t len);
 
@@ -69,6 +122,11 @@ void send_buffer_string_data(send_buffer_t *sendbuf, char * str, size_t len);
 void send_buffer_error_info(send_buffer_t *sendbuf, const char *filename,
                             const int status, const int http_ver );
 
+/** Like send_buffer_error_info(), with additional header fields
+ * in header_info (e.g. Retry-After). */
+void send_buffer_error_info_header(send_buffer_t *sendbuf, const char *filename,
+                                   const int status, const kv_item *header_info, const int http_ver );
+
 /** Escapes double quotes and newline with a backslash when adding to send buffer */
 void send_buffer_json_ascii(send_buffer_t *sendbuf, const char *str);
 
@@ -7,6 +7,8 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <sys/types.h>
+
 #include "kvlist.h"
 #include "webthread.h"
 
@@ -18,7 +20,8 @@
 #endif
 
 /* The following defines affect the buffer sizes and memory usage: */
-  /** Maxium total length (including \r\n) of each http header line */
+  /** Size of the receive buffer if none is given to http_request_read(),
+   * the complete request header has to fit into it */
   #define MAX_HTTP_HEADER_LINE           4096
   /** Maximum length in kilobytes of a x-www-form-urlencoded field
    * of a post request. This means that for instance the text in a textarea
@@ -27,10 +30,6 @@
   /* TODO refactor & explain */
   #define MIN_POST_FORM_BUF_SIZE        2048
 
-/** Timeout in seconds when receiving data,
- * TODO This should be a setting */
-#define REQUEST_RECV_TIMEOUT		    10
-
 enum _RECV_FUNC_RETURNS_ {
     RECV_SOCKET_ERROR = SOCKET_ERROR,
     RECV_SELECT_ERROR = -2,
@@ -49,6 +48,8 @@ enum _REQUEST_READ_RETURNS {
     RRT_ALLOCATION_ERROR,
     RRT_TE_NOT_SUPPORTED, /**< Transfer encoding not supported. */
     RRT_CT_NOT_SUPPORTED, /**< Content type not supported. */
+    RRT_CONNECTION_CLOSED, /**< Connection closed by the client before a request was sent. */
+    RRT_TOO_MANY_HEADER_FIELDS, /**< More header fields than HTTP_PARSER_MAX_FIELDS. */
     RRT_UNKNOWN_ERR
 };
 
@@ -131,24 +132,51 @@ typedef struct {
 
     short http_version;		/**< HTTP version of request */
     short scripting;		/**< which server side scripting should be used to process return request.. */
+    short keep_alive;       /**< 1 if the client wants to keep the connection open */
 
     kv_item *get_vars;		/**< The list of GET variables (key/values) */
     kv_item *post_vars;		/**< The list of POST variables (key/values) */
 
     postdata_t *post_info;  /** TODO describe */
 
-    kv_item *header_info;   /**< The list of header fields and their values */
+    kv_item *header_info;   /**< The list of header fields and their values, allocated
+                                 as one block together with the names and values */
     kv_item *cookie_info;   /**< The list of cookies and their values */
 } http_req_info_t;
 
+/** A byte range of a file, first and last are byte positions (inclusive). */
+typedef struct {
+    off_t first;
+    off_t last;
+} http_range_t;
+
 /** Free a http_req_info_t struct object */
 void free_req_info( http_req_info_t* req_info );
 
-/** Read a HTTP request. */
+/** Read a HTTP request. Bytes that were received after the header of a
+ * request without body are kept in the connection (args) and are
+ * used as the beginning of the next request. */
 http_req_info_t* http_request_read( thread_arg_t *args, const int flags, int* err, char* getbuf, size_t buflen );
-int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t* req_info );
-int http_request_recv_post_and_throw_away( const int fd, http_req_info_t* req_info, char* buf, size_t buflen );
-int http_request_recv_until_timeout_or_error( const int fd, char* buf, size_t buflen );
+
+/** Returns 1 if the complete header of a pipelined request was already
+ * received on the connection, the request can be read without waiting.
+ * The header ends as http_parser_execute() decides, bare LF line ends
+ * included. */
+int http_request_pending( const thread_arg_t *args );
+
+/** Append bytes that were already received on the connection (e.g. by the
+ * event loop) to the beginning of the next request. Returns 0 on error. */
+int http_request_pending_append( thread_arg_t *args, const char *data, size_t len );
+int http_request_read_post_vars_urlencoded( thread_arg_t *args, http_req_info_t* req_info );
+int http_request_recv_post_and_throw_away( thread_arg_t *args, http_req_info_t* req_info, char* buf, size_t buflen );
+int http_request_recv_until_timeout_or_error( thread_arg_t *args, char* buf, size_t buflen );
+
+/** Parse the value of a Range header field for a file of the given size,
+ * see http://tools.ietf.org/html/rfc7233#section-2.1. The satisfiable ranges are
+ * stored in ranges, positions behind the end of the file are clipped. Returns the
+ * number of satisfiable ranges, 0 if there are none (416 reply), or -1 if the header
+ * is invalid or has more than max_ranges ranges and has to be ignored. */
+int http_request_parse_range( const char *value, const off_t size, http_range_t *ranges, const int max_ranges );
 
 /** Takes a request type enum value and returns the corresponding character string. */
 const char * http_request_type_to_str( const int type );
@@ -156,6 +184,8 @@ const char * http_request_type_to_str( const int type );
 #ifdef HTTP_REQUEST_IMPL_
 int _recv_data_timed( const int fd, char *buf, const int buflen, const unsigned int timeout_sec );
 int _recv_data_timed_rrt( const int fd, char *buf, const int buflen, const unsigned int timeout_sec );
+/* receive on a connection that is handled by a worker, the event loop enforces its deadline */
+int _recv_data_conn( thread_arg_t *args, char *buf, const int buflen );
 #endif
 
 #endif /* HTTP_REQUEST_H_ */
@@ -26,13 +26,70 @@
  * # ipv6 = 1 or 0, 1 by default / enables or disables ipv6 support
  * # deflate = 0-9, 0 is off = default, 1-9 is compression level, 
  *                              while 1 is the fastest and 9 the best compression
+ * # deflate_cache_limit_mb = memory for compressed static files, every file is only
+ *                            compressed once while it is cached, 0 disables the
+ *                            cache - 16 by default
+ * # deflate_cache_file_limit_kb = maximum size of a file that is compressed into the
+ *                                 cache, larger files are compressed on every
+ *                                 request - 1024 by default
+ * # deflate_threads = number of threads that compress large files in blocks in parallel,
+ *                     0 compresses every file on the thread that answers it - 4 by default
+ * # deflate_block_kb = size of the blocks large files are split into, files of at least
+ *                      four blocks are compressed in parallel - 128 by default
  * # disable_embedded_res = 0 or 1, 0 by default
+ * # resource_bundle = resource bundle file (see mkcres.py bundle) that is mapped at
+ *                     startup, its resources are used before the compiled in
+ *                     ones, none by default
+ * # workers = number of web thread workers, 8 by default
+ * # queue_size = maximum number of connections waiting for a worker, 
+ *                further connections are rejected with 503 - 256 by default
+ * # io_workers = number of i/o workers that answer static file requests which need
+ *               file system access, 0 to answer them on the web thread workers - 8 by default
+ * # io_queue_size = maximum number of static file requests waiting for an i/o worker,
+ *                   further requests are rejected with 503 - 256 by default
+ * # keepalive_timeout = seconds an idle persistent connection is kept open, 
+ *                       0 disables persistent connections - 5 by default
+ * # keepalive_max_requests = maximum number of requests per connection, 100 by default
+ * # request_header_timeout = seconds a client has to send the complete request header,
+ *                            counted from the connect or from the end of the keep-alive
+ *                            idle time - 10 by default
+ * # request_body_timeout = seconds the request body may stall before the request
+ *                          times out - 10 by default
+ * # io_engine = io_uring, epoll or poll, unavailable engines fall back
+ *               to the next one in this order - io_uring by default
+ * # listen_shards = number of SO_REUSEPORT listener shards, each with its own event loop
+ *                   and workers pinned to one cpu, -1 for one per cpu - 0 (off) by default
+ * # listen_backlog = length of the accept queue of each listen socket,
+ *                    0 for the system maximum (SOMAXCONN) - 0 by default
+ * # max_static_requests = maximum number of static file requests handled at the same
+ *                         time, 0 for no limit - 0 by default
+ * # max_embedded_requests = maximum number of embedded resource requests handled at the
+ *                           same time, 0 for no limit - 0 by default
+ * # max_lua_requests = maximum number of lua page requests handled at the same time,
+ *                      0 for no limit - 0 by default
+ * # retry_after = seconds sent in the Retry-After header of 503 replies when the
+ *                 server is overloaded, 0 to leave it out - 1 by default
+ * # file_cache_entries = number of www root lookups (stat results, open files and
+ *                        missing files) that are cached, 0 disables the cache - 1024 by default
+ * # file_cache_fds = maximum number of open files kept in the cache - 256 by default
+ * # file_cache_ttl = seconds a cached lookup is used before the file is looked up
+ *                    again - 2 by default
+ * # content_cache_limit_mb = memory for the content of small static files that are
+ *                            served from memory, 0 disables the cache - 16 by default
+ * # content_cache_file_limit_kb = maximum size of a file in the content cache - 64 by default
+ * # precompressed = 1 or 0, serve precompressed files (file.gz or file.deflate next to
+ *                   file) and the deflate variants of embedded resources to clients
+ *                   that accept the encoding - 1 by default
  *
  * # [scripting]
  * # enabled = 0 or 1,  1 by default
  * # error_output_socket = 1 or 0, 1 by default
  * # session_timeout = ..     1800 by default
  * # caching = 0 or 1, 0 by default
+ * # workers = number of script workers that answer lua page requests, 0 to answer
+ *             them on the web thread workers - 4 by default
+ * # queue_size = maximum number of lua page requests waiting for a script worker,
+ *                further requests are rejected with 503 - 64 by default
  * 
  * # [scripting_cache]  ; only used if scripting.caching = 1
  * # cache_tmpfile = 0 or 1, 1 by default (if scripting caching =1)
@@ -48,6 +105,13 @@
 #define WEBSRV_PORT_NOT_SET  -1
 #define SETTING_VAL_NOT_SET  WEBSRV_PORT_NOT_SET
 
+/** I/O engines of the event loop, in the order they fall back to each other. */
+enum {
+    IO_ENGINE_IO_URING = 0,  /**< io_uring (linux >= 5.11) */
+    IO_ENGINE_EPOLL,         /**< epoll (linux) */
+    IO_ENGINE_POLL           /**< poll, or select on windows - available everywhere */
+};
+
 #if LUA_SUPPORT
     enum {
         LUASP_CACHING_NONE = 0,        /**< Lua caching off. */
@@ -64,6 +128,11 @@
         unsigned session_timeout;
         /** Lua caching enabled/disabled, default is LUASP_CACHING_NONE (0) */
         int cache; /*  NOT YET SUPPORTED */
+        /** Number of script workers, 0 to run scripts on the web thread workers.
+         * The default is 4. */
+        unsigned int workers;
+        /** Maximum number of requests waiting for a script worker, default is 64 */
+        unsigned int queue_size;
     } scripting_t;
 #endif
 
@@ -78,11 +147,63 @@ typedef struct {
     char *logfile;         /**< The log output file */
 
     int disable_er;        /**< Disable embedded resource lookups if 1 - default is 0. */
+    char *resource_bundle; /**< Resource bundle file, none by default. */
+
+    unsigned int workers;    /**< Number of web thread workers. The default is 8. */
+    unsigned int queue_size; /**< Maximum number of connections waiting for a worker.
+                                  The default is 256. */
+    unsigned int io_workers;    /**< Number of i/o workers for static files that are not
+                                     in memory, 0 is off. The default is 8. */
+    unsigned int io_queue_size; /**< Maximum number of requests waiting for an i/o worker.
+                                     The default is 256. */
+    unsigned int keepalive_timeout;      /**< Idle timeout in seconds for persistent
+                                              connections, 0 is off. The default is 5. */
+    unsigned int keepalive_max_requests; /**< Maximum number of requests per connection.
+                                              The default is 100. */
+    unsigned int request_header_timeout; /**< Seconds until the request header has to be
+                                              received completely. The default is 10. */
+    unsigned int request_body_timeout;   /**< Seconds the request body may stall.
+                                              The default is 10. */
+    int io_engine;           /**< I/O engine of the event loop (IO_ENGINE_*).
+                                  The default is IO_ENGINE_IO_URING. */
+    int listen_shards;       /**< Number of SO_REUSEPORT listener shards, -1 for one per cpu.
+                                  The default is 0 (one listener). */
+    unsigned int listen_backlog;      /**< Accept queue length of the listen sockets,
+                                           0 is the system maximum. The default is 0. */
+    unsigned int max_static_requests; /**< Maximum number of static file requests in progress,
+                                           0 is no limit. The default is 0. */
+    unsigned int max_embedded_requests; /**< Maximum number of embedded resource requests
+                                             in progress, 0 is no limit. The default is 0. */
+    unsigned int max_lua_requests;    /**< Maximum number of lua requests in progress,
+                                           0 is no limit. The default is 0. */
+    unsigned int retry_after;         /**< Retry-After seconds of 503 overload replies,
+                                           0 is off. The default is 1. */
+    unsigned int file_cache_entries;  /**< Number of cached www root lookups, 0 is off.
+                                           The default is 1024. */
+    unsigned int file_cache_fds;      /**< Maximum number of cached open files.
+                                           The default is 256. */
+    unsigned int file_cache_ttl;      /**< Seconds a cached lookup is valid.
+                                           The default is 2. */
+    unsigned int content_cache_limit_mb;      /**< Memory of the static content cache in MB,
+                                                   0 is off. The default is 16. */
+    unsigned int content_cache_file_limit_kb; /**< Maximum size of a cached file in KB.
+                                                   The default is 64. */
+    int precompressed;     /**< Serve precompressed .gz/.deflate variants of static files
+                                if they exist and the deflate variants of embedded
+                                resources, the default is enabled (1). */
 
 #ifdef DEFLATE_SUPPORT
     int deflate;           /**< Auto compress static content for compressible 
                                 MIME types with deflate if the client supports it.
                                 The default is off (0). */
+    unsigned int deflate_cache_limit_mb;      /**< Memory for compressed static files in MB,
+                                                   0 is off. The default is 16. */
+    unsigned int deflate_cache_file_limit_kb; /**< Maximum size of a file that is compressed
+                                                   into the cache in KB. The default is 1024. */
+    unsigned int deflate_threads;  /**< Number of threads that compress large files in
+                                        parallel, 0 is off. The default is 4. */
+    unsigned int deflate_block_kb; /**< Size of the independently compressed blocks in KB.
+                                        The default is 128. */
 #endif
 
 #if LUA_SUPPORT
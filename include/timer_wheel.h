@@ -0,0 +1,72 @@
+/* cranberry-server
+ * https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file timer_wheel.h
+ *
+ *  Hierarchical timer wheel. Timers are entries embedded in the data they
+ *  belong to, adding and removing a timer takes constant time and expiring
+ *  timers only touches the timers that expire (plus a cascade of an upper
+ *  level slot once per round of the level below).
+ *
+ *  Deadlines are absolute times in milliseconds, the wheel advances in ticks
+ *  of a fixed resolution. Timers never expire before their deadline and at
+ *  most one tick after it. The wheel is not thread safe, the owner has to
+ *  serialize access.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stddef.h>
+
+/** Number of slots per level is 1 << TIMER_WHEEL_BITS. */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+/** Number of levels, deadlines up to TIMER_WHEEL_SLOTS^TIMER_WHEEL_LEVELS ticks
+ * ahead are exact, later ones are cascaded until they are in range. */
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct timer_entry_s timer_entry_t;
+struct timer_entry_s {
+    timer_entry_t *next;      /**< next entry in the slot or in the expired list */
+    timer_entry_t *prev;      /**< previous entry in the slot */
+    timer_entry_t **slot;     /**< slot the entry is in, NULL if the timer is not armed */
+    unsigned long expires;    /**< tick at which the timer expires */
+    void *data;               /**< user data */
+};
+
+typedef struct {
+    unsigned long tick;       /**< next tick that is processed */
+    unsigned int resolution;  /**< milliseconds per tick */
+    size_t count;             /**< number of armed timers */
+    timer_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/** Returns 1 if a timer entry is armed. */
+#define TIMER_ENTRY_ARMED(entry) ((entry)->slot != NULL)
+
+/** Initialize a timer wheel, now is the current time in milliseconds. */
+void timer_wheel_init( timer_wheel_t *wheel, unsigned long now, unsigned int resolution );
+
+/** Initialize a timer entry that is not armed. */
+void timer_entry_init( timer_entry_t *entry, void *data );
+
+/** Arm a timer with a deadline in milliseconds. An armed timer is moved. */
+void timer_wheel_add( timer_wheel_t *wheel, timer_entry_t *entry, unsigned long deadline );
+
+/** Disarm a timer, nothing happens if the timer is not armed. */
+void timer_wheel_remove( timer_wheel_t *wheel, timer_entry_t *entry );
+
+/** Advance the wheel to now and remove all expired timers. Returns the
+ * expired entries as a list linked by their next field, NULL if none. */
+timer_entry_t * timer_wheel_expire( timer_wheel_t *wheel, unsigned long now );
+
+/** Milliseconds until timer_wheel_expire() has to be called again, -1 if
+ * no timer is armed. The time might be shorter than the time until the
+ * next deadline when upper levels have to be cascaded first. */
+long timer_wheel_next( const timer_wheel_t *wheel, unsigned long now );
+
+#endif /* TIMER_WHEEL_H_ */
@@ -11,21 +11,24 @@
 
 #include "config.h"
 
+#include "cresource.h"
 #include "cthreads.h"
 #include "http_reply.h"
+#include "timer_wheel.h"
 
 /** Caching age send to browser for static resources. */
 #define STATIC_CACHE_AGE_MAX 21600         /* 6 hours */
 /** Caching age send to browser for embedded static resources. */
 #define EMBEDDED_RES_CACHE_AGE_MAX 604800  /* 7 days */
 
-/** Argument struct for server threads */
-typedef struct {
-    /* filled in by main server thread: */
+/** Argument struct for server threads, one per client connection. */
+typedef struct thread_arg_s thread_arg_t;
+struct thread_arg_s {
+    /* filled in by the event loop: */
     int fd;             /**< open socket */
     size_t hit;         /**< hit number */
-    char *client_addr;  /**< client network address */
-    int client_port;    /**< client port */
+    char *client_addr;  /**< client network address, use event_loop_client_addr() */
+    int client_port;    /**< client port, set together with client_addr */
 
     /* pointers to settings and initialization/runtime
        data from different server modules */
@@ -33,21 +36,67 @@ typedef struct {
     void *pDataSrvThreads;
     void *pDataSrvCmds;
     void *pDataSrvSessions;
+    void *pDataEventLoop;
+    void *pDataFileCache;
+    void *pDataContentCache;
+    void *pDataDeflateCache;
+    void *pDataBlockDeflate;
+    void *pDataResourceBundle;
     #if LUA_SUPPORT
         void *pDataLuaScripting;
     #endif
+    int cpu;            /**< cpu the listener shard is pinned to, -1 if not pinned */
 
     /* buffer, set by the request handling thread */
     /* char *buf;                // pointer to webthread buffer*/
     
     send_buffer_t *sendbuf;   /**< pointer to send buffer */
-} thread_arg_t;
 
+    unsigned int requests;    /**< number of requests handled on this connection */
+    char *pending;            /**< received bytes of the next (pipelined) request */
+    size_t pending_len;       /**< number of bytes in pending */
+    void *request;            /**< request (http_req_info_t) that was read and is
+                                   handed over to a script or i/o worker */
+    int reply_flags;          /**< send buffer flags of the handed over request */
+    int request_class;        /**< admitted request class of the handed over request */
 
-CTHREAD_RET webthread( CTHREAD_ARG );
+    /* event loop internals */
+    int loop_registered;      /**< connection is registered with the event loop backend,
+                                   -1 while the backend closes it */
+    int idle_list;            /**< idle connection list the connection is in, -1 for none */
+    int deadline_kind;        /**< receive deadline while handled by a worker (EVENT_DEADLINE_*) */
+    volatile int timed_out;   /**< a receive deadline was missed, the socket is shut down for reading */
+    unsigned long deadline;   /**< time (ms) of the current deadline */
+    timer_entry_t timer;      /**< deadline timer in the timer wheel of the event loop */
+    thread_arg_t *prev;       /**< previous connection in an idle list */
+    thread_arg_t *next;       /**< next connection in an idle list */
+    void *reply;              /**< reply that is sent by the event loop backend */
+};
 
-/** Initialize web thread module. */
-void * webthread_init( void );
+/** Handle a request on a readable client connection. This is called by
+ * the web thread workers, the connection is closed or handed back to the
+ * event loop afterwards. Static files, embedded resources and lua pages
+ * are admitted against separate limits (max_static_requests,
+ * max_embedded_requests, max_lua_requests), requests over the limit get
+ * a 503 reply with a Retry-After header. Lua pages are handed over to a
+ * separate pool of script workers with its own queue, so slow scripts
+ * do not hold up the web thread workers that answer static requests. */
+int webthread( thread_arg_t *args );
+
+/** Look up an embedded resource, resources of the resource bundle come
+ * before the compiled in ones. Returns NULL if there is none. */
+cresource_t * webthread_get_resource( thread_arg_t *args, const char *name );
+
+/** Initialize web thread module and start the worker threads and the
+ * script workers. With listener shards every shard has its own worker
+ * threads, which are pinned to the shard's cpu. */
+void * webthread_init( thread_arg_t *args );
+
+/** Dispatch a readable client connection to a web thread worker.
+ * If the worker queue is full the client gets a 503 reply right away.
+ * Returns 0 if the connection was not queued, in which case the caller
+ * still owns the connection. */
+int webthread_dispatch( void *init_data, thread_arg_t *conn );
 
 /** Deinitialize web thread module. */
 void webthread_free( void *init_data );
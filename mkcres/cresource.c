@@ -7,20 +7,22 @@
 
 #include <string.h>
 
+unsigned long cresource_hash(unsigned long seed, const char* name)
+{
+    unsigned long h = seed;
+    for( ; *name; ++name )
+        h = ((h ^ (unsigned char)*name) * 16777619UL) & 0xffffffffUL;
+    return h ^ (h >> 16);
+}
+
 cresource_t* get_cresource(const char* filename) 
 {
-    cresource_collection_t *c = get_cresources();
-    if( c ) {
-        cresource_prefix_t **p = (cresource_prefix_t**)c->prefix_sections;
-        for( ; p && *p; ++p) {
-            if( strncmp((*p)->prefix, filename, (*p)->prefix_len) == 0 ) {
-                cresource_t **r = (cresource_t**)(*p)->resources;
-                for( ; r && *r; ++r ) {
-                    if( strcmp((*r)->name, &filename[(*p)->prefix_len]) == 0 )
-                        return *r;
-                } 
-            }
-        }
+    cresource_index_t *index = get_cresource_index();
+    if( index && filename ) {
+        const unsigned long bucket = cresource_hash(index->seed, filename) & index->bucket_mask;
+        const unsigned long slot = cresource_hash(index->bucket_seeds[bucket], filename) & index->mask;
+        if( index->names[slot] && strcmp(index->names[slot], filename) == 0 )
+            return index->resources[slot];
     }
     return 0;
 }
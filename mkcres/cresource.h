@@ -14,6 +14,10 @@ typedef const struct {
    const char* const name;
    const unsigned long size;
    const unsigned char *data;
+   const unsigned long deflate_size;   /* 0 if there is no deflate variant */
+   const unsigned char *deflate_data;  /* raw deflate stream of data, without zlib header */
+   const char* const etag;             /* quoted entity tag from a hash of data and size */
+   const char* const mimetype;         /* mime type from the config, 0 if not set */
 } cresource_t;
 
 typedef const struct {
@@ -28,6 +32,24 @@ typedef const struct {
     const cresource_prefix_t* const prefix_sections[];
 } cresource_collection_t;
 
+/** Perfect hash table of all resources by their full name, i.e. prefix and
+ * name. The first hash of a name selects a bucket, the seed of the bucket
+ * hashes the name to its slot. Every name has a different slot, so a lookup
+ * compares the name with at most one entry. */
+typedef const struct {
+    const unsigned long seed;               /* seed of the bucket hash */
+    const unsigned long bucket_mask;        /* number of buckets - 1 */
+    const unsigned long *bucket_seeds;      /* seed of the slot hash by bucket */
+    const unsigned long mask;               /* number of slots - 1 */
+    const char* const *names;               /* full names by slot, 0 if empty */
+    const cresource_t* const *resources;    /* resources by slot, 0 if empty */
+} cresource_index_t;
+
+/** Seeded 32 bit FNV-1a hash of a resource name with the high bits folded
+ * in, it is used for the resource index and by resource bundles. mkcres.py
+ * uses the same function to build them. */
+unsigned long cresource_hash(unsigned long seed, const char* name);
+
 /** Get a resource with the given filename. Returns a null ptr if the resource
  * was not found. */
 cresource_t* get_cresource(const char* filename);
@@ -36,6 +58,10 @@ cresource_t* get_cresource(const char* filename);
  * function is generated by cresource generator together with the resources. */
 cresource_collection_t* get_cresources();
 
+/** Get the perfect hash table of the resources, also generated by cresource
+ * generator. */
+cresource_index_t* get_cresource_index();
+
 #ifdef __cplusplus
 }
 #endif
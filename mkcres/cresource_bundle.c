@@ -0,0 +1,230 @@
+/* mkcres
+ * https://github.com/jahnf/mkcres
+ * For licensing and details see LICENSE and README.md
+ */
+
+/* Bundle file layout, all numbers are little endian and all offsets are
+ * counted from the start of the file (see write_bundle() in mkcres.py):
+ *
+ *   header      "CRESBNDL", u32 version, u32 number of resources,
+ *               u32 seed, u32 number of buckets, u32 number of slots, u32 0
+ *   index       u32 seed by bucket, u32 resource number + 1 by slot (0 if empty)
+ *   resources   aligned to 8 bytes, per resource: u64 data offset, u64 size,
+ *               u64 deflate offset, u64 deflate size, u32 name offset,
+ *               u32 etag offset, u32 mimetype offset (0 if none), u32 0
+ *   strings     zero terminated full names, entity tags and mime types
+ *   data        the data and deflate variants, each one aligned to 16 bytes
+ */
+
+#include "cresource_bundle.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#define BUNDLE_MAGIC "CRESBNDL"
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE 32
+#define BUNDLE_RESOURCE_SIZE 48
+
+struct cresource_bundle_s {
+    const unsigned char *map;
+    size_t map_size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    unsigned long seed;
+    unsigned long bucket_mask;
+    unsigned long slot_mask;
+    unsigned long *bucket_seeds;
+    unsigned long *slots;       /* resource number + 1 by slot, 0 if empty */
+    unsigned long num_resources;
+    cresource_t *resources;
+};
+
+static unsigned long read_u32(const unsigned char* p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+         | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/* reads an u64 that has to fit into an unsigned long, returns 0 if it doesn't */
+static int read_u64(const unsigned char* p, unsigned long* value)
+{
+    const unsigned long high = read_u32(p + 4);
+    if( high && sizeof(unsigned long) < 8 ) return 0;
+    *value = read_u32(p) | ((high << 16) << 16);
+    return 1;
+}
+
+/* checks that offset points to a zero terminated string within the file */
+static const char* bundle_string(const cresource_bundle_t* b, unsigned long offset)
+{
+    if( offset >= b->map_size || !memchr(b->map + offset, 0, b->map_size - offset) )
+        return 0;
+    return (const char*)b->map + offset;
+}
+
+/* checks that size bytes at offset are within the file */
+static const unsigned char* bundle_data(const cresource_bundle_t* b, unsigned long offset,
+                                        unsigned long size)
+{
+    if( offset > b->map_size || size > b->map_size - offset ) return 0;
+    return b->map + offset;
+}
+
+/* reads the index and the resources of a mapped bundle, returns 0 if the
+ * file is not a valid bundle */
+static int bundle_load(cresource_bundle_t* b)
+{
+    const unsigned char *p = b->map;
+    unsigned long num_buckets, num_slots, i;
+    size_t resources_offset;
+
+    if( b->map_size < BUNDLE_HEADER_SIZE || memcmp(p, BUNDLE_MAGIC, 8) != 0
+        || read_u32(p + 8) != BUNDLE_VERSION )
+        return 0;
+    b->num_resources = read_u32(p + 12);
+    b->seed = read_u32(p + 16);
+    num_buckets = read_u32(p + 20);
+    num_slots = read_u32(p + 24);
+    /* the numbers of buckets and slots are powers of two */
+    if( !num_buckets || (num_buckets & (num_buckets - 1)) || !num_slots
+        || (num_slots & (num_slots - 1)) || num_slots < b->num_resources )
+        return 0;
+    resources_offset = (BUNDLE_HEADER_SIZE + 4 * ((size_t)num_buckets + num_slots) + 7) & ~(size_t)7;
+    if( resources_offset > b->map_size
+        || b->num_resources > (b->map_size - resources_offset) / BUNDLE_RESOURCE_SIZE )
+        return 0;
+    b->bucket_mask = num_buckets - 1;
+    b->slot_mask = num_slots - 1;
+
+    b->bucket_seeds = (unsigned long*)malloc(num_buckets * sizeof(unsigned long));
+    b->slots = (unsigned long*)malloc(num_slots * sizeof(unsigned long));
+    b->resources = (cresource_t*)malloc((b->num_resources ? b->num_resources : 1) * sizeof(cresource_t));
+    if( !b->bucket_seeds || !b->slots || !b->resources ) return 0;
+
+    p += BUNDLE_HEADER_SIZE;
+    for( i = 0; i < num_buckets; ++i, p += 4 )
+        b->bucket_seeds[i] = read_u32(p);
+    for( i = 0; i < num_slots; ++i, p += 4 ) {
+        if( (b->slots[i] = read_u32(p)) > b->num_resources ) return 0;
+    }
+
+    p = b->map + resources_offset;
+    for( i = 0; i < b->num_resources; ++i, p += BUNDLE_RESOURCE_SIZE ) {
+        unsigned long data_offset, size, deflate_offset, deflate_size;
+        const unsigned long mimetype_offset = read_u32(p + 40);
+        const char *name = bundle_string(b, read_u32(p + 32));
+        const char *etag = bundle_string(b, read_u32(p + 36));
+        const char *mimetype = mimetype_offset ? bundle_string(b, mimetype_offset) : 0;
+        if( !read_u64(p, &data_offset) || !read_u64(p + 8, &size)
+            || !read_u64(p + 16, &deflate_offset) || !read_u64(p + 24, &deflate_size)
+            || !name || !etag || (mimetype_offset && !mimetype)
+            || !bundle_data(b, data_offset, size)
+            || (deflate_size && !bundle_data(b, deflate_offset, deflate_size)) )
+            return 0;
+        {
+            /* the name of a resource is its full name, the bundle has no prefixes */
+            cresource_t r = { name, size, b->map + data_offset, deflate_size,
+                              deflate_size ? b->map + deflate_offset : 0, etag, mimetype };
+            memcpy((void*)&b->resources[i], &r, sizeof(r));
+        }
+    }
+    return 1;
+}
+
+cresource_bundle_t* cresource_bundle_open(const char* filename)
+{
+    cresource_bundle_t *b = (cresource_bundle_t*)calloc(1, sizeof(cresource_bundle_t));
+    if( !b ) return 0;
+
+#ifdef _WIN32
+    {
+        LARGE_INTEGER size;
+        b->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+        b->mapping = NULL;
+        if( b->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(b->file, &size) || !size.QuadPart
+            || (ULONGLONG)size.QuadPart > (size_t)-1
+            || !(b->mapping = CreateFileMappingA(b->file, NULL, PAGE_READONLY, 0, 0, NULL))
+            || !(b->map = (const unsigned char*)MapViewOfFile(b->mapping, FILE_MAP_READ, 0, 0, 0)) ) {
+            cresource_bundle_close(b);
+            return 0;
+        }
+        b->map_size = (size_t)size.QuadPart;
+    }
+#else
+    {
+        struct stat st;
+        void *map;
+        const int fd = open(filename, O_RDONLY);
+        if( fd == -1 ) {
+            free(b);
+            return 0;
+        }
+        /* the mapping stays valid after the file is closed */
+        if( fstat(fd, &st) != 0 || st.st_size <= 0 || (unsigned long long)st.st_size > (size_t)-1
+            || (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+            close(fd);
+            free(b);
+            return 0;
+        }
+        close(fd);
+        b->map = (const unsigned char*)map;
+        b->map_size = (size_t)st.st_size;
+    }
+#endif
+
+    if( !bundle_load(b) ) {
+        cresource_bundle_close(b);
+        return 0;
+    }
+    return b;
+}
+
+cresource_t* cresource_bundle_get(const cresource_bundle_t* b, const char* filename)
+{
+    if( b && filename ) {
+        const unsigned long bucket = cresource_hash(b->seed, filename) & b->bucket_mask;
+        const unsigned long r = b->slots[cresource_hash(b->bucket_seeds[bucket], filename) & b->slot_mask];
+        if( r && strcmp(b->resources[r - 1].name, filename) == 0 )
+            return &b->resources[r - 1];
+    }
+    return 0;
+}
+
+unsigned long cresource_bundle_count(const cresource_bundle_t* b)
+{
+    return b ? b->num_resources : 0;
+}
+
+cresource_t* cresource_bundle_at(const cresource_bundle_t* b, unsigned long i)
+{
+    return (b && i < b->num_resources) ? &b->resources[i] : 0;
+}
+
+void cresource_bundle_close(cresource_bundle_t* b)
+{
+    if( !b ) return;
+#ifdef _WIN32
+    if( b->map ) UnmapViewOfFile(b->map);
+    if( b->mapping ) CloseHandle(b->mapping);
+    if( b->file != INVALID_HANDLE_VALUE ) CloseHandle(b->file);
+#else
+    if( b->map ) munmap((void*)b->map, b->map_size);
+#endif
+    free(b->bucket_seeds);
+    free(b->slots);
+    free((void*)b->resources);
+    free(b);
+}
@@ -0,0 +1,43 @@
+/* mkcres
+ * https://github.com/jahnf/mkcres
+ * For licensing and details see LICENSE and README.md
+ */
+
+#ifndef CRESOURCE_BUNDLE__H_
+#define CRESOURCE_BUNDLE__H_
+
+#include "cresource.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A resource bundle file that was created with `mkcres.py bundle` and is
+ * mapped into memory. The resources point directly into the mapped file,
+ * only the index is held in allocated memory. */
+typedef struct cresource_bundle_s cresource_bundle_t;
+
+/** Open and map a resource bundle file. Returns a null ptr if the file can't
+ * be opened or is not a valid bundle. */
+cresource_bundle_t* cresource_bundle_open(const char* filename);
+
+/** Get a resource with the given filename from a bundle. Returns a null ptr
+ * if the resource was not found. */
+cresource_t* cresource_bundle_get(const cresource_bundle_t* bundle, const char* filename);
+
+/** Number of resources in a bundle, they can be listed with
+ * cresource_bundle_at(). */
+unsigned long cresource_bundle_count(const cresource_bundle_t* bundle);
+
+/** Get the resource with the given number (0 to count - 1) from a bundle. */
+cresource_t* cresource_bundle_at(const cresource_bundle_t* bundle, unsigned long i);
+
+/** Unmap and free a bundle, resources of the bundle must not be used
+ * anymore. A null ptr is ignored. */
+void cresource_bundle_close(cresource_bundle_t* bundle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRESOURCE_BUNDLE__H_ */
@@ -11,6 +11,9 @@
 # -------------------------------------------------------------
 #   include(mkcres/mkcres.cmake)
 #   mkcres_add_library(myresources resources.json "./mkcres")
+#
+#   Add DEFLATE after the mkcres directory to compile in a raw deflate
+#   variant of every compressible resource as well.
 #    
 #   add_executable(example main.c) 
 #   target_link_libraries(example myresources)
@@ -24,10 +27,14 @@ function(mkcres_add_library name configfiles mkcres_dir)
     set(mkcres_res_force_target "${name}-cres-force-rewrite")
     set(mkcres_outdir ${CMAKE_CURRENT_BINARY_DIR}/${name}_cresources)
     set(mkcres_outfile ${mkcres_outdir}/cres_files.cmake)
+    list(FIND ARGN DEFLATE mkcres_deflate)
 
 	# mkcres update command arguments
 	set(mkcres_update_args create --list-outfile "${mkcres_outfile}" --list-cmake-prefix=${name}
                                   --outdir "${mkcres_outdir}" ${configfiles})
+    if(NOT mkcres_deflate EQUAL -1)
+        list(APPEND mkcres_update_args --deflate)
+    endif()
 	
     add_custom_target(${mkcres_res_target} "${PYTHON_EXECUTABLE}" "${mkcres_script}" 
 						${mkcres_update_args} --quiet
@@ -45,7 +52,8 @@ function(mkcres_add_library name configfiles mkcres_dir)
 	
 	include("${mkcres_outfile}")
     include_directories(${mkcres_dir})
-    add_library(${name} STATIC EXCLUDE_FROM_ALL ${${name}_CRES_SOURCE_FILES} ${mkcres_dir}/cresource.c)
+    add_library(${name} STATIC EXCLUDE_FROM_ALL ${${name}_CRES_SOURCE_FILES} ${mkcres_dir}/cresource.c
+                                         ${mkcres_dir}/cresource_bundle.c)
     add_dependencies(${name} ${mkcres_res_target})
 
     if(NOT TARGET mkcres-update)
@@ -54,15 +54,31 @@ import filecmp
 import argparse  # needs Python version 2.7 or higher
 import hashlib
 import binascii
+import zlib
+import struct
 
-SCRIPT_VERSION = "0.2"
+SCRIPT_VERSION = "0.5"
 OUT_FILENAME = "CRES.out"
 OUT_SOURCENAME = 'cres.c'
 CRES_KEY = 'CRES'
 CRES_CRESOURCE_TYPE = 'cresource_t'
 CRES_CPREFIX_TYPE = 'cresource_prefix_t'
 CRES_CCOLL_TYPE = 'cresource_collection_t'
+CRES_CINDEX_TYPE = 'cresource_index_t'
 CRES_CRESOURCE_VAR = '___cres_resources'
+CRES_CINDEX_VAR = '___cres_index'
+# seed of the resource index hash (FNV-1a offset basis) and the number
+# of seeds tried for a bucket of the index
+INDEX_SEED = 2166136261
+INDEX_SEED_TRIES = 100000
+# a deflate variant is only kept if it is smaller than this part of the data
+DEFLATE_MAX_RATIO = 0.9
+# resource bundle file format, see cresource_bundle.c
+BUNDLE_MAGIC = b'CRESBNDL'
+BUNDLE_VERSION = 1
+BUNDLE_HEADER_SIZE = 32
+BUNDLE_RESOURCE_SIZE = 48
+BUNDLE_DATA_ALIGN = 16
 
 def bytes_from_file(infile, chunksize=8192):
     while True:
@@ -76,7 +92,34 @@ def error_and_exit(reason):
     sys.stderr.write(reason + '\n')
     exit(1)
 
-def write_c_source(infile, outfile_config, out_basedir):
+def write_c_array(outfile, var, chunks):
+    outfile.write("const unsigned char {}[] = {{\n".format(var))
+    empty = True
+    for bindata in chunks:
+        empty = False
+        s=binascii.b2a_hex(bindata).upper().decode('utf-8')
+        outfile.write("\t\"" + "".join(["\\x"+x+y for (x,y) in zip(s[0::2], s[1::2])]) + "\"\n")
+    if empty:
+        outfile.write("\t\"\"\n")
+    outfile.write("};")
+
+def deflate_data(infile):
+    """Compress a file to a raw deflate stream, without zlib header."""
+    compressor = zlib.compressobj(9, zlib.DEFLATED, -zlib.MAX_WBITS)
+    data = b"".join([compressor.compress(chunk) for chunk in bytes_from_file(infile)])
+    return data + compressor.flush()
+
+def content_etag(infile, size):
+    """Quoted entity tag of a file from a hash of its content and its size."""
+    hashdata = hashlib.sha1()
+    for chunk in bytes_from_file(infile):
+        hashdata.update(chunk)
+    return '"{0}-{1:x}"'.format(hashdata.hexdigest()[:16], size)
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+def write_c_source(infile, outfile_config, out_basedir, deflate=False):
     global CRES_CRESOURCE_TYPE
     
     if not 'c_src' in outfile_config or outfile_config['c_src'] == "":
@@ -94,21 +137,62 @@ def write_c_source(infile, outfile_config, out_basedir):
         
     outfile.write("/* auto generated CRES source */\n")
     outfile.write("/* {} */\n".format(outfile_config['abspath']))
-    outfile.write("const unsigned char {}[] = {{\n".format(outfile_config['c_data_var']))
-    
-    read_len = 0
-    if outfile_config['size'] == 0:
-        outfile.write("\t\"\"\n")
-    else:
-        for bindata in bytes_from_file(infile,20):
-            read_len += len(bindata)
-            s=binascii.b2a_hex(bindata).upper().decode('utf-8')
-            outfile.write("\t\"" + "".join(["\\x"+x+y for (x,y) in zip(s[0::2], s[1::2])]) + "\"\n")
-    
-    outfile.write("};")
+    write_c_array(outfile, outfile_config['c_data_var'], bytes_from_file(infile,20))
+
+    infile.seek(0)
+    outfile_config['etag'] = content_etag(infile, outfile_config['size'])
+
+    # the raw deflate variant is only written if it is worth it
+    outfile_config['deflate_size'] = 0
+    if deflate and outfile_config['size'] > 0:
+        infile.seek(0)
+        compressed = deflate_data(infile)
+        if len(compressed) < outfile_config['size'] * DEFLATE_MAX_RATIO:
+            outfile_config['deflate_size'] = len(compressed)
+            outfile.write("\n")
+            write_c_array(outfile, outfile_config['c_data_var'] + "_deflate",
+                          [compressed[i:i+20] for i in range(0, len(compressed), 20)])
+
     outfile.truncate()
     outfile.close()
 
+def cres_hash(seed, name):
+    """Seeded FNV-1a hash of a resource name, same as in cresource.c. The
+    high bits are folded in, the low bits of FNV-1a alone mix poorly."""
+    h = seed
+    for c in bytearray(name.encode('utf-8')):
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h ^ (h >> 16)
+
+def make_index(names):
+    """Build a perfect hash table with hash and displace: the names are
+    distributed into buckets by the first hash, then a seed is searched for
+    every bucket, largest first, that puts all its names into free slots.
+    Returns (seed, bucket_seeds, slots)."""
+    size = 1
+    while size < len(names) + len(names) // 4: size *= 2
+    num_buckets = 1
+    while num_buckets * 2 < size: num_buckets *= 2
+    seed = INDEX_SEED
+    buckets = [[] for b in range(num_buckets)]
+    for n in names:
+        buckets[cres_hash(seed, n) & (num_buckets - 1)].append(n)
+    bucket_seeds = [0] * num_buckets
+    slots = [None] * size
+    for b in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[b]: break
+        for i in range(INDEX_SEED_TRIES):
+            bucket_seed = (INDEX_SEED + i * 0x9E3779B9) & 0xffffffff
+            taken = set(cres_hash(bucket_seed, n) & (size - 1) for n in buckets[b])
+            if len(taken) == len(buckets[b]) and all(slots[t] is None for t in taken):
+                break
+        else:
+            error_and_exit("Could not build the resource index.")
+        bucket_seeds[b] = bucket_seed
+        for n in buckets[b]:
+            slots[cres_hash(bucket_seed, n) & (size - 1)] = n
+    return seed, bucket_seeds, slots
+
 def write_c_main_source(config):
     global OUT_SOURCENAME
     temp_varlist = []
@@ -116,6 +200,8 @@ def write_c_main_source(config):
         for f in p['files']:
             if not f['c_data_var'] in temp_varlist:
                 temp_varlist.append(f['c_data_var'])
+                if f.get('deflate_size', 0):
+                    temp_varlist.append(f['c_data_var'] + "_deflate")
                 
     try:
         outfile = open(os.path.join(config['outdir'], OUT_SOURCENAME), 'w+')
@@ -135,7 +221,18 @@ def write_c_main_source(config):
             outfile.write("\nstatic {} {} = {{\n".format(CRES_CRESOURCE_TYPE, f['c_var']))
             outfile.write("\t\"{}\", /* filename */\n".format(c_resource_name))
             outfile.write("\t{}, /* filesize */\n".format(f['size']))
-            outfile.write("\t{} /* data */\n".format(f['c_data_var']))
+            outfile.write("\t{}, /* data */\n".format(f['c_data_var']))
+            if f.get('deflate_size', 0):
+                outfile.write("\t{}, /* deflate size */\n".format(f['deflate_size']))
+                outfile.write("\t{}_deflate, /* deflate data */\n".format(f['c_data_var']))
+            else:
+                outfile.write("\t0, /* deflate size */\n")
+                outfile.write("\t0, /* deflate data */\n")
+            outfile.write("\t{}, /* etag */\n".format(c_string(f['etag'])))
+            if f.get('mimetype'):
+                outfile.write("\t{} /* mimetype */\n".format(c_string(f['mimetype'])))
+            else:
+                outfile.write("\t0 /* mimetype */\n")
             outfile.write("};\n")
             file_count += 1
 
@@ -161,7 +258,38 @@ def write_c_main_source(config):
     for p in prefix_varlist:
         outfile.write("\t\t&{0},\n".format(p))
     outfile.write("\t\t0\n\t}\n};\n")
-    outfile.write("\n{0}* get_cresources() {{ return &{1}; }}".format(CRES_CCOLL_TYPE, CRES_CRESOURCE_VAR))
+    outfile.write("\n{0}* get_cresources() {{ return &{1}; }}\n".format(CRES_CCOLL_TYPE, CRES_CRESOURCE_VAR))
+
+    # perfect hash table over the full resource names (prefix + name),
+    # the first resource of a name wins like in the prefix sections
+    resources = {}
+    for p in config[CRES_KEY]:
+        for f in p['files']:
+            full_name = p['prefix'] + f['name_out']
+            if not full_name in resources:
+                resources[full_name] = f['c_var']
+    seed, bucket_seeds, slots = make_index(sorted(resources.keys()))
+    outfile.write("\nstatic const unsigned long {0}_seeds[] = {{\n".format(CRES_CINDEX_VAR))
+    for bucket_seed in bucket_seeds:
+        outfile.write("\t{0}UL,\n".format(bucket_seed))
+    outfile.write("};\n")
+    outfile.write("\nstatic const char* const {0}_names[] = {{\n".format(CRES_CINDEX_VAR))
+    for n in slots:
+        outfile.write("\t\"{0}\",\n".format(n.replace('"', '\\"')) if n is not None else "\t0,\n")
+    outfile.write("};\n")
+    outfile.write("\nstatic const {0}* const {1}_resources[] = {{\n".format(CRES_CRESOURCE_TYPE, CRES_CINDEX_VAR))
+    for n in slots:
+        outfile.write("\t&{0},\n".format(resources[n]) if n is not None else "\t0,\n")
+    outfile.write("};\n")
+    outfile.write("\nstatic {0} {1} = {{\n".format(CRES_CINDEX_TYPE, CRES_CINDEX_VAR))
+    outfile.write("\t{0}UL, /* seed */\n".format(seed))
+    outfile.write("\t{0}, /* bucket mask */\n".format(len(bucket_seeds) - 1))
+    outfile.write("\t{0}_seeds,\n".format(CRES_CINDEX_VAR))
+    outfile.write("\t{0}, /* slot mask */\n".format(len(slots) - 1))
+    outfile.write("\t{0}_names,\n".format(CRES_CINDEX_VAR))
+    outfile.write("\t{0}_resources\n".format(CRES_CINDEX_VAR))
+    outfile.write("};\n")
+    outfile.write("\n{0}* get_cresource_index() {{ return &{1}; }}".format(CRES_CINDEX_TYPE, CRES_CINDEX_VAR))
     
     outfile.truncate()
     outfile.close()
@@ -218,6 +346,9 @@ def add_resource(args, prefix, fileconf, origin_in, outconf):
             of['c_src'] = df['c_src']
             of['mtime'] = df['mtime']
             of['size'] = df['size']
+            of['deflate'] = df.get('deflate', False)
+            of['deflate_size'] = df.get('deflate_size', 0)
+            if 'etag' in df: of['etag'] = df['etag']
         out_pre['files'].append(of)
     
     if (not found_data_file or not found_file or not 'name_out' in of or
@@ -226,25 +357,34 @@ def add_resource(args, prefix, fileconf, origin_in, outconf):
     else: 
         changes = False
 
+    if of.get('mimetype') != fileconf.get('mimetype'):
+        changes = True
     of['name_out'] = name_out
+    of['mimetype'] = fileconf.get('mimetype')
     of['origin_config'] = origin_in
     csrc_missing = False
     if ('c_src' in of and not
         os.path.exists(os.path.join(outconf['outdir'], of['c_src']))):
         csrc_missing = True
     
-    if of['mtime'] != infile_mtime or of['size'] != infile_size or csrc_missing:
+    deflate = bool(args.deflate)
+    if (of['mtime'] != infile_mtime or of['size'] != infile_size or csrc_missing
+        or of.get('deflate', False) != deflate or not 'etag' in of):
         changes = True
         if not args.quiet: print("Updating/Creating sources for file: " + abspath)
         of['mtime'] = infile_mtime
         of['size'] = infile_size
-        write_c_source(infile, of, outconf['outdir'])
+        of['deflate'] = deflate
+        write_c_source(infile, of, outconf['outdir'], deflate)
         # update all other resources that use the same binary data
         for p in outconf[CRES_KEY]:
             for f in p['files']:
                 if f != of and of['c_src'] == f['c_src']:
                     f['mtime'] = of['mtime']
                     f['size'] = of['size']
+                    f['deflate'] = of['deflate']
+                    f['deflate_size'] = of['deflate_size']
+                    f['etag'] = of['etag']
     
     infile.close()
     return 1 if changes else 0
@@ -286,6 +426,9 @@ def create(args):
         outfile.seek(0,0)
     
     cres_outconfig['outdir'] = os.path.abspath(res_outdir)
+    # the main source of an older script version has to be rewritten
+    main_outdated = cres_outconfig.get('version') != SCRIPT_VERSION
+    cres_outconfig['version'] = SCRIPT_VERSION
 
     of_remove_list = []
     new_entries = 0
@@ -351,7 +494,7 @@ def create(args):
                 os.remove(abs_delpath)
     
     # write main source file for config
-    if new_entries > 0 or len(of_remove_list) > 0:
+    if new_entries > 0 or len(of_remove_list) > 0 or main_outdated:
         write_c_main_source(cres_outconfig) 
         if args.list_outfile:
             listfile_temp = args.list_outfile + ".tmp~"
@@ -419,6 +562,106 @@ def write_sources_list(config, outdir, outfile, cmake, relative=False, absolute=
         
     if cmake: outfile.write(')\n')
 
+def bundle_align(offset, alignment):
+    return (offset + alignment - 1) // alignment * alignment
+
+def write_bundle(args):
+    """Write the resources of all resource files into one bundle file, that
+    is mapped into memory at runtime (see cresource_bundle.h). The names of
+    the resources are their full names, i.e. prefix and name."""
+    resources = {}
+    for infile in args.resfile:
+        try:
+            resfile_inconfig = json.loads(infile.read())
+        except:
+            error_and_exit("Could not parse resource file '{0}'.".format(infile.name))
+        if not CRES_KEY in resfile_inconfig:
+            error_and_exit("Not a cresource config file. Missing {0} key.".format(CRES_KEY))
+        res_infile_absdir = os.path.dirname(os.path.abspath(infile.name))
+        for p in resfile_inconfig[CRES_KEY]:
+            for f in p.get('files', []):
+                if not 'name' in f: continue
+                full_name = p.get('prefix', "") + f.get('alias', f['name'])
+                # the first resource of a name wins like in the prefix sections
+                if not full_name in resources:
+                    resources[full_name] = (os.path.join(res_infile_absdir, f['name']), f.get('mimetype'))
+
+    names = sorted(resources.keys())
+    seed, bucket_seeds, slots = make_index(names)
+
+    # the data of a file that is used under several names is stored once
+    blobs = {}
+    for name in names:
+        abspath = resources[name][0]
+        if abspath in blobs: continue
+        try:
+            with open(abspath, 'rb') as infile:
+                data = infile.read()
+                infile.seek(0)
+                etag = content_etag(infile, len(data))
+                infile.seek(0)
+                compressed = deflate_data(infile) if args.deflate and len(data) else b''
+        except IOError:
+            error_and_exit("Could not open: " + abspath)
+        if len(compressed) >= len(data) * DEFLATE_MAX_RATIO:
+            compressed = b''
+        blobs[abspath] = {'data': data, 'deflate': compressed, 'etag': etag}
+
+    # strings follow the resources, the data follows the strings
+    resources_offset = bundle_align(BUNDLE_HEADER_SIZE + 4 * (len(bucket_seeds) + len(slots)), 8)
+    strings = bytearray()
+    string_offsets = {}
+    def add_string(s):
+        if not s in string_offsets:
+            string_offsets[s] = resources_offset + BUNDLE_RESOURCE_SIZE * len(names) + len(strings)
+            strings.extend(s.encode('utf-8') + b'\0')
+        return string_offsets[s]
+    entries = []
+    for name in names:
+        abspath, mimetype = resources[name]
+        entries.append((add_string(name), add_string(blobs[abspath]['etag']),
+                        add_string(mimetype) if mimetype else 0))
+    offset = resources_offset + BUNDLE_RESOURCE_SIZE * len(names) + len(strings)
+    if offset > 0xffffffff:
+        error_and_exit("Too many resource names for a bundle.")
+    for abspath in sorted(blobs.keys()):
+        for variant in ('data', 'deflate'):
+            offset = bundle_align(offset, BUNDLE_DATA_ALIGN)
+            blobs[abspath][variant + '_offset'] = offset
+            offset += len(blobs[abspath][variant])
+
+    out = bytearray(struct.pack('<8sIIIIII', BUNDLE_MAGIC, BUNDLE_VERSION, len(names), seed,
+                                len(bucket_seeds), len(slots), 0))
+    for bucket_seed in bucket_seeds:
+        out.extend(struct.pack('<I', bucket_seed))
+    numbers = dict((name, i) for i, name in enumerate(names))
+    for n in slots:
+        out.extend(struct.pack('<I', numbers[n] + 1 if n is not None else 0))
+    out.extend(b'\0' * (resources_offset - len(out)))
+    for name, (name_offset, etag_offset, mimetype_offset) in zip(names, entries):
+        blob = blobs[resources[name][0]]
+        out.extend(struct.pack('<QQQQIIII', blob['data_offset'], len(blob['data']),
+                               blob['deflate_offset'] if blob['deflate'] else 0, len(blob['deflate']),
+                               name_offset, etag_offset, mimetype_offset, 0))
+    out.extend(strings)
+    for abspath in sorted(blobs.keys()):
+        for variant in ('data', 'deflate'):
+            out.extend(b'\0' * (blobs[abspath][variant + '_offset'] - len(out)))
+            out.extend(blobs[abspath][variant])
+
+    # a new bundle replaces the old file, a program that has mapped the old
+    # one keeps using it until it opens the bundle again
+    outfile_temp = args.outfile + ".tmp~"
+    try:
+        with open(outfile_temp, 'wb') as outfile:
+            outfile.write(out)
+        if os.path.exists(args.outfile):
+            os.remove(args.outfile) # otherwise os.rename will fail on Windows
+        os.rename(outfile_temp, args.outfile)
+    except (IOError, OSError):
+        error_and_exit("Could not write bundle file: " + args.outfile)
+    if not args.quiet: print("{0} resources in {1} ({2} bytes)".format(len(names), args.outfile, len(out)))
+
 def main():
     global SCRIPT_VERSION
     global OUT_FILENAME
@@ -431,6 +674,7 @@ def main():
     parser_a.add_argument('--force', help='force rewrite, default is update mode', action='store_const', const=True)
     parser_a.add_argument('--keep-missing', help='keep missing entries in output', action='store_const', const=True)
     parser_a.add_argument('--quiet', help='no outputs', action='store_const', const=True)
+    parser_a.add_argument('--deflate', help='add a raw deflate variant of compressible resources', action='store_const', const=True)
     parser_a.add_argument('--list-outfile', help='', required=False)
     parser_a.add_argument('--list-cmake-prefix', help='cmake format', required=False)
     parser_a.add_argument('resfile', help='resource definition file', nargs='+', type=argparse.FileType('r'))
@@ -445,6 +689,13 @@ def main():
     parser_b.add_argument('outfile',nargs='?', type=argparse.FileType('w'), default=sys.stdout)
     parser_b.set_defaults(func=listfiles)
     
+    parser_c = subparsers.add_parser('bundle', help='Generate a resource bundle file that is mapped at runtime')
+    parser_c.add_argument('--quiet', help='no outputs', action='store_const', const=True)
+    parser_c.add_argument('--deflate', help='add a raw deflate variant of compressible resources', action='store_const', const=True)
+    parser_c.add_argument('outfile', help='bundle file')
+    parser_c.add_argument('resfile', help='resource definition file', nargs='+', type=argparse.FileType('r'))
+    parser_c.set_defaults(func=write_bundle)
+    
     args = parser.parse_args()
     args.func(args)
 
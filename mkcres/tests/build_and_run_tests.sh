@@ -52,6 +52,11 @@ cmp output_file ${SCRIPT_DIR}/main.c
 ./test_cpp images/penguin.jpg output_file
 cmp output_file ${SCRIPT_DIR}/linux_logo.jpg
 
+# create a bundle from the same config, the c test executable
+# compares it with the compiled in resources
+python ${SCRIPT_DIR}/../mkcres.py bundle --quiet test_bundle.cres ${SCRIPT_DIR}/test_resources1.json
+./test_c --bundle test_bundle.cres
+
 # modify a resource file, build and compare again
 echo `date` >> ${SCRIPT_DIR}/FILE01
 make
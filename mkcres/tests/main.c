@@ -3,8 +3,10 @@
  * Visit https://github.com/jahnf/mkcres for more details
  */
 #include "cresource.h"
+#include "cresource_bundle.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static int save_resource_to_file(const char *res_name, const char *filename) 
 {
@@ -34,17 +36,47 @@ static int save_resource_to_file(const char *res_name, const char *filename)
 }
 
 
-int main (int argc, char **argv) 
+/* Checks that a bundle made from the same config has the same resources */
+static int check_bundle(const char *bundle_file, const char **filenames)
 {
-    /* usage: executable resource output_file */
-    if(argc == 3) exit(save_resource_to_file(argv[1],argv[2]));
+    int i;
+    cresource_bundle_t *bundle = cresource_bundle_open(bundle_file);
+    if(bundle == NULL) {
+        printf("Cannot open bundle '%s'\n", bundle_file);
+        return EXIT_FAILURE;
+    }
+    for( i = 0; filenames[i] != NULL; ++i) {
+        cresource_t *res = get_cresource(filenames[i]);
+        cresource_t *bres = cresource_bundle_get(bundle, filenames[i]);
+        if(!bres || strcmp(bres->name, filenames[i]) != 0 || bres->size != res->size
+           || memcmp(bres->data, res->data, res->size) != 0 || strcmp(bres->etag, res->etag) != 0
+           || (res->mimetype ? !bres->mimetype || strcmp(bres->mimetype, res->mimetype) != 0 : bres->mimetype != NULL)) {
+            printf("%s differs in bundle.\n", filenames[i]);
+            return EXIT_FAILURE;
+        }
+        printf("%s found in bundle (%lu bytes)\n", filenames[i], bres->size);
+    }
+    if(cresource_bundle_get(bundle, "images/missing.jpg") || cresource_bundle_count(bundle) != (unsigned long)i) {
+        printf("Wrong resources in bundle.\n");
+        return EXIT_FAILURE;
+    }
+    cresource_bundle_close(bundle);
+    return EXIT_SUCCESS;
+}
 
+int main (int argc, char **argv) 
+{
     /* Check all files from test_resources1.json */
     const char* filenames[] = { "images/linux_logo.jpg",
                                 "images/tux.jpg",
                                 "data-files/FILE01",
                                 "data-files/FILE02",
                                 "data-files/FILE03", NULL };
+
+    /* usage: executable --bundle bundle_file */
+    if(argc == 3 && strcmp(argv[1], "--bundle") == 0) exit(check_bundle(argv[2], filenames));
+    /* usage: executable resource output_file */
+    if(argc == 3) exit(save_resource_to_file(argv[1],argv[2]));
                                 
     int i =0;                            
     for( ; filenames[i] != NULL; ++i) {
@@ -58,6 +90,29 @@ int main (int argc, char **argv)
         }
     }
     
+    /* Resources have an entity tag, the mime type is only set in the config */
+    cresource_t *logo = get_cresource("images/linux_logo.jpg");
+    cresource_t *tux = get_cresource("images/tux.jpg");
+    if(!logo->etag || logo->etag[0] != '"' || strcmp(logo->etag, tux->etag) != 0
+       || !logo->mimetype || strcmp(logo->mimetype, "image/jpeg") != 0 || tux->mimetype) {
+        printf("Wrong entity tag or mime type.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Names that are not resources, also ones with a known prefix or
+     * name alone, are not found */
+    const char* missing[] = { "images/missing.jpg",
+                              "images/",
+                              "FILE01",
+                              "data-files/FILE01x",
+                              "", NULL };
+    for( i = 0; missing[i] != NULL; ++i) {
+        if(get_cresource(missing[i])) {
+            printf("'%s' found, but is no resource.\n", missing[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     printf("\n=== List all resources:\n");
     
     /* List all embedded resources */
@@ -0,0 +1,204 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file block_deflate.c
+ * Compression threads fed by a bounded block queue. Every thread keeps its
+ * own compressor, which is reset for each block.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.c"
+
+#include "block_deflate.h"
+#include "cfile.h"
+#include "cthreads.h"
+#include "log.h"
+
+SETLOGMODULENAME("block_deflate");
+
+/* files with less blocks are not compressed in parallel */
+#define BLOCK_DEFLATE_MIN_BLOCKS 4
+/* maximum number of blocks of a file in memory at a time */
+#define BLOCK_DEFLATE_MAX_WINDOW 16
+/* additional room for the sync flush after a block */
+#define BLOCK_DEFLATE_FLUSH_ROOM 16
+
+typedef struct {
+    unsigned char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    int last;                   /* last block of the file, finishes the stream */
+    volatile long done;         /* 1 once compressed, -1 on error */
+    c_semaphore *finished;      /* posted when a queued block is done */
+} block_deflate_block_t;
+
+typedef struct {
+    int level;
+    size_t block_size;
+    size_t out_size;            /* output buffer size of a block */
+    unsigned int window;        /* blocks of a file in memory at a time */
+    c_pool threads;             /* compression threads, fed with blocks */
+} block_deflate_t;
+
+/* Compress a block with a compressor that was initialized before */
+static long _block_deflate_compress( z_stream *stream, block_deflate_block_t *block, size_t out_size )
+{
+    int status;
+    if( mz_deflateReset( stream ) != Z_OK ) return -1;
+    stream->next_in = block->in;
+    stream->avail_in = (unsigned int)block->in_len;
+    stream->next_out = block->out;
+    stream->avail_out = (unsigned int)out_size;
+
+    status = mz_deflate( stream, block->last ? Z_FINISH : Z_SYNC_FLUSH );
+    if( block->last ? status != Z_STREAM_END : (status != Z_OK || stream->avail_in) ) {
+        LOG( log_ERROR, "deflate() failed with status %i!", status );
+        return -1;
+    }
+    block->out_len = out_size - stream->avail_out;
+    return 1;
+}
+
+/* Compression thread main function */
+static void _block_deflate_thread( c_pool *threads )
+{
+    block_deflate_t *bd = (block_deflate_t*)threads->data;
+    block_deflate_block_t *block;
+    z_stream stream;
+    int ready;
+
+    memset( &stream, 0, sizeof(stream) );
+    if( !(ready = (mz_deflateInitwoHeader( &stream, bd->level ) == Z_OK)) )
+        LOG( log_ERROR, "deflateInit() failed!" );
+
+    while( (block = (block_deflate_block_t*)cthread_pool_pop( threads )) ) {
+        cthread_atomic_add( &block->done, ready ? _block_deflate_compress( &stream, block, bd->out_size ) : -1 );
+        cthread_sem_post( block->finished );
+    }
+
+    if( ready ) mz_deflateEnd( &stream );
+}
+
+void * block_deflate_init( unsigned int threads, int level, size_t block_size )
+{
+    block_deflate_t *bd = (block_deflate_t*)calloc( 1, sizeof(block_deflate_t) );
+    if( !bd ) return NULL;
+
+    bd->level = level;
+    bd->block_size = block_size;
+    bd->out_size = (size_t)mz_deflateBound( NULL, (mz_ulong)block_size ) + BLOCK_DEFLATE_FLUSH_ROOM;
+    bd->window = !threads ? 1 : (threads * 2 < BLOCK_DEFLATE_MAX_WINDOW) ? threads * 2
+                                                                         : BLOCK_DEFLATE_MAX_WINDOW;
+    if( !threads ) return bd;
+
+    /* every thread can have a block of each file in progress */
+    if( !cthread_pool_init( &bd->threads, threads, threads * BLOCK_DEFLATE_MAX_WINDOW,
+                            _block_deflate_thread, bd ) ) {
+        LOG( log_ERROR, "compression thread creation error" );
+        free( bd );
+        return NULL;
+    }
+    return bd;
+}
+
+int block_deflate_parallel( void *data, off_t size )
+{
+    block_deflate_t *bd = (block_deflate_t*)data;
+    return bd && bd->threads.num_workers && size >= (off_t)(bd->block_size * BLOCK_DEFLATE_MIN_BLOCKS);
+}
+
+/* Read a whole block, returns 0 if the file is shorter than expected */
+static int _block_deflate_read( int fd, block_deflate_block_t *block, off_t offset )
+{
+    size_t done = 0;
+    while( done < block->in_len ) {
+        const long ret = cfile_pread( fd, block->in + done, block->in_len - done, offset + (off_t)done );
+        if( ret <= 0 ) return 0;
+        done += (size_t)ret;
+    }
+    return 1;
+}
+
+int block_deflate_file( void *data, int fd, off_t size, block_deflate_write_t writer, void *ctx )
+{
+    block_deflate_t *bd = (block_deflate_t*)data;
+    const unsigned long num_blocks = (unsigned long)((size + bd->block_size - 1) / bd->block_size);
+    const unsigned int window = (num_blocks < bd->window) ? (unsigned int)num_blocks : bd->window;
+    unsigned long next = 0, sent = 0, queued = 0, waited = 0;
+    block_deflate_block_t *blocks;
+    z_stream stream, *own = NULL;   /* compressor of this thread, if needed */
+    c_semaphore finished;
+    unsigned int i;
+    int ok = 1;
+
+    if( !num_blocks ) return 1;
+    if( !(blocks = (block_deflate_block_t*)malloc( window * (sizeof(block_deflate_block_t)
+                                                             + bd->block_size + bd->out_size) )) )
+        return 0;
+    cthread_sem_init( &finished, 0 );
+    for( i = 0; i < window; ++i ) {
+        blocks[i].in = (unsigned char*)(blocks + window) + i * (bd->block_size + bd->out_size);
+        blocks[i].out = blocks[i].in + bd->block_size;
+        blocks[i].finished = &finished;
+    }
+
+    while( ok && sent < num_blocks ) {
+        block_deflate_block_t *block;
+        /* read the next blocks into the free part of the window */
+        for( ; ok && next < num_blocks && next - sent < window; ++next ) {
+            const off_t offset = (off_t)next * (off_t)bd->block_size;
+            block = &blocks[next % window];
+            block->in_len = (size - offset < (off_t)bd->block_size) ? (size_t)(size - offset) : bd->block_size;
+            block->last = (next == num_blocks - 1);
+            block->done = 0;
+            if( !_block_deflate_read( fd, block, offset ) ) {
+                ok = 0;
+            } else if( bd->threads.num_workers && cthread_pool_push( &bd->threads, block ) ) {
+                ++queued;
+            } else {
+                /* the queue is full, this thread has to help out */
+                if( !own ) {
+                    memset( &stream, 0, sizeof(stream) );
+                    if( mz_deflateInitwoHeader( &stream, bd->level ) == Z_OK )
+                        own = &stream;
+                }
+                block->done = own ? _block_deflate_compress( own, block, bd->out_size ) : -1;
+            }
+        }
+        if( !ok ) break;
+
+        /* pass the oldest block on once it is compressed */
+        block = &blocks[sent % window];
+        while( !cthread_atomic_add( &block->done, 0 ) ) {
+            cthread_sem_wait( &finished );
+            ++waited;
+        }
+        if( block->done < 0 || !writer( ctx, (const char*)block->out, block->out_len ) )
+            ok = 0;
+        ++sent;
+    }
+
+    /* the blocks must not be freed while a compression thread uses them */
+    for( ; waited < queued; ++waited )
+        cthread_sem_wait( &finished );
+    cthread_sem_destroy( &finished );
+    if( own ) mz_deflateEnd( own );
+    free( blocks );
+    return ok;
+}
+
+void block_deflate_free( void *data )
+{
+    block_deflate_t *bd = (block_deflate_t*)data;
+    if( !bd ) return;
+
+    cthread_pool_destroy( &bd->threads, NULL );
+    free( bd );
+}
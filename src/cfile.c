@@ -11,8 +11,12 @@
  
 #ifdef _WIN32
     #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
 #else
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <errno.h>
     #include <dirent.h>
     #include <limits.h>
     #include <pwd.h>
@@ -105,6 +109,7 @@ int cfile_getstat( const char *filename, cfile_stat_t *cst )
         return CFILE_DOES_NOT_EXIST;
     }
     cst->size = st.st_size;
+    cst->mtime = st.st_mtime;
 
     if( st.st_mode & S_IFDIR )
         cst->type = CFILE_TYPE_DIR;
@@ -116,6 +121,45 @@ int cfile_getstat( const char *filename, cfile_stat_t *cst )
     return CFILE_SUCCESS;
 }
 
+int cfile_open_read( const char *filename )
+{
+    #ifdef _WIN32
+        return _open( filename, _O_RDONLY | _O_BINARY );
+    #else
+        #ifdef O_CLOEXEC
+            return open( filename, O_RDONLY | O_CLOEXEC );
+        #else
+            return open( filename, O_RDONLY );
+        #endif
+    #endif
+}
+
+long cfile_pread( int fd, void *buf, size_t len, off_t offset )
+{
+    #ifdef _WIN32
+        OVERLAPPED ov;
+        DWORD read = 0;
+        memset( &ov, 0, sizeof(ov) );
+        ov.Offset = (DWORD)offset;
+        if( !ReadFile( (HANDLE)_get_osfhandle( fd ), buf, (DWORD)len, &read, &ov ) )
+            return (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+        return (long)read;
+    #else
+        ssize_t ret;
+        while( (ret = pread( fd, buf, len, offset )) < 0 && errno == EINTR );
+        return (long)ret;
+    #endif
+}
+
+void cfile_close( int fd )
+{
+    #ifdef _WIN32
+        _close( fd );
+    #else
+        close( fd );
+    #endif
+}
+
 void cfile_item_free( cfile_item_t *cf_item ) 
 {
     cfile_item_t *tmp;
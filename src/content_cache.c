@@ -0,0 +1,272 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file content_cache.c
+ * Striped hash table of file contents with CLOCK eviction. An entry, its
+ * path, header fields and content are allocated in one block.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfile.h"
+#include "cthreads.h"
+#include "content_cache.h"
+#include "str_utils.h"
+
+/* number of independently locked parts of the cache */
+#define CONTENT_CACHE_STRIPES 16
+/* number of hash table slots per stripe */
+#define CONTENT_CACHE_SLOTS 256
+
+typedef struct {
+    c_mutex lock;
+    content_cache_entry_t *table[CONTENT_CACHE_SLOTS];
+    content_cache_entry_t *hand;    /* clock hand, next eviction candidate */
+    size_t memory;                  /* size of the cached content */
+} content_cache_stripe_t;
+
+typedef struct {
+    size_t max_memory;              /* per stripe, 0 if caching is off */
+    size_t max_file_size;
+    content_cache_stripe_t stripes[CONTENT_CACHE_STRIPES];
+} content_cache_t;
+
+#define STRIPE_OF(cache, hash) (&(cache)->stripes[(hash) % CONTENT_CACHE_STRIPES])
+#define SLOT_OF(stripe, hash) (&(stripe)->table[((hash) / CONTENT_CACHE_STRIPES) % CONTENT_CACHE_SLOTS])
+
+static content_cache_entry_t * _content_cache_find( content_cache_stripe_t *stripe,
+                                                    const char *path, unsigned long hash )
+{
+    content_cache_entry_t *entry = *SLOT_OF(stripe, hash);
+    for( ; entry; entry = entry->next ) {
+        if( entry->hash == hash && strcmp( entry->path, path ) == 0 )
+            return entry;
+    }
+    return NULL;
+}
+
+static void _content_cache_insert( content_cache_stripe_t *stripe, content_cache_entry_t *entry )
+{
+    content_cache_entry_t **slot = SLOT_OF(stripe, entry->hash);
+    entry->next = *slot;
+    *slot = entry;
+    /* new entries are put right behind the hand, i.e. they are checked last */
+    if( stripe->hand ) {
+        entry->clock_next = stripe->hand;
+        entry->clock_prev = stripe->hand->clock_prev;
+        entry->clock_prev->clock_next = entry;
+        stripe->hand->clock_prev = entry;
+    } else {
+        entry->clock_next = entry->clock_prev = entry;
+        stripe->hand = entry;
+    }
+    entry->cached = 1;
+    stripe->memory += entry->size;
+}
+
+/* remove an entry from the cache, it is freed once it is not used anymore */
+static void _content_cache_remove( content_cache_stripe_t *stripe, content_cache_entry_t *entry )
+{
+    content_cache_entry_t **pp = SLOT_OF(stripe, entry->hash);
+    while( *pp != entry ) pp = &(*pp)->next;
+    *pp = entry->next;
+    if( entry->clock_next == entry )
+        stripe->hand = NULL;
+    else {
+        if( stripe->hand == entry ) stripe->hand = entry->clock_next;
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+    }
+    entry->cached = 0;
+    stripe->memory -= entry->size;
+    if( !entry->refs ) free( entry );
+}
+
+/* evict entries until size more bytes fit into the stripe */
+static void _content_cache_evict( content_cache_t *cache, content_cache_stripe_t *stripe, size_t size )
+{
+    while( stripe->hand && stripe->memory + size > cache->max_memory ) {
+        content_cache_entry_t *entry = stripe->hand;
+        if( entry->referenced ) {
+            /* second chance */
+            entry->referenced = 0;
+            stripe->hand = entry->clock_next;
+        }
+        else
+            _content_cache_remove( stripe, entry );
+    }
+}
+
+void * content_cache_init( size_t max_memory, size_t max_file_size )
+{
+    int i;
+    content_cache_t *cache = (content_cache_t*)calloc( 1, sizeof(content_cache_t) );
+    if( !cache ) return NULL;
+
+    cache->max_memory = max_memory / CONTENT_CACHE_STRIPES;
+    cache->max_file_size = (max_file_size < cache->max_memory) ? max_file_size : cache->max_memory;
+    for( i = 0; i < CONTENT_CACHE_STRIPES; ++i )
+        cthread_mutex_init( &cache->stripes[i].lock );
+    return cache;
+}
+
+int content_cache_fits( void *data, off_t size )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    return cache->max_memory && size >= 0 && (size_t)size <= cache->max_file_size;
+}
+
+content_cache_entry_t * content_cache_get( void *data, const char *path, time_t mtime, off_t size )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    const unsigned long hash = strhash( path );
+    content_cache_stripe_t *stripe = STRIPE_OF(cache, hash);
+    content_cache_entry_t *entry;
+
+    if( !content_cache_fits( cache, size ) ) return NULL;
+
+    cthread_mutex_lock( &stripe->lock );
+    if( (entry = _content_cache_find( stripe, path, hash )) ) {
+        if( entry->mtime == mtime && entry->file_size == size ) {
+            entry->referenced = 1;
+            ++entry->refs;
+        } else {
+            /* the file was modified */
+            _content_cache_remove( stripe, entry );
+            entry = NULL;
+        }
+    }
+    cthread_mutex_unlock( &stripe->lock );
+    return entry;
+}
+
+int content_cache_contains( void *data, const char *path, time_t mtime, off_t size )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    const unsigned long hash = strhash( path );
+    content_cache_stripe_t *stripe = STRIPE_OF(cache, hash);
+    content_cache_entry_t *entry;
+    int found;
+
+    if( !content_cache_fits( cache, size ) ) return 0;
+
+    cthread_mutex_lock( &stripe->lock );
+    found = (entry = _content_cache_find( stripe, path, hash ))
+            && entry->mtime == mtime && entry->file_size == size;
+    cthread_mutex_unlock( &stripe->lock );
+    return found;
+}
+
+/* allocate a referenced entry with room for size bytes of content */
+static content_cache_entry_t * _content_cache_new( const char *path, time_t mtime, off_t file_size,
+                                                   const char *fields, size_t fields_len, size_t size )
+{
+    const size_t path_len = strlen( path );
+    content_cache_entry_t *entry;
+    char *p;
+
+    if( !(entry = (content_cache_entry_t*)malloc( sizeof(content_cache_entry_t)
+                                                  + path_len + 1 + fields_len + size )) )
+        return NULL;
+    memset( entry, 0, sizeof(content_cache_entry_t) );
+    p = (char*)(entry + 1);
+    entry->path = p;
+    memcpy( p, path, path_len + 1 );
+    p += path_len + 1;
+    entry->fields = p;
+    entry->fields_len = fields_len;
+    memcpy( p, fields, fields_len );
+    entry->data = p + fields_len;
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->file_size = file_size;
+    entry->hash = strhash( path );
+    entry->refs = 1;
+    return entry;
+}
+
+/* put a new entry into the cache, an older entry of the same path is replaced */
+static content_cache_entry_t * _content_cache_store( content_cache_t *cache, content_cache_entry_t *entry )
+{
+    content_cache_stripe_t *stripe = STRIPE_OF(cache, entry->hash);
+    content_cache_entry_t *old;
+
+    cthread_mutex_lock( &stripe->lock );
+    if( (old = _content_cache_find( stripe, entry->path, entry->hash )) )
+        _content_cache_remove( stripe, old );
+    _content_cache_evict( cache, stripe, entry->size );
+    _content_cache_insert( stripe, entry );
+    cthread_mutex_unlock( &stripe->lock );
+    return entry;
+}
+
+content_cache_entry_t * content_cache_add( void *data, const char *path, int fd, time_t mtime,
+                                           off_t size, const char *fields, size_t fields_len )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    content_cache_entry_t *entry;
+    size_t done = 0;
+
+    if( !content_cache_fits( cache, size ) ) return NULL;
+    if( !(entry = _content_cache_new( path, mtime, size, fields, fields_len, (size_t)size )) )
+        return NULL;
+
+    /* the file is read without holding the lock */
+    while( done < entry->size ) {
+        const long ret = cfile_pread( fd, (char*)entry->data + done, entry->size - done, (off_t)done );
+        if( ret <= 0 ) {
+            /* read error or the file was truncated in the meantime */
+            free( entry );
+            return NULL;
+        }
+        done += (size_t)ret;
+    }
+    return _content_cache_store( cache, entry );
+}
+
+content_cache_entry_t * content_cache_put( void *data, const char *path, time_t mtime, off_t file_size,
+                                           const char *fields, size_t fields_len,
+                                           const void *content, size_t size )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    content_cache_entry_t *entry;
+
+    if( !content_cache_fits( cache, file_size ) || size > cache->max_memory ) return NULL;
+    if( !(entry = _content_cache_new( path, mtime, file_size, fields, fields_len, size )) )
+        return NULL;
+    memcpy( (char*)entry->data, content, size );
+    return _content_cache_store( cache, entry );
+}
+
+void content_cache_release( void *data, content_cache_entry_t *entry )
+{
+    content_cache_t *cache = (content_cache_t*)data;
+    content_cache_stripe_t *stripe;
+    int destroy;
+    if( !entry ) return;
+
+    stripe = STRIPE_OF(cache, entry->hash);
+    cthread_mutex_lock( &stripe->lock );
+    destroy = (--entry->refs == 0 && !entry->cached);
+    cthread_mutex_unlock( &stripe->lock );
+    if( destroy ) free( entry );
+}
+
+void content_cache_free( void *data )
+{
+    int i;
+    content_cache_t *cache = (content_cache_t*)data;
+    if( !cache ) return;
+
+    for( i = 0; i < CONTENT_CACHE_STRIPES; ++i ) {
+        content_cache_stripe_t *stripe = &cache->stripes[i];
+        while( stripe->hand )
+            _content_cache_remove( stripe, stripe->hand );
+        cthread_mutex_destroy( &stripe->lock );
+    }
+    free( cache );
+}
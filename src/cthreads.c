@@ -7,11 +7,19 @@
 /** @file cthreads.c
  *  @author Jahn Fuchs
  *
- *  cthreads wraps simple threads, mutexes, semaphores and a readers-writer_lock
+ *  cthreads wraps simple threads, mutexes, semaphores, a readers-writer_lock,
+ *  a bounded lock-free ring buffer and a pool of worker threads fed by it
  *  that can be used without changes on both posix and ms windows systems.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    /* for pthread_setaffinity_np and sched_getaffinity */
+    #define _GNU_SOURCE
+#endif
+
 #include <time.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cthreads.h"
 
 #ifdef _WIN32
@@ -19,7 +27,24 @@
 #else
     static int bAttrInit = 0;
     static pthread_attr_t _pt_attr;
+    #include <signal.h>
     #include <sys/time.h>
+    #include <unistd.h>
+    #ifdef __linux__
+        #include <sched.h>
+    #endif
+#endif
+
+/* atomic helpers for the ring buffer */
+#ifdef _WIN32
+    #define CTHREAD_MEMORY_BARRIER() MemoryBarrier()
+    #define CTHREAD_CAS_SIZE(ptr, oldval, newval) \
+        (InterlockedCompareExchangePointer( (PVOID volatile*)(ptr), \
+            (PVOID)(newval), (PVOID)(oldval) ) == (PVOID)(oldval))
+#else
+    #define CTHREAD_MEMORY_BARRIER() __sync_synchronize()
+    #define CTHREAD_CAS_SIZE(ptr, oldval, newval) \
+        __sync_bool_compare_and_swap( (ptr), (oldval), (newval) )
 #endif
 
 int cthread_sleep(unsigned int milliseconds)
@@ -106,6 +131,88 @@ size_t cthread_attr_getstacksize()
     #endif
 }
 
+/* number of online processors, at least 1 */
+static unsigned int _cthread_cpus_online( void )
+{
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo( &info );
+        return info.dwNumberOfProcessors ? (unsigned int)info.dwNumberOfProcessors : 1;
+    #elif defined(_SC_NPROCESSORS_ONLN)
+        long count = sysconf( _SC_NPROCESSORS_ONLN );
+        return (count > 0) ? (unsigned int)count : 1;
+    #else
+        return 1;
+    #endif
+}
+
+unsigned int cthread_cpu_count( void )
+{
+    #ifdef _WIN32
+        DWORD_PTR mask, system_mask;
+        unsigned int count = 0;
+        if( GetProcessAffinityMask( GetCurrentProcess(), &mask, &system_mask ) )
+            for( ; mask; mask >>= 1 )
+                count += (unsigned int)(mask & 1);
+        if( count ) return count;
+    #elif defined(__linux__)
+        cpu_set_t set;
+        if( !sched_getaffinity( 0, sizeof(cpu_set_t), &set ) && CPU_COUNT( &set ) > 0 )
+            return (unsigned int)CPU_COUNT( &set );
+    #endif
+    return _cthread_cpus_online();
+}
+
+unsigned int cthread_cpu_list( unsigned int *cpus, unsigned int max )
+{
+    unsigned int count = 0, i;
+    #ifdef _WIN32
+        DWORD_PTR mask, system_mask;
+        if( GetProcessAffinityMask( GetCurrentProcess(), &mask, &system_mask ) )
+            for( i = 0; i < sizeof(DWORD_PTR) * 8 && count < max; ++i )
+                if( mask & ((DWORD_PTR)1 << i) ) cpus[count++] = i;
+    #elif defined(__linux__)
+        cpu_set_t set;
+        if( !sched_getaffinity( 0, sizeof(cpu_set_t), &set ) )
+            for( i = 0; i < CPU_SETSIZE && count < max; ++i )
+                if( CPU_ISSET( i, &set ) ) cpus[count++] = i;
+    #endif
+    if( !count ) {
+        /* the affinity mask is unknown, every online processor is used */
+        const unsigned int online = _cthread_cpus_online();
+        for( i = 0; i < online && count < max; ++i )
+            cpus[count++] = i;
+    }
+    return count;
+}
+
+int cthread_set_affinity( c_thread *thread, unsigned int cpu )
+{
+    #ifdef _WIN32
+        if( cpu >= sizeof(DWORD_PTR) * 8 ) return 0;
+        return SetThreadAffinityMask( *thread, (DWORD_PTR)1 << cpu ) != 0;
+    #elif defined(__linux__)
+        cpu_set_t set;
+        if( cpu >= CPU_SETSIZE ) return 0;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        return !pthread_setaffinity_np( *thread, sizeof(cpu_set_t), &set );
+    #else
+        /* not supported */
+        (void)thread; (void)cpu;
+        return 0;
+    #endif
+}
+
+long cthread_atomic_add( volatile long *value, long delta )
+{
+    #ifdef _WIN32
+        return InterlockedExchangeAdd( value, delta ) + delta;
+    #else
+        return __sync_add_and_fetch( value, delta );
+    #endif
+}
+
 /* returns 0 on error */
 int cthread_detach(c_thread * thread_handle)
 {
@@ -341,3 +448,169 @@ int cthread_rwlock_write_post( c_rwlock *rwlock )
         cthread_sem_post( &rwlock->readers );
     return 1;
 }
+
+/* The ring buffer follows the bounded MPMC queue design by Dmitry Vyukov:
+ * every cell carries a sequence number that tells producers and consumers
+ * if the cell is ready for them, positions are claimed with a single CAS. */
+int cthread_ring_init( c_ring *ring, size_t capacity )
+{
+    size_t i, size = 2;
+    while( size < capacity ) size <<= 1;
+
+    if( !(ring->cells = (c_ring_cell*)malloc( size * sizeof(c_ring_cell) )) )
+        return 0;
+    for( i = 0; i < size; ++i ) {
+        ring->cells[i].seq = i;
+        ring->cells[i].data = NULL;
+    }
+    ring->mask = size - 1;
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    CTHREAD_MEMORY_BARRIER();
+    return 1;
+}
+
+void cthread_ring_destroy( c_ring *ring )
+{
+    free( ring->cells );
+    ring->cells = NULL;
+}
+
+size_t cthread_ring_capacity( const c_ring *ring )
+{
+    return ring->mask + 1;
+}
+
+int cthread_ring_push( c_ring *ring, void *data )
+{
+    c_ring_cell *cell;
+    size_t pos = ring->enqueue_pos;
+
+    for( ;; ) {
+        long diff;
+        cell = &ring->cells[pos & ring->mask];
+        diff = (long)(cell->seq - pos);
+        CTHREAD_MEMORY_BARRIER();
+        if( diff == 0 ) {
+            if( CTHREAD_CAS_SIZE( &ring->enqueue_pos, pos, pos + 1 ) )
+                break;
+        }
+        else if( diff < 0 )
+            return 0; /* full */
+        pos = ring->enqueue_pos;
+    }
+
+    cell->data = data;
+    CTHREAD_MEMORY_BARRIER();
+    cell->seq = pos + 1;
+    return 1;
+}
+
+void * cthread_ring_pop( c_ring *ring )
+{
+    void *data;
+    c_ring_cell *cell;
+    size_t pos = ring->dequeue_pos;
+
+    for( ;; ) {
+        long diff;
+        cell = &ring->cells[pos & ring->mask];
+        diff = (long)(cell->seq - (pos + 1));
+        CTHREAD_MEMORY_BARRIER();
+        if( diff == 0 ) {
+            if( CTHREAD_CAS_SIZE( &ring->dequeue_pos, pos, pos + 1 ) )
+                break;
+        }
+        else if( diff < 0 )
+            return NULL; /* empty */
+        pos = ring->dequeue_pos;
+    }
+
+    data = cell->data;
+    CTHREAD_MEMORY_BARRIER();
+    cell->seq = pos + ring->mask + 1;
+    return data;
+}
+
+/* Worker main function */
+static CTHREAD_RET _cthread_pool_worker( CTHREAD_ARG data )
+{
+    c_pool *pool = (c_pool*)data;
+
+    #ifndef _WIN32
+    {   /* signals are handled by the main thread */
+        sigset_t set;
+        sigfillset( &set );
+        pthread_sigmask( SIG_BLOCK, &set, NULL );
+    }
+    #endif
+
+    pool->run( pool );
+    return (CTHREAD_RETURN) 0;
+}
+
+int cthread_pool_init( c_pool *pool, unsigned int workers, size_t queue_size,
+                       void (*run)( c_pool *pool ), void *data )
+{
+    memset( pool, 0, sizeof(c_pool) );
+    pool->run = run;
+    pool->data = data;
+    if( !cthread_ring_init( &pool->queue, queue_size ) )
+        return 0;
+    if( !(pool->workers = (c_thread*)malloc( workers * sizeof(c_thread) )) ) {
+        cthread_ring_destroy( &pool->queue );
+        return 0;
+    }
+    cthread_sem_init( &pool->queue_items, 0 );
+
+    for( pool->num_workers = 0; pool->num_workers < workers; ++pool->num_workers ) {
+        if( !cthread_create( &pool->workers[pool->num_workers], _cthread_pool_worker, pool ) ) {
+            cthread_pool_destroy( pool, NULL );
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int cthread_pool_push( c_pool *pool, void *item )
+{
+    if( pool->stop || !cthread_ring_push( &pool->queue, item ) )
+        return 0;
+    cthread_sem_post( &pool->queue_items );
+    return 1;
+}
+
+void * cthread_pool_pop( c_pool *pool )
+{
+    void *item;
+    cthread_sem_wait( &pool->queue_items );
+    /* a posted item might not be visible yet if another
+     * producer claimed an earlier slot, retry until it is */
+    while( !(item = cthread_ring_pop( &pool->queue )) ) {
+        if( pool->stop ) return NULL;
+        cthread_sleep( 1 );
+    }
+    return item;
+}
+
+void cthread_pool_destroy( c_pool *pool, void (*discard)( void *item ) )
+{
+    unsigned int i;
+    void *item;
+    if( !pool->workers ) return;
+
+    /* wake up all workers, an empty queue tells them to stop */
+    pool->stop = 1;
+    for( i = 0; i < pool->num_workers; ++i )
+        cthread_sem_post( &pool->queue_items );
+    for( i = 0; i < pool->num_workers; ++i )
+        cthread_join( &pool->workers[i] );
+
+    while( (item = cthread_ring_pop( &pool->queue )) )
+        if( discard ) discard( item );
+
+    cthread_sem_destroy( &pool->queue_items );
+    cthread_ring_destroy( &pool->queue );
+    free( pool->workers );
+    pool->workers = NULL;
+}
@@ -0,0 +1,1550 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file event_loop.c
+ * Event loop (reactor) implementation. The loop accepts new connections
+ * and watches idle client connections. Readable connections are dispatched
+ * to the web thread workers, which hand the connection back to the loop or
+ * close it after processing a request.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    /* for pipe2 and F_GETPIPE_SZ */
+    #define _GNU_SOURCE
+#endif
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <time.h>
+    #include <poll.h>
+    #ifdef __linux__
+        #include <sys/epoll.h>
+        #define EVENT_LOOP_EPOLL 1
+        #if defined(__has_include)
+            #if __has_include(<linux/io_uring.h>)
+                #include <linux/io_uring.h>
+            #endif
+        #endif
+        /* multishot accept and provided buffer rings need linux >= 5.19 headers */
+        #ifdef IORING_ACCEPT_MULTISHOT
+            #include <sys/mman.h>
+            #include <sys/socket.h>
+            #include <sys/syscall.h>
+            #define EVENT_LOOP_URING 1
+        #endif
+    #endif
+#endif
+
+#include "ip_socket_utils.h"
+#include "event_loop.h"
+#include "http_request.h"
+#include "settings.h"
+#include "timer_wheel.h"
+#include "log.h"
+
+SETLOGMODULENAME("event_loop");
+
+/** Resolution of the connection deadlines in milliseconds. */
+#define TIMER_RESOLUTION_MS 100
+
+/** Maximum number of events handled per epoll_wait call. */
+#define EPOLL_MAX_EVENTS 64
+
+/** Number of io_uring submission queue entries. */
+#define URING_ENTRIES 256
+/** Number and size of the receive buffers in the io_uring provided buffer ring. */
+#define URING_BUF_COUNT 128
+#define URING_BUF_SIZE 4096
+/** Maximum number of pipe sized chunks of a file that are spliced per round. */
+#define URING_SPLICE_ROUND 8
+/** Number of idle splice pipes that are kept open. */
+#define URING_PIPES 64
+
+#ifdef _WIN32
+    /* no self pipe on windows, the select backend wakes up periodically */
+    #define SELECT_TIMEOUT_MS 100
+    #define SOCKET_ERRNO WSAGetLastError()
+    #define SOCKET_WOULDBLOCK(e) ((e) == WSAEWOULDBLOCK)
+    #define SHUT_RD SD_RECEIVE
+    /* windows fd_sets are arrays of sockets with FD_SETSIZE entries */
+    #define FD_SETTABLE(fd, count) ((count) < FD_SETSIZE)
+#else
+    #define SOCKET_ERRNO errno
+    #define SOCKET_WOULDBLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK || (e) == EINTR)
+#endif
+
+typedef struct event_loop_s event_loop_t;
+
+/** Idle connection lists, the connections watched by the backend.
+ * Their deadlines are kept in the timer wheel of the loop. */
+enum {
+    IDLE_LIST_NONE = -1,
+    IDLE_LIST_NEW = 0,      /**< accepted, waiting for the first request */
+    IDLE_LIST_KEEPALIVE,    /**< persistent, waiting for the next request */
+    IDLE_LISTS
+};
+
+typedef struct {
+    thread_arg_t *head;
+    thread_arg_t *tail;
+} idle_list_t;
+
+/** Event loop backend. */
+typedef struct {
+    int engine;                 /* io engine setting that selects the backend */
+    const char *name;
+    int  (*init)( event_loop_t *loop );
+    void (*free)( event_loop_t *loop );
+    int  (*add_listener)( event_loop_t *loop, int fd );
+    int  (*watch)( event_loop_t *loop, thread_arg_t *conn );
+    /** Wait for events and handle them, returns 0 on error. */
+    int  (*wait)( event_loop_t *loop );
+    /** Close a watched connection that timed out, NULL if the
+     * connection can be closed right away. */
+    void (*close)( event_loop_t *loop, thread_arg_t *conn );
+    /** Send the rest of the replies on a connection and watch or close it
+     * afterwards, NULL if the workers send. Returns 0 if the reply was
+     * not queued, it is sent by the caller then. */
+    int  (*reply)( event_loop_t *loop, thread_arg_t *conn, send_buffer_t *sendbuf, int keep_alive );
+} event_backend_t;
+
+#if EVENT_LOOP_URING
+/** io_uring instance, the rings are shared with the kernel. */
+typedef struct {
+    int fd;
+    c_mutex sq_mutex;           /* protects the submission queue */
+    c_thread owner;             /* thread that runs the event loop */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *rings;                /* mapping of both rings */
+    size_t rings_size;
+    struct io_uring_buf_ring *buf_ring; /* provided receive buffers, NULL if unsupported */
+    char *bufs;
+    int accept_multishot;       /* multishot accept is supported */
+    thread_arg_t *closing;      /* timed out connections with a pending request */
+    thread_arg_t *sending;      /* connections with a reply in flight, protected
+                                   by the submission queue mutex */
+    int pipes[URING_PIPES][3];  /* idle splice pipes and their size */
+    int num_pipes;
+    long page_size;             /* a pipe buffer holds up to a page of a file */
+} uring_t;
+
+/** Reply of a connection that is sent by the io_uring backend. The requests
+ * of a reply are queued in rounds, the next round is queued by the loop once
+ * all requests of a round are complete. */
+typedef struct {
+    char *head;                 /* buffered data of the reply, i.e. the header */
+    size_t head_size;
+    struct iovec iov[2];        /* head and a body in memory */
+    struct msghdr msg;
+    int head_queued;
+    send_body_t body;
+    int pipe[3];                /* splice pipe of a file body and its size, -1 if none */
+    off_t spliced;              /* bytes of the file body that were queued */
+    unsigned inflight;          /* requests of the round that did not complete yet */
+    long expected, done;        /* bytes the requests of the round transfer */
+    int error;                  /* first error of the reply */
+    int keep_alive;
+} uring_reply_t;
+#endif
+
+/** Event loop data. */
+struct event_loop_s {
+    const event_backend_t *backend;
+    thread_arg_t *baseargs;     /* copied for every accepted connection */
+    volatile int running;
+    size_t hit;                 /* counter for number of accepted connections */
+
+    int listeners[EVENT_LOOP_MAX_LISTENERS];
+    int num_listeners;
+    int wakeup[2];              /* self pipe, to interrupt a waiting backend */
+
+#if EVENT_LOOP_EPOLL
+    int epfd;                   /* epoll instance */
+#endif
+#if EVENT_LOOP_URING
+    uring_t uring;              /* io_uring instance */
+#endif
+#ifndef _WIN32
+    struct pollfd *pfds;        /* poll backend: watched descriptors... */
+    thread_arg_t **pconns;      /* ...and their connections */
+    size_t pcapacity;
+#endif
+    c_mutex conn_mutex;         /* protects the idle lists, the timer wheel and the wake up time */
+    idle_list_t idle[IDLE_LISTS]; /* watched client connections */
+    timer_wheel_t timers;       /* deadlines of idle connections and of requests being received */
+    unsigned long header_timeout;    /* ms */
+    unsigned long body_timeout;      /* ms */
+    unsigned long keepalive_timeout; /* ms */
+    int waiting;                /* the backend waits until wake_at */
+    unsigned long wake_at;
+};
+
+/* free a thread argument struct */
+static void free_thread_arg( thread_arg_t *arg )
+{
+    if( !arg ) return;
+    free( arg->client_addr );
+    free( arg->pending );
+#if EVENT_LOOP_URING
+    if( arg->reply ) {
+        uring_reply_t *reply = (uring_reply_t*)arg->reply;
+        if( reply->pipe[0] != -1 ) {
+            close( reply->pipe[0] );
+            close( reply->pipe[1] );
+        }
+        free( reply->head );
+        free( reply );
+    }
+#endif
+    free( arg );
+}
+
+/* close a client connection that is not in the timer wheel */
+static void _event_loop_close( thread_arg_t *conn )
+{
+    closesocket( conn->fd );
+    free_thread_arg( conn );
+}
+
+/* set a socket to blocking or non-blocking mode, returns 0 on error */
+static int _socket_set_nonblocking( int fd, int nonblocking )
+{
+#ifdef _WIN32
+    u_long mode = nonblocking ? 1 : 0;
+    return ioctlsocket( fd, FIONBIO, &mode ) == 0;
+#else
+    int flags = fcntl( fd, F_GETFL, 0 );
+    if( flags < 0 ) return 0;
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl( fd, F_SETFL, flags ) == 0;
+#endif
+}
+
+/* interrupt a waiting backend */
+static void _event_loop_wakeup( event_loop_t *loop )
+{
+#ifndef _WIN32
+    if( loop->wakeup[1] != -1 ) {
+        ssize_t ret = write( loop->wakeup[1], "", 1 );
+        (void)ret; /* if the pipe is full a wake up is pending anyway */
+    }
+#endif
+}
+
+/* read all pending wake up bytes */
+static void _event_loop_drain_wakeup( event_loop_t *loop )
+{
+#ifndef _WIN32
+    char buf[64];
+    while( read( loop->wakeup[0], buf, sizeof(buf) ) > 0 );
+#endif
+}
+
+/* monotonic time in milliseconds */
+static unsigned long _event_loop_now( void )
+{
+#ifdef _WIN32
+    return (unsigned long)GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (unsigned long)ts.tv_sec * 1000UL + (unsigned long)(ts.tv_nsec / 1000000L);
+#endif
+}
+
+/* arm the timer of a connection, the caller holds the connection mutex.
+ * A waiting backend does not know about deadlines before its wake up time. */
+static void _event_loop_arm( event_loop_t *loop, thread_arg_t *conn, unsigned long timeout )
+{
+    conn->deadline = _event_loop_now() + timeout;
+    timer_wheel_add( &loop->timers, &conn->timer, conn->deadline );
+    if( loop->waiting && (long)(conn->deadline - loop->wake_at) < 0 ) {
+        loop->waiting = 0;
+        _event_loop_wakeup( loop );
+    }
+}
+
+void event_loop_close( thread_arg_t *conn )
+{
+    event_loop_t *loop;
+    if( !conn ) return;
+    if( (loop = (event_loop_t*)conn->pDataEventLoop) ) {
+        /* the timer has to be gone before the socket can be reused */
+        cthread_mutex_lock( &loop->conn_mutex );
+        timer_wheel_remove( &loop->timers, &conn->timer );
+        cthread_mutex_unlock( &loop->conn_mutex );
+    }
+    _event_loop_close( conn );
+}
+
+void event_loop_deadline( thread_arg_t *conn, int deadline )
+{
+    event_loop_t *loop = (event_loop_t*)conn->pDataEventLoop;
+    if( !loop ) return;
+    cthread_mutex_lock( &loop->conn_mutex );
+    conn->deadline_kind = deadline;
+    if( deadline == EVENT_DEADLINE_HEADER )
+        _event_loop_arm( loop, conn, loop->header_timeout );
+    else if( deadline == EVENT_DEADLINE_BODY )
+        _event_loop_arm( loop, conn, loop->body_timeout );
+    else
+        timer_wheel_remove( &loop->timers, &conn->timer );
+    cthread_mutex_unlock( &loop->conn_mutex );
+}
+
+/* append a connection to an idle list, the caller holds the connection mutex */
+static void _idle_list_append( event_loop_t *loop, thread_arg_t *conn, int list )
+{
+    idle_list_t *l = &loop->idle[list];
+    conn->idle_list = list;
+    conn->next = NULL;
+    conn->prev = l->tail;
+    if( l->tail ) l->tail->next = conn;
+    else l->head = conn;
+    l->tail = conn;
+}
+
+/* remove a connection from its idle list, the caller holds the connection mutex */
+static void _idle_list_remove( event_loop_t *loop, thread_arg_t *conn )
+{
+    idle_list_t *l;
+    if( conn->idle_list == IDLE_LIST_NONE ) return;
+    l = &loop->idle[conn->idle_list];
+    if( conn->prev ) conn->prev->next = conn->next;
+    else l->head = conn->next;
+    if( conn->next ) conn->next->prev = conn->prev;
+    else l->tail = conn->prev;
+    conn->prev = conn->next = NULL;
+    conn->idle_list = IDLE_LIST_NONE;
+}
+
+/* remove a connection from its idle list and the timer wheel */
+static void _event_loop_unwatch( event_loop_t *loop, thread_arg_t *conn )
+{
+    cthread_mutex_lock( &loop->conn_mutex );
+    _idle_list_remove( loop, conn );
+    timer_wheel_remove( &loop->timers, &conn->timer );
+    cthread_mutex_unlock( &loop->conn_mutex );
+}
+
+/* add a connection to the idle connections watched by the backend, the
+ * connection mutex is held so the connection cannot time out before it is
+ * watched. Connections that timed out during a request are not watched. */
+static int _event_loop_watch( event_loop_t *loop, thread_arg_t *conn, int list )
+{
+    int ret = 0;
+    cthread_mutex_lock( &loop->conn_mutex );
+    if( !conn->timed_out ) {
+        conn->deadline_kind = EVENT_DEADLINE_NONE;
+        _idle_list_append( loop, conn, list );
+        /* new connections have to send their request header in time */
+        _event_loop_arm( loop, conn, list == IDLE_LIST_NEW ? loop->header_timeout
+                                                           : loop->keepalive_timeout );
+        if( !(ret = loop->backend->watch( loop, conn )) ) {
+            _idle_list_remove( loop, conn );
+            timer_wheel_remove( &loop->timers, &conn->timer );
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+    return ret;
+}
+
+/* milliseconds until the timer wheel has to be advanced, -1 if no timer is armed */
+static int _event_loop_next_timeout( event_loop_t *loop )
+{
+    long timeout;
+    const unsigned long now = _event_loop_now();
+
+    cthread_mutex_lock( &loop->conn_mutex );
+    timeout = timer_wheel_next( &loop->timers, now );
+    if( timeout > INT_MAX ) timeout = INT_MAX;
+    loop->waiting = 1;
+    loop->wake_at = now + (timeout < 0 ? (unsigned long)LONG_MAX : (unsigned long)timeout);
+    cthread_mutex_unlock( &loop->conn_mutex );
+    return (int)timeout;
+}
+
+/* close all idle connections that timed out, requests
+ * that were not received in time are interrupted */
+static void _event_loop_expire( event_loop_t *loop )
+{
+    timer_entry_t *entry;
+    thread_arg_t *conn, *expired = NULL;
+
+    cthread_mutex_lock( &loop->conn_mutex );
+    loop->waiting = 0;
+    entry = timer_wheel_expire( &loop->timers, _event_loop_now() );
+    while( entry ) {
+        conn = (thread_arg_t*)entry->data;
+        entry = entry->next;
+        if( conn->idle_list != IDLE_LIST_NONE ) {
+            _idle_list_remove( loop, conn );
+            conn->next = expired;
+            expired = conn;
+        } else {
+            /* a worker receives the request, shutting the socket down makes a
+             * blocking receive return. The worker cannot close the socket
+             * in the meantime, it has to remove the timer first. */
+            LOG( log_DEBUG, "request timed out (hit %lu)", (unsigned long)conn->hit );
+            conn->timed_out = 1;
+            shutdown( conn->fd, SHUT_RD );
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+
+    while( (conn = expired) ) {
+        expired = conn->next;
+        LOG( log_DEBUG, "closing idle connection (hit %lu)", (unsigned long)conn->hit );
+        if( loop->backend->close )
+            loop->backend->close( loop, conn );
+        else
+            _event_loop_close( conn );
+    }
+}
+
+/* hand a readable connection to a web thread worker,
+ * connections that were rejected by the workers are closed */
+static void _event_loop_dispatch( event_loop_t *loop, thread_arg_t *conn )
+{
+    cthread_mutex_lock( &loop->conn_mutex );
+    /* the request header has to be complete in time, for new
+     * connections the time started when they were accepted */
+    if( conn->idle_list != IDLE_LIST_NEW )
+        _event_loop_arm( loop, conn, loop->header_timeout );
+    conn->deadline_kind = EVENT_DEADLINE_HEADER;
+    _idle_list_remove( loop, conn );
+    cthread_mutex_unlock( &loop->conn_mutex );
+
+    if( !webthread_dispatch( loop->baseargs->pDataSrvThreads, conn ) )
+        event_loop_close( conn );
+}
+
+/* store the network address and port of a client */
+static void _event_loop_set_client_addr( thread_arg_t *conn, const struct sockaddr_storage *addr )
+{
+    if( addr->ss_family == AF_INET6 ) {
+        struct sockaddr_in6 *cli_addr6 = (struct sockaddr_in6 *)addr;
+        if( (conn->client_addr = malloc(INET6_ADDRSTRLEN)) ) {
+            conn->client_addr[0] = 0;
+            inet_ntop( AF_INET6, &(cli_addr6->sin6_addr), conn->client_addr,
+                       INET6_ADDRSTRLEN, cli_addr6 );
+        }
+        conn->client_port = cli_addr6->sin6_port;
+    } else {
+        struct sockaddr_in *cli_addr4 = (struct sockaddr_in *)addr;
+        if( (conn->client_addr = malloc(INET_ADDRSTRLEN)) ) {
+            conn->client_addr[0] = 0;
+            inet_ntop( AF_INET, &(cli_addr4->sin_addr), conn->client_addr,
+                       INET_ADDRSTRLEN, cli_addr4 );
+        }
+        conn->client_port = cli_addr4->sin_port;
+    }
+}
+
+const char * event_loop_client_addr( thread_arg_t *conn )
+{
+    if( !conn->client_addr ) {
+        struct sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        if( getpeername( conn->fd, (struct sockaddr *)&addr, &length ) == 0 )
+            _event_loop_set_client_addr( conn, &addr );
+    }
+    return conn->client_addr ? conn->client_addr : "";
+}
+
+/* set up the connection data of an accepted client connection
+ * and add it to the idle connections watched by the backend. Without
+ * an address it is looked up once it is needed (event_loop_client_addr) */
+static void _event_loop_add_connection( event_loop_t *loop, int fd,
+                                        const struct sockaddr_storage *addr )
+{
+    thread_arg_t *conn;
+
+    ++loop->hit;
+
+    /* accepted sockets inherit O_NONBLOCK on some systems,
+     * the web thread workers use blocking sockets */
+    if( !_socket_set_nonblocking( fd, 0 )
+        || !(conn = (thread_arg_t*)malloc( sizeof(thread_arg_t) )) ) {
+        LOG( log_ERROR, "connection setup error (hit %lu)", (unsigned long)loop->hit );
+        closesocket( fd );
+        return;
+    }
+
+    /* copy baseargs (contains pointers to settings and module data) */
+    memcpy( conn, loop->baseargs, sizeof(thread_arg_t) );
+    conn->fd = fd;
+    conn->hit = loop->hit;
+    conn->prev = conn->next = NULL;
+    conn->idle_list = IDLE_LIST_NONE;
+    conn->deadline_kind = EVENT_DEADLINE_NONE;
+    conn->timed_out = 0;
+    timer_entry_init( &conn->timer, conn );
+    conn->loop_registered = 0;
+    conn->requests = 0;
+    conn->pending = NULL;
+    conn->pending_len = 0;
+    conn->request = NULL;
+    conn->reply = NULL;
+    conn->client_addr = NULL;
+    conn->client_port = 0;
+    if( addr ) _event_loop_set_client_addr( conn, addr );
+
+    if( (addr && !conn->client_addr) || !_event_loop_watch( loop, conn, IDLE_LIST_NEW ) ) {
+        LOG( log_ERROR, "connection setup error (hit %lu)", (unsigned long)loop->hit );
+        _event_loop_close( conn );
+    }
+}
+
+/* accept all pending connections on a listen socket */
+static void _event_loop_accept( event_loop_t *loop, int listenfd )
+{
+    for( ;; ) {
+        struct sockaddr_storage addr;
+        socklen_t length = sizeof(addr);
+        int fd = (int)accept( listenfd, (struct sockaddr *)&addr, &length );
+
+        if( fd < 0 ) {
+            const int err = SOCKET_ERRNO;
+            if( !SOCKET_WOULDBLOCK(err) )
+                LOG( log_ERROR, "accept error (hit %lu): %s",
+                     (unsigned long)loop->hit, strerror(err) );
+            return;
+        }
+        _event_loop_add_connection( loop, fd, &addr );
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+/* epoll backend                                                            */
+/* ------------------------------------------------------------------------ */
+#if EVENT_LOOP_EPOLL
+
+static int _epoll_init( event_loop_t *loop )
+{
+    struct epoll_event ev;
+    if( (loop->epfd = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+        return 0;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop->wakeup;
+    return epoll_ctl( loop->epfd, EPOLL_CTL_ADD, loop->wakeup[0], &ev ) == 0;
+}
+
+static void _epoll_free( event_loop_t *loop )
+{
+    if( loop->epfd >= 0 ) close( loop->epfd );
+}
+
+static int _epoll_add_listener( event_loop_t *loop, int fd )
+{
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->listeners[loop->num_listeners];
+    return epoll_ctl( loop->epfd, EPOLL_CTL_ADD, fd, &ev ) == 0;
+}
+
+static int _epoll_watch( event_loop_t *loop, thread_arg_t *conn )
+{
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    /* one shot: the connection is owned by exactly one worker after an event */
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if( conn->loop_registered )
+        return epoll_ctl( loop->epfd, EPOLL_CTL_MOD, conn->fd, &ev ) == 0;
+    conn->loop_registered = 1;
+    return epoll_ctl( loop->epfd, EPOLL_CTL_ADD, conn->fd, &ev ) == 0;
+}
+
+static int _epoll_wait( event_loop_t *loop )
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int i, n = epoll_wait( loop->epfd, events, EPOLL_MAX_EVENTS,
+                           _event_loop_next_timeout( loop ) );
+
+    if( n < 0 )
+        return errno == EINTR;
+
+    for( i = 0; i < n; ++i ) {
+        void *ptr = events[i].data.ptr;
+        if( ptr == loop->wakeup ) {
+            _event_loop_drain_wakeup( loop );
+        }
+        else if( ptr >= (void*)loop->listeners
+                 && ptr < (void*)&loop->listeners[EVENT_LOOP_MAX_LISTENERS] ) {
+            _event_loop_accept( loop, *(int*)ptr );
+        }
+        else if( (events[i].events & (EPOLLERR | EPOLLHUP))
+                 && !(events[i].events & EPOLLIN) ) {
+            _event_loop_unwatch( loop, (thread_arg_t*)ptr );
+            _event_loop_close( (thread_arg_t*)ptr );
+        }
+        else {
+            _event_loop_dispatch( loop, (thread_arg_t*)ptr );
+        }
+    }
+    _event_loop_expire( loop );
+    return 1;
+}
+
+static const event_backend_t _epoll_backend = {
+    IO_ENGINE_EPOLL, "epoll", _epoll_init, _epoll_free, _epoll_add_listener,
+    _epoll_watch, _epoll_wait, NULL, NULL
+};
+
+#endif /* EVENT_LOOP_EPOLL */
+
+/* ------------------------------------------------------------------------ */
+/* io_uring backend                                                         */
+/* ------------------------------------------------------------------------ */
+#if EVENT_LOOP_URING
+
+/* request types, stored in the low bits of the request user data */
+#define URING_TAG_RECV   0UL    /* recv on a client connection */
+#define URING_TAG_POLL   1UL    /* poll on a client connection */
+#define URING_TAG_ACCEPT 2UL    /* accept on a listener, listener index in the upper bits */
+#define URING_TAG_WAKEUP 3UL    /* poll on the wake up pipe */
+#define URING_TAG_REPLY  4UL    /* send or splice of a reply on a client connection */
+#define URING_TAG_MASK   7UL
+#define URING_TAG_BITS   3
+
+/* ring indices are shared with the kernel */
+#define URING_LOAD(p)     __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define URING_STORE(p, v) __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+static int _uring_enter( int fd, unsigned to_submit, unsigned min_complete,
+                         unsigned flags, void *arg, size_t argsz )
+{
+    return (int)syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz );
+}
+
+/* number of queued requests that were not submitted yet */
+static unsigned _uring_queued( uring_t *ring )
+{
+    return URING_LOAD( ring->sq_tail ) - URING_LOAD( ring->sq_head );
+}
+
+/* hand a receive buffer (back) to the kernel */
+static void _uring_buf_recycle( uring_t *ring, unsigned short bid )
+{
+    struct io_uring_buf_ring *br = ring->buf_ring;
+    const unsigned short tail = br->tail;
+    struct io_uring_buf *buf = &br->bufs[tail & (URING_BUF_COUNT - 1)];
+    /* the resv field of the first entry is the ring tail, don't touch it */
+    buf->addr = (unsigned long)&ring->bufs[(size_t)bid * URING_BUF_SIZE];
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    URING_STORE( &br->tail, (unsigned short)(tail + 1) );
+}
+
+/* register the provided receive buffer ring, connections are
+ * polled instead if the kernel does not support it */
+static void _uring_setup_buffers( uring_t *ring )
+{
+    struct io_uring_buf_reg reg;
+    unsigned short i;
+    void *mem = mmap( NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( mem == MAP_FAILED ) return;
+
+    memset( &reg, 0, sizeof(reg) );
+    reg.ring_addr = (unsigned long)mem;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = 0;
+    if( !(ring->bufs = (char*)malloc( (size_t)URING_BUF_COUNT * URING_BUF_SIZE ))
+        || syscall( __NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+        LOG( log_INFO, "io_uring provided buffers are not supported, polling connections" );
+        munmap( mem, URING_BUF_COUNT * sizeof(struct io_uring_buf) );
+        free( ring->bufs );
+        ring->bufs = NULL;
+        return;
+    }
+    ring->buf_ring = (struct io_uring_buf_ring*)mem;
+    for( i = 0; i < URING_BUF_COUNT; ++i )
+        _uring_buf_recycle( ring, i );
+}
+
+/* queue a request. Requests of the loop thread are submitted together
+ * with the next wait, other threads submit their request right away. */
+static int _uring_queue( event_loop_t *loop, unsigned char opcode, int fd, unsigned long user_data )
+{
+    uring_t *ring = &loop->uring;
+    struct io_uring_sqe *sqe;
+    unsigned tail;
+    int ret = 0;
+
+    cthread_mutex_lock( &ring->sq_mutex );
+    tail = *ring->sq_tail;
+    if( tail - URING_LOAD( ring->sq_head ) >= ring->sq_entries ) {
+        /* submission queue is full */
+        _uring_enter( ring->fd, _uring_queued( ring ), 0, 0, NULL, 0 );
+    }
+    if( tail - URING_LOAD( ring->sq_head ) < ring->sq_entries ) {
+        sqe = &ring->sqes[tail & *ring->sq_mask];
+        memset( sqe, 0, sizeof(struct io_uring_sqe) );
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = user_data;
+        switch( opcode ) {
+        case IORING_OP_ACCEPT:
+            if( ring->accept_multishot ) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            break;
+        case IORING_OP_RECV:
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->len = URING_BUF_SIZE;
+            break;
+        case IORING_OP_POLL_ADD:
+            #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            sqe->poll32_events = __builtin_bswap32( POLLIN );
+            #else
+            sqe->poll32_events = POLLIN;
+            #endif
+            break;
+        }
+        URING_STORE( ring->sq_tail, tail + 1 );
+        ret = cthread_equal( cthread_self(), ring->owner )
+              || _uring_enter( ring->fd, _uring_queued( ring ), 0, 0, NULL, 0 ) >= 0;
+    }
+    cthread_mutex_unlock( &ring->sq_mutex );
+    return ret;
+}
+
+/* queue the next round of requests of a reply, the caller holds the submission
+ * queue mutex. The buffered head and a body in memory are sent with one sendmsg,
+ * a file body is spliced through the pipe of the reply, a pipe sized chunk at a
+ * time. The requests are linked, a failing request cancels the ones behind it.
+ * Returns 0 if the submission queue is full. */
+static int _uring_queue_reply( uring_t *ring, thread_arg_t *conn )
+{
+    uring_reply_t *reply = (uring_reply_t*)conn->reply;
+    const unsigned long user_data = (unsigned long)conn | URING_TAG_REPLY;
+    off_t left = reply->body.data ? 0 : reply->body.len - reply->spliced;
+    off_t pos = reply->body.offset + reply->spliced;
+    unsigned tail = *ring->sq_tail, count, chunks = 0, i;
+    unsigned lens[URING_SPLICE_ROUND];
+    struct io_uring_sqe *sqe = NULL;
+
+    /* a pipe buffer holds one page of the file, a chunk that starts within
+     * a page must leave room for that, or the splice into the pipe is short */
+    for( ; left > 0 && chunks < URING_SPLICE_ROUND; ++chunks ) {
+        const off_t room = reply->pipe[2] - pos % ring->page_size;
+        lens[chunks] = (unsigned)(left < room ? left : room);
+        left -= lens[chunks];
+        pos += lens[chunks];
+    }
+    count = (reply->head_queued ? 0 : 1) + 2 * chunks;
+    if( tail - URING_LOAD( ring->sq_head ) + count > ring->sq_entries ) {
+        /* submission queue is full */
+        _uring_enter( ring->fd, _uring_queued( ring ), 0, 0, NULL, 0 );
+        if( tail - URING_LOAD( ring->sq_head ) + count > ring->sq_entries )
+            return 0;
+    }
+    reply->inflight = count;
+    reply->expected = reply->done = 0;
+
+    if( !reply->head_queued ) {
+        sqe = &ring->sqes[tail++ & *ring->sq_mask];
+        memset( sqe, 0, sizeof(struct io_uring_sqe) );
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (unsigned long)&reply->msg;
+        sqe->len = 1;
+        /* the header goes out together with the first bytes of a file */
+        sqe->msg_flags = MSG_WAITALL | (chunks ? MSG_MORE : 0);
+        sqe->user_data = user_data;
+        reply->expected += (long)(reply->iov[0].iov_len + (reply->msg.msg_iovlen > 1 ? reply->iov[1].iov_len : 0));
+        reply->head_queued = 1;
+    }
+    for( i = 0; i < chunks; ++i ) {
+        const unsigned len = lens[i];
+        if( sqe ) sqe->flags |= IOSQE_IO_LINK;
+        sqe = &ring->sqes[tail++ & *ring->sq_mask];
+        memset( sqe, 0, sizeof(struct io_uring_sqe) );
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = reply->pipe[1];
+        sqe->off = (unsigned long long)-1;
+        sqe->splice_fd_in = reply->body.fd;
+        sqe->splice_off_in = (unsigned long long)(reply->body.offset + reply->spliced);
+        sqe->len = len;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = user_data;
+
+        sqe = &ring->sqes[tail++ & *ring->sq_mask];
+        memset( sqe, 0, sizeof(struct io_uring_sqe) );
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = conn->fd;
+        sqe->off = (unsigned long long)-1;
+        sqe->splice_fd_in = reply->pipe[0];
+        sqe->splice_off_in = (unsigned long long)-1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE | ((left || i + 1 < chunks) ? SPLICE_F_MORE : 0);
+        sqe->user_data = user_data;
+
+        reply->expected += 2L * len;
+        reply->spliced += len;
+    }
+    URING_STORE( ring->sq_tail, tail );
+    return 1;
+}
+
+/* release the body of a reply, its pipe is kept for other replies if it is empty */
+static void _uring_reply_done( uring_t *ring, uring_reply_t *reply, int pipe_empty )
+{
+    if( reply->body.release )
+        reply->body.release( reply->body.owner, reply->body.ref );
+    memset( &reply->body, 0, sizeof(send_body_t) );
+    if( reply->pipe[0] != -1 ) {
+        cthread_mutex_lock( &ring->sq_mutex );
+        if( pipe_empty && ring->num_pipes < URING_PIPES ) {
+            memcpy( ring->pipes[ring->num_pipes++], reply->pipe, sizeof(reply->pipe) );
+        } else {
+            close( reply->pipe[0] );
+            close( reply->pipe[1] );
+        }
+        cthread_mutex_unlock( &ring->sq_mutex );
+        reply->pipe[0] = reply->pipe[1] = -1;
+    }
+}
+
+/* take an idle splice pipe or open a new one, returns 0 on error */
+static int _uring_reply_pipe( uring_t *ring, uring_reply_t *reply )
+{
+    cthread_mutex_lock( &ring->sq_mutex );
+    if( ring->num_pipes )
+        memcpy( reply->pipe, ring->pipes[--ring->num_pipes], sizeof(reply->pipe) );
+    cthread_mutex_unlock( &ring->sq_mutex );
+    if( reply->pipe[0] != -1 )
+        return 1;
+    if( pipe2( reply->pipe, O_CLOEXEC ) != 0 ) {
+        reply->pipe[0] = reply->pipe[1] = -1;
+        return 0;
+    }
+    /* a chunk has to fit into the pipe, pipes might be smaller than
+     * the default if a user has many of them */
+    if( (reply->pipe[2] = fcntl( reply->pipe[1], F_GETPIPE_SZ )) <= 0 )
+        reply->pipe[2] = 4096;
+    return 1;
+}
+
+/* queue the replies of a worker on the ring, the queued requests are
+ * submitted right away, together with requests queued by the loop */
+static int _uring_reply( event_loop_t *loop, thread_arg_t *conn, send_buffer_t *sendbuf, int keep_alive )
+{
+    uring_t *ring = &loop->uring;
+    uring_reply_t *reply = (uring_reply_t*)conn->reply;
+    const int file = sendbuf->body.len && !sendbuf->body.data;
+    int ret;
+
+    if( !sendbuf->curpos && !sendbuf->body.len )
+        return 0;   /* nothing to send, just watch the connection */
+    if( !reply ) {
+        if( !(reply = (uring_reply_t*)calloc( 1, sizeof(uring_reply_t) )) )
+            return 0;
+        reply->pipe[0] = reply->pipe[1] = -1;
+        conn->reply = reply;
+    }
+    if( reply->head_size < sendbuf->curpos ) {
+        char *head = (char*)realloc( reply->head, sendbuf->curpos );
+        if( !head ) return 0;
+        reply->head = head;
+        reply->head_size = sendbuf->curpos;
+    }
+    if( file && !_uring_reply_pipe( ring, reply ) )
+        return 0;
+
+    memcpy( reply->head, sendbuf->buf, sendbuf->curpos );
+    reply->iov[0].iov_base = reply->head;
+    reply->iov[0].iov_len = sendbuf->curpos;
+    reply->iov[1].iov_base = (void*)sendbuf->body.data;
+    reply->iov[1].iov_len = sendbuf->body.data ? (size_t)sendbuf->body.len : 0;
+    memset( &reply->msg, 0, sizeof(reply->msg) );
+    reply->msg.msg_iov = reply->iov;
+    reply->msg.msg_iovlen = sendbuf->body.data ? 2 : 1;
+    reply->head_queued = 0;
+    reply->body = sendbuf->body;
+    reply->spliced = 0;
+    reply->error = 0;
+    reply->keep_alive = keep_alive;
+
+    cthread_mutex_lock( &ring->sq_mutex );
+    if( (ret = _uring_queue_reply( ring, conn )) ) {
+        conn->prev = NULL;
+        if( (conn->next = ring->sending) ) conn->next->prev = conn;
+        ring->sending = conn;
+        /* requests that can't be submitted now go with the next wait of the loop */
+        if( !cthread_equal( cthread_self(), ring->owner ) )
+            _uring_enter( ring->fd, _uring_queued( ring ), 0, 0, NULL, 0 );
+    }
+    cthread_mutex_unlock( &ring->sq_mutex );
+
+    if( !ret ) {
+        /* the caller sends the reply and releases the body */
+        memset( &reply->body, 0, sizeof(send_body_t) );
+        if( file ) _uring_reply_done( ring, reply, 1 );
+        return 0;
+    }
+    /* the body belongs to the reply now */
+    sendbuf->curpos = 0;
+    memset( &sendbuf->body, 0, sizeof(send_body_t) );
+    return 1;
+}
+
+/* handle a completed request of a reply, once the requests of a round are
+ * complete the next round is queued, or the connection is watched again */
+static void _uring_complete_reply( event_loop_t *loop, thread_arg_t *conn, int res )
+{
+    uring_t *ring = &loop->uring;
+    uring_reply_t *reply = (uring_reply_t*)conn->reply;
+    int queued = 0;
+
+    if( res >= 0 )
+        reply->done += res;
+    else if( !reply->error && res != -ECANCELED )
+        reply->error = -res;
+    if( --reply->inflight )
+        return;
+    /* a short send or splice cancels the linked requests, it is only seen
+     * when the peer goes away while the body is sent */
+    if( !reply->error && reply->done != reply->expected )
+        reply->error = EPIPE;
+
+    cthread_mutex_lock( &ring->sq_mutex );
+    if( !reply->error && !reply->body.data && reply->spliced < reply->body.len
+        && !(queued = _uring_queue_reply( ring, conn )) )
+        reply->error = EBUSY;
+    if( !queued ) {
+        if( conn->prev ) conn->prev->next = conn->next;
+        else ring->sending = conn->next;
+        if( conn->next ) conn->next->prev = conn->prev;
+        conn->prev = conn->next = NULL;
+    }
+    cthread_mutex_unlock( &ring->sq_mutex );
+    if( queued )
+        return;
+
+    _uring_reply_done( ring, reply, !reply->error );
+    if( reply->error && reply->error != EPIPE && reply->error != ECONNRESET )
+        LOG( log_WARNING, "sending reply failed (hit %lu): %s", (unsigned long)conn->hit,
+             strerror(reply->error) );
+    if( reply->error || !reply->keep_alive || !_event_loop_watch( loop, conn, IDLE_LIST_KEEPALIVE ) )
+        _event_loop_close( conn );
+}
+
+static void _uring_free( event_loop_t *loop )
+{
+    uring_t *ring = &loop->uring;
+    thread_arg_t *conn;
+
+    /* closing the ring cancels all pending requests */
+    if( ring->fd >= 0 ) close( ring->fd );
+    if( ring->rings ) munmap( ring->rings, ring->rings_size );
+    if( ring->sqes ) munmap( ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe) );
+    if( ring->buf_ring ) munmap( ring->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf) );
+    free( ring->bufs );
+    while( (conn = ring->closing) ) {
+        ring->closing = conn->next;
+        _event_loop_close( conn );
+    }
+    while( (conn = ring->sending) ) {
+        ring->sending = conn->next;
+        _uring_reply_done( ring, (uring_reply_t*)conn->reply, 0 );
+        _event_loop_close( conn );
+    }
+    while( ring->num_pipes-- > 0 ) {
+        close( ring->pipes[ring->num_pipes][0] );
+        close( ring->pipes[ring->num_pipes][1] );
+    }
+    cthread_mutex_destroy( &ring->sq_mutex );
+}
+
+static int _uring_init( event_loop_t *loop )
+{
+    uring_t *ring = &loop->uring;
+    struct io_uring_params p;
+    unsigned i;
+
+    cthread_mutex_init( &ring->sq_mutex );
+    ring->owner = cthread_self();
+    ring->accept_multishot = 1;
+    if( (ring->page_size = sysconf( _SC_PAGESIZE )) <= 0 )
+        ring->page_size = 4096;
+
+    memset( &p, 0, sizeof(p) );
+    if( (ring->fd = (int)syscall( __NR_io_uring_setup, URING_ENTRIES, &p )) < 0 )
+        return 0;
+    /* the loop waits with a timeout argument (linux 5.11) */
+    if( !(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_SINGLE_MMAP) )
+        return 0;
+
+    /* the submission and completion queue rings share one mapping */
+    ring->rings_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if( ring->rings_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) )
+        ring->rings_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings = mmap( NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+    if( ring->rings == MAP_FAILED ) {
+        ring->rings = NULL;
+        return 0;
+    }
+    ring->sq_entries = p.sq_entries;
+    ring->sqes = (struct io_uring_sqe*)mmap( NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+    if( ring->sqes == MAP_FAILED ) {
+        ring->sqes = NULL;
+        return 0;
+    }
+    ring->sq_head  = (unsigned*)((char*)ring->rings + p.sq_off.head);
+    ring->sq_tail  = (unsigned*)((char*)ring->rings + p.sq_off.tail);
+    ring->sq_mask  = (unsigned*)((char*)ring->rings + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->rings + p.sq_off.array);
+    ring->cq_head  = (unsigned*)((char*)ring->rings + p.cq_off.head);
+    ring->cq_tail  = (unsigned*)((char*)ring->rings + p.cq_off.tail);
+    ring->cq_mask  = (unsigned*)((char*)ring->rings + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->rings + p.cq_off.cqes);
+    for( i = 0; i < p.sq_entries; ++i )
+        ring->sq_array[i] = i;
+
+    _uring_setup_buffers( ring );
+    return _uring_queue( loop, IORING_OP_POLL_ADD, loop->wakeup[0], URING_TAG_WAKEUP );
+}
+
+static int _uring_add_listener( event_loop_t *loop, int fd )
+{
+    return _uring_queue( loop, IORING_OP_ACCEPT, fd,
+                         ((unsigned long)loop->num_listeners << URING_TAG_BITS) | URING_TAG_ACCEPT );
+}
+
+static int _uring_watch( event_loop_t *loop, thread_arg_t *conn )
+{
+    conn->loop_registered = 1;
+    /* receive the request right away if there are receive buffers */
+    if( loop->uring.buf_ring )
+        return _uring_queue( loop, IORING_OP_RECV, conn->fd, (unsigned long)conn | URING_TAG_RECV );
+    return _uring_queue( loop, IORING_OP_POLL_ADD, conn->fd, (unsigned long)conn | URING_TAG_POLL );
+}
+
+/* a timed out connection still has a pending request, shutting the socket
+ * down completes the request and the connection is closed afterwards */
+static void _uring_close( event_loop_t *loop, thread_arg_t *conn )
+{
+    uring_t *ring = &loop->uring;
+    conn->loop_registered = -1;
+    conn->prev = NULL;
+    if( (conn->next = ring->closing) ) conn->next->prev = conn;
+    ring->closing = conn;
+    shutdown( conn->fd, SHUT_RDWR );
+}
+
+/* handle a completed request of a client connection */
+static void _uring_complete_conn( event_loop_t *loop, thread_arg_t *conn,
+                                  unsigned long tag, int res, unsigned flags )
+{
+    uring_t *ring = &loop->uring;
+
+    if( flags & IORING_CQE_F_BUFFER ) {
+        const unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+        /* the received bytes are the start of the next request */
+        if( res > 0 && conn->loop_registered != -1
+            && !http_request_pending_append( conn, &ring->bufs[(size_t)bid * URING_BUF_SIZE], res ) )
+            res = -ENOMEM;
+        _uring_buf_recycle( ring, bid );
+    }
+
+    if( conn->loop_registered == -1 ) {
+        /* timed out before */
+        if( conn->prev ) conn->prev->next = conn->next;
+        else ring->closing = conn->next;
+        if( conn->next ) conn->next->prev = conn->prev;
+        _event_loop_close( conn );
+        return;
+    }
+
+    if( tag == URING_TAG_RECV && res == -ENOBUFS ) {
+        /* all receive buffers are in use, wait until the connection is readable */
+        if( _uring_queue( loop, IORING_OP_POLL_ADD, conn->fd, (unsigned long)conn | URING_TAG_POLL ) )
+            return;
+    }
+
+    if( res > 0 && (tag == URING_TAG_RECV || (res & POLLIN)) ) {
+        _event_loop_dispatch( loop, conn );
+    } else {
+        /* closed by the client or error */
+        _event_loop_unwatch( loop, conn );
+        _event_loop_close( conn );
+    }
+}
+
+/* handle a completed accept request */
+static void _uring_complete_accept( event_loop_t *loop, int listener, int res, unsigned flags )
+{
+    if( res >= 0 ) {
+        /* multishot accept cannot return the client address,
+         * it is looked up only if a request needs it */
+        _event_loop_add_connection( loop, res, NULL );
+    } else if( res == -EINVAL && loop->uring.accept_multishot ) {
+        LOG( log_INFO, "io_uring multishot accept is not supported" );
+        loop->uring.accept_multishot = 0;
+    } else if( res != -ECANCELED ) {
+        LOG( log_ERROR, "accept error (hit %lu): %s", (unsigned long)loop->hit, strerror(-res) );
+    }
+
+    /* rearm the accept request if the kernel is done with it */
+    if( !(flags & IORING_CQE_F_MORE) && loop->running
+        && !_uring_queue( loop, IORING_OP_ACCEPT, loop->listeners[listener],
+                          ((unsigned long)listener << URING_TAG_BITS) | URING_TAG_ACCEPT ) )
+        LOG( log_ERROR, "cannot queue accept request" );
+}
+
+static int _uring_wait( event_loop_t *loop )
+{
+    uring_t *ring = &loop->uring;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail;
+    const int timeout = _event_loop_next_timeout( loop );
+
+    ring->owner = cthread_self();
+    memset( &arg, 0, sizeof(arg) );
+    if( timeout >= 0 ) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (unsigned long)&ts;
+    }
+
+    /* submit the requests queued by the loop and wait with a single call */
+    if( _uring_enter( ring->fd, _uring_queued( ring ), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &arg, sizeof(arg) ) < 0 && errno != EINTR && errno != ETIME && errno != EBUSY )
+        return 0;
+
+    head = *ring->cq_head;
+    tail = URING_LOAD( ring->cq_tail );
+    for( ; head != tail; ++head ) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        const unsigned long user_data = (unsigned long)cqe->user_data;
+        const unsigned long tag = user_data & URING_TAG_MASK;
+        const int res = cqe->res;
+        const unsigned flags = cqe->flags;
+
+        /* free the completion queue entry before handling it */
+        URING_STORE( ring->cq_head, head + 1 );
+        if( tag == URING_TAG_WAKEUP ) {
+            _event_loop_drain_wakeup( loop );
+            if( !_uring_queue( loop, IORING_OP_POLL_ADD, loop->wakeup[0], URING_TAG_WAKEUP ) )
+                return 0;
+        }
+        else if( tag == URING_TAG_REPLY )
+            _uring_complete_reply( loop, (thread_arg_t*)(user_data & ~URING_TAG_MASK), res );
+        else if( tag == URING_TAG_ACCEPT )
+            _uring_complete_accept( loop, (int)(user_data >> URING_TAG_BITS), res, flags );
+        else
+            _uring_complete_conn( loop, (thread_arg_t*)(user_data & ~URING_TAG_MASK), tag, res, flags );
+    }
+    _event_loop_expire( loop );
+    return 1;
+}
+
+static const event_backend_t _uring_backend = {
+    IO_ENGINE_IO_URING, "io_uring", _uring_init, _uring_free, _uring_add_listener,
+    _uring_watch, _uring_wait, _uring_close, _uring_reply
+};
+
+#endif /* EVENT_LOOP_URING */
+
+/* ------------------------------------------------------------------------ */
+/* select backend (windows fallback)                                        */
+/* ------------------------------------------------------------------------ */
+#ifdef _WIN32
+
+static int _select_init( event_loop_t *loop )
+{
+    (void)loop;
+    return 1;
+}
+
+static void _select_free( event_loop_t *loop )
+{
+}
+
+static int _select_add_listener( event_loop_t *loop, int fd )
+{
+    (void)loop;
+    (void)fd;
+    return 1;
+}
+
+static int _select_watch( event_loop_t *loop, thread_arg_t *conn )
+{
+    (void)conn;
+    /* the idle lists are the watched connections, just wake up the loop */
+    _event_loop_wakeup( loop );
+    return 1;
+}
+
+static int _select_wait( event_loop_t *loop )
+{
+    fd_set set;
+    int i, l, count = 0, highfd = -1, timeout;
+    thread_arg_t *conn, *next, *ready = NULL;
+    struct timeval tv, *ptv = NULL;
+
+    FD_ZERO( &set );
+    for( i = 0; i < loop->num_listeners; ++i, ++count ) {
+        FD_SET( loop->listeners[i], &set );
+        if( loop->listeners[i] > highfd ) highfd = loop->listeners[i];
+    }
+
+    cthread_mutex_lock( &loop->conn_mutex );
+    for( l = 0; l < IDLE_LISTS; ++l ) {
+        for( conn = loop->idle[l].head; conn; conn = next ) {
+            next = conn->next;
+            if( !FD_SETTABLE(conn->fd, count) ) {
+                /* cannot be watched with select(), let a worker wait for it */
+                _idle_list_remove( loop, conn );
+                conn->next = ready;
+                ready = conn;
+                continue;
+            }
+            FD_SET( conn->fd, &set );
+            if( conn->fd > highfd ) highfd = conn->fd;
+            ++count;
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+
+    /* no self pipe on windows, wake up periodically */
+    timeout = _event_loop_next_timeout( loop );
+    if( timeout < 0 || timeout > SELECT_TIMEOUT_MS ) timeout = SELECT_TIMEOUT_MS;
+    if( timeout >= 0 ) {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        ptv = &tv;
+    }
+
+    if( !ready && select( highfd + 1, &set, NULL, NULL, ptv ) < 0 ) {
+        return SOCKET_ERRNO == EINTR;
+    } else if( ready ) {
+        /* don't block, dispatch the unwatchable connections first */
+        FD_ZERO( &set );
+    }
+
+    for( i = 0; i < loop->num_listeners; ++i ) {
+        if( FD_ISSET( loop->listeners[i], &set ) )
+            _event_loop_accept( loop, loop->listeners[i] );
+    }
+
+    cthread_mutex_lock( &loop->conn_mutex );
+    for( l = 0; l < IDLE_LISTS; ++l ) {
+        for( conn = loop->idle[l].head; conn; conn = next ) {
+            next = conn->next;
+            if( FD_ISSET( conn->fd, &set ) ) {
+                _idle_list_remove( loop, conn );
+                conn->next = ready;
+                ready = conn;
+            }
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+
+    while( (conn = ready) ) {
+        ready = conn->next;
+        conn->next = NULL;
+        _event_loop_dispatch( loop, conn );
+    }
+    _event_loop_expire( loop );
+    return 1;
+}
+
+static const event_backend_t _select_backend = {
+    IO_ENGINE_POLL, "select", _select_init, _select_free, _select_add_listener,
+    _select_watch, _select_wait, NULL, NULL
+};
+#define FALLBACK_BACKEND (&_select_backend)
+
+/* ------------------------------------------------------------------------ */
+/* poll backend (posix fallback)                                            */
+/* ------------------------------------------------------------------------ */
+#else
+
+static int _poll_init( event_loop_t *loop )
+{
+    (void)loop;
+    return 1;
+}
+
+static void _poll_free( event_loop_t *loop )
+{
+    free( loop->pfds );
+    free( loop->pconns );
+}
+
+static int _poll_add_listener( event_loop_t *loop, int fd )
+{
+    (void)loop;
+    (void)fd;
+    return 1;
+}
+
+static int _poll_watch( event_loop_t *loop, thread_arg_t *conn )
+{
+    (void)conn;
+    /* the idle lists are the watched connections, just wake up the loop */
+    _event_loop_wakeup( loop );
+    return 1;
+}
+
+/* make room for count watched descriptors, the caller holds the idle mutex */
+static int _poll_reserve( event_loop_t *loop, size_t count )
+{
+    struct pollfd *pfds;
+    thread_arg_t **pconns;
+    if( count <= loop->pcapacity ) return 1;
+
+    count += count / 2;
+    if( !(pfds = (struct pollfd*)realloc( loop->pfds, count * sizeof(struct pollfd) )) )
+        return 0;
+    loop->pfds = pfds;
+    if( !(pconns = (thread_arg_t**)realloc( loop->pconns, count * sizeof(thread_arg_t*) )) )
+        return 0;
+    loop->pconns = pconns;
+    loop->pcapacity = count;
+    return 1;
+}
+
+static int _poll_wait( event_loop_t *loop )
+{
+    int l;
+    size_t i, n = 0, count = 1 + loop->num_listeners;
+    thread_arg_t *conn, *ready = NULL;
+
+    cthread_mutex_lock( &loop->conn_mutex );
+    for( l = 0; l < IDLE_LISTS; ++l )
+        for( conn = loop->idle[l].head; conn; conn = conn->next ) ++count;
+    if( !_poll_reserve( loop, count ) ) {
+        cthread_mutex_unlock( &loop->conn_mutex );
+        return 0;
+    }
+
+    /* wake up pipe and listeners first, then the idle connections */
+    loop->pfds[n].fd = loop->wakeup[0];
+    loop->pconns[n++] = NULL;
+    for( l = 0; l < loop->num_listeners; ++l ) {
+        loop->pfds[n].fd = loop->listeners[l];
+        loop->pconns[n++] = NULL;
+    }
+    for( l = 0; l < IDLE_LISTS; ++l ) {
+        for( conn = loop->idle[l].head; conn; conn = conn->next ) {
+            loop->pfds[n].fd = conn->fd;
+            loop->pconns[n++] = conn;
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+    for( i = 0; i < n; ++i ) {
+        loop->pfds[i].events = POLLIN;
+        loop->pfds[i].revents = 0;
+    }
+
+    if( poll( loop->pfds, n, _event_loop_next_timeout( loop ) ) < 0 )
+        return errno == EINTR;
+
+    if( loop->pfds[0].revents )
+        _event_loop_drain_wakeup( loop );
+    for( l = 0; l < loop->num_listeners; ++l ) {
+        if( loop->pfds[1 + l].revents )
+            _event_loop_accept( loop, loop->listeners[l] );
+    }
+
+    /* only the loop removes connections from the idle lists,
+     * the collected connections are still in there */
+    cthread_mutex_lock( &loop->conn_mutex );
+    for( i = 1 + loop->num_listeners; i < n; ++i ) {
+        if( loop->pfds[i].revents ) {
+            conn = loop->pconns[i];
+            _idle_list_remove( loop, conn );
+            conn->next = ready;
+            ready = conn;
+        }
+    }
+    cthread_mutex_unlock( &loop->conn_mutex );
+
+    while( (conn = ready) ) {
+        ready = conn->next;
+        conn->next = NULL;
+        _event_loop_dispatch( loop, conn );
+    }
+    _event_loop_expire( loop );
+    return 1;
+}
+
+static const event_backend_t _poll_backend = {
+    IO_ENGINE_POLL, "poll", _poll_init, _poll_free, _poll_add_listener,
+    _poll_watch, _poll_wait, NULL, NULL
+};
+#define FALLBACK_BACKEND (&_poll_backend)
+
+#endif /* _WIN32 */
+
+/* ------------------------------------------------------------------------ */
+
+/* available backends, each one falls back to the next */
+static const event_backend_t *_event_backends[] = {
+    #if EVENT_LOOP_URING
+        &_uring_backend,
+    #endif
+    #if EVENT_LOOP_EPOLL
+        &_epoll_backend,
+    #endif
+    FALLBACK_BACKEND
+};
+
+void * event_loop_init( thread_arg_t *baseargs )
+{
+    const server_settings_t *pSettings = (server_settings_t*)baseargs->pSettings;
+    event_loop_t *loop = (event_loop_t*)malloc( sizeof(event_loop_t) );
+    unsigned int i = 0;
+    if( !loop ) return NULL;
+
+    memset( loop, 0, sizeof(event_loop_t) );
+    loop->baseargs = baseargs;
+    loop->running = 1;
+    loop->wakeup[0] = loop->wakeup[1] = -1;
+    loop->header_timeout = pSettings->request_header_timeout * 1000UL;
+    loop->body_timeout = pSettings->request_body_timeout * 1000UL;
+    loop->keepalive_timeout = pSettings->keepalive_timeout * 1000UL;
+    timer_wheel_init( &loop->timers, _event_loop_now(), TIMER_RESOLUTION_MS );
+    #if EVENT_LOOP_EPOLL
+        loop->epfd = -1;
+    #endif
+
+    #ifndef _WIN32
+    if( pipe( loop->wakeup ) != 0
+        || !_socket_set_nonblocking( loop->wakeup[0], 1 )
+        || !_socket_set_nonblocking( loop->wakeup[1], 1 ) ) {
+        LOG( log_ERROR, "cannot create wake up pipe: %s", strerror(errno) );
+        if( loop->wakeup[0] != -1 ) close( loop->wakeup[0] );
+        if( loop->wakeup[1] != -1 ) close( loop->wakeup[1] );
+        free( loop );
+        return NULL;
+    }
+    #endif
+    cthread_mutex_init( &loop->conn_mutex );
+
+    /* start with the configured io engine, or the next available one */
+    while( _event_backends[i] != FALLBACK_BACKEND && _event_backends[i]->engine < pSettings->io_engine )
+        ++i;
+    for( loop->backend = _event_backends[i]; loop->backend != FALLBACK_BACKEND;
+         loop->backend = _event_backends[++i] ) {
+        if( loop->backend->init( loop ) ) break;
+        LOG( log_WARNING, "cannot initialize %s backend, falling back to %s",
+             loop->backend->name, _event_backends[i+1]->name );
+        loop->backend->free( loop );
+    }
+
+    if( loop->backend == FALLBACK_BACKEND && !loop->backend->init( loop ) ) {
+        LOG( log_ERROR, "cannot initialize %s backend", loop->backend->name );
+        #ifndef _WIN32
+            close( loop->wakeup[0] );
+            close( loop->wakeup[1] );
+        #endif
+        cthread_mutex_destroy( &loop->conn_mutex );
+        free( loop );
+        return NULL;
+    }
+    LOG( log_INFO, "event loop backend: %s", loop->backend->name );
+    return loop;
+}
+
+int event_loop_add_listener( void *data, int fd )
+{
+    event_loop_t *loop = (event_loop_t*)data;
+    if( !loop || loop->num_listeners >= EVENT_LOOP_MAX_LISTENERS ) return 0;
+    if( !_socket_set_nonblocking( fd, 1 ) ) return 0;
+    if( !loop->backend->add_listener( loop, fd ) ) return 0;
+    loop->listeners[loop->num_listeners++] = fd;
+    return 1;
+}
+
+int event_loop_watch( void *data, thread_arg_t *conn )
+{
+    return _event_loop_watch( (event_loop_t*)data, conn, IDLE_LIST_KEEPALIVE );
+}
+
+int event_loop_run( void *data )
+{
+    event_loop_t *loop = (event_loop_t*)data;
+    while( loop->running ) {
+        if( !loop->backend->wait( loop ) ) {
+            LOG( log_ERROR, "event loop error (%s): %s",
+                 loop->backend->name, strerror(SOCKET_ERRNO) );
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void event_loop_reply( void *data, thread_arg_t *conn, send_buffer_t *sendbuf, int keep_alive )
+{
+    event_loop_t *loop = (event_loop_t*)data;
+    if( loop->backend->reply && loop->backend->reply( loop, conn, sendbuf, keep_alive ) )
+        return;
+    send_buffer_flush_body( sendbuf );
+    /* hand a persistent connection back to the event loop, it must not
+     * be used here afterwards since another worker might pick it up */
+    if( !keep_alive || !_event_loop_watch( loop, conn, IDLE_LIST_KEEPALIVE ) )
+        event_loop_close( conn );
+}
+
+void event_loop_stop( void *data )
+{
+    event_loop_t *loop = (event_loop_t*)data;
+    if( !loop ) return;
+    loop->running = 0;
+    _event_loop_wakeup( loop );
+}
+
+void event_loop_free( void *data )
+{
+    int i;
+    thread_arg_t *conn;
+    event_loop_t *loop = (event_loop_t*)data;
+    if( !loop ) return;
+
+    /* free the backend first, it might still use the idle connections */
+    loop->backend->free( loop );
+
+    /* close all idle connections */
+    for( i = 0; i < IDLE_LISTS; ++i ) {
+        while( (conn = loop->idle[i].head) ) {
+            _idle_list_remove( loop, conn );
+            timer_wheel_remove( &loop->timers, &conn->timer );
+            _event_loop_close( conn );
+        }
+    }
+    cthread_mutex_destroy( &loop->conn_mutex );
+    #ifndef _WIN32
+        close( loop->wakeup[0] );
+        close( loop->wakeup[1] );
+    #endif
+    free( loop );
+}
@@ -0,0 +1,276 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file file_cache.c
+ * Striped hash table of file lookups. Every stripe has its own lock, hash
+ * table and least recently used list. Files are looked up and opened
+ * outside of the lock.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cthreads.h"
+#include "file_cache.h"
+#include "str_utils.h"
+
+/* number of independently locked parts of the cache */
+#define FILE_CACHE_STRIPES 16
+/* minimum number of hash table slots per stripe */
+#define FILE_CACHE_MIN_SLOTS 16
+
+typedef struct {
+    c_mutex lock;
+    file_cache_entry_t **table;
+    unsigned long table_mask;
+    file_cache_entry_t *lru_head;   /* most recently used entry */
+    file_cache_entry_t *lru_tail;   /* least recently used entry */
+    size_t entries;                 /* number of cached entries */
+    size_t fds;                     /* number of cached descriptors */
+} file_cache_stripe_t;
+
+typedef struct {
+    size_t max_entries;             /* per stripe, 0 if caching is off */
+    size_t max_fds;                 /* per stripe */
+    unsigned int ttl;               /* seconds */
+    file_cache_stripe_t stripes[FILE_CACHE_STRIPES];
+} file_cache_t;
+
+#define STRIPE_OF(cache, hash) (&(cache)->stripes[(hash) % FILE_CACHE_STRIPES])
+#define SLOT_OF(stripe, hash) (&(stripe)->table[((hash) / FILE_CACHE_STRIPES) & (stripe)->table_mask])
+
+/* look up and open a file, the new entry is referenced once */
+static file_cache_entry_t * _file_cache_load( const char *path, unsigned long hash,
+                                              time_t now, unsigned int ttl )
+{
+    const size_t len = strlen( path );
+    file_cache_entry_t *entry = (file_cache_entry_t*)calloc( 1, sizeof(file_cache_entry_t) );
+    if( !entry ) return NULL;
+    if( !(entry->path = (char*)malloc( len + 1 )) ) {
+        free( entry );
+        return NULL;
+    }
+    memcpy( entry->path, path, len + 1 );
+    entry->hash = hash;
+    entry->expires = now + ttl;
+    entry->refs = 1;
+    entry->fd = -1;
+
+    if( cfile_getstat( path, &entry->st ) == CFILE_SUCCESS ) {
+        entry->status = CFILE_SUCCESS;
+        if( entry->st.type == CFILE_TYPE_REGULAR )
+            entry->fd = cfile_open_read( path );
+    }
+    else
+        entry->status = CFILE_DOES_NOT_EXIST;
+    return entry;
+}
+
+static void _file_cache_destroy( file_cache_entry_t *entry )
+{
+    if( entry->fd != -1 ) cfile_close( entry->fd );
+    free( entry->path );
+    free( entry );
+}
+
+static file_cache_entry_t * _file_cache_find( file_cache_stripe_t *stripe,
+                                              const char *path, unsigned long hash )
+{
+    file_cache_entry_t *entry = *SLOT_OF(stripe, hash);
+    for( ; entry; entry = entry->next ) {
+        if( entry->hash == hash && strcmp( entry->path, path ) == 0 )
+            return entry;
+    }
+    return NULL;
+}
+
+static void _file_cache_lru_unlink( file_cache_stripe_t *stripe, file_cache_entry_t *entry )
+{
+    if( entry->lru_prev ) entry->lru_prev->lru_next = entry->lru_next;
+    else stripe->lru_head = entry->lru_next;
+    if( entry->lru_next ) entry->lru_next->lru_prev = entry->lru_prev;
+    else stripe->lru_tail = entry->lru_prev;
+}
+
+static void _file_cache_lru_front( file_cache_stripe_t *stripe, file_cache_entry_t *entry )
+{
+    entry->lru_prev = NULL;
+    if( (entry->lru_next = stripe->lru_head) ) entry->lru_next->lru_prev = entry;
+    else stripe->lru_tail = entry;
+    stripe->lru_head = entry;
+}
+
+/* a cached entry was used, reference it and mark it most recently used */
+static file_cache_entry_t * _file_cache_use( file_cache_stripe_t *stripe, file_cache_entry_t *entry )
+{
+    ++entry->refs;
+    if( stripe->lru_head != entry ) {
+        _file_cache_lru_unlink( stripe, entry );
+        _file_cache_lru_front( stripe, entry );
+    }
+    return entry;
+}
+
+static void _file_cache_insert( file_cache_stripe_t *stripe, file_cache_entry_t *entry )
+{
+    file_cache_entry_t **slot = SLOT_OF(stripe, entry->hash);
+    entry->next = *slot;
+    *slot = entry;
+    _file_cache_lru_front( stripe, entry );
+    entry->cached = 1;
+    ++stripe->entries;
+    if( entry->fd != -1 ) ++stripe->fds;
+}
+
+/* remove an entry from the cache, it is destroyed once it is not used anymore */
+static void _file_cache_remove( file_cache_stripe_t *stripe, file_cache_entry_t *entry )
+{
+    file_cache_entry_t **pp = SLOT_OF(stripe, entry->hash);
+    while( *pp != entry ) pp = &(*pp)->next;
+    *pp = entry->next;
+    _file_cache_lru_unlink( stripe, entry );
+    entry->cached = 0;
+    --stripe->entries;
+    if( entry->fd != -1 ) --stripe->fds;
+    if( !entry->refs ) _file_cache_destroy( entry );
+}
+
+/* drop least recently used entries to make room for a new entry */
+static void _file_cache_trim( file_cache_t *cache, file_cache_stripe_t *stripe, const int need_fd )
+{
+    file_cache_entry_t *entry = stripe->lru_tail, *prev;
+    while( entry && (stripe->entries >= cache->max_entries
+                     || (need_fd && stripe->fds >= cache->max_fds)) ) {
+        prev = entry->lru_prev;
+        if( stripe->entries >= cache->max_entries || entry->fd != -1 )
+            _file_cache_remove( stripe, entry );
+        entry = prev;
+    }
+}
+
+void * file_cache_init( unsigned int max_entries, unsigned int max_fds, unsigned int ttl_sec )
+{
+    int i;
+    file_cache_t *cache = (file_cache_t*)calloc( 1, sizeof(file_cache_t) );
+    if( !cache ) return NULL;
+
+    cache->max_entries = (max_entries + FILE_CACHE_STRIPES - 1) / FILE_CACHE_STRIPES;
+    cache->max_fds = (max_fds + FILE_CACHE_STRIPES - 1) / FILE_CACHE_STRIPES;
+    cache->ttl = ttl_sec ? ttl_sec : 1;
+
+    for( i = 0; i < FILE_CACHE_STRIPES; ++i ) {
+        file_cache_stripe_t *stripe = &cache->stripes[i];
+        unsigned long slots = FILE_CACHE_MIN_SLOTS;
+        while( slots < cache->max_entries ) slots <<= 1;
+        cthread_mutex_init( &stripe->lock );
+        stripe->table_mask = slots - 1;
+        if( cache->max_entries &&
+            !(stripe->table = (file_cache_entry_t**)calloc( slots, sizeof(file_cache_entry_t*) )) ) {
+            file_cache_free( cache );
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+file_cache_entry_t * file_cache_get( void *data, const char *path )
+{
+    file_cache_t *cache = (file_cache_t*)data;
+    const unsigned long hash = strhash( path );
+    file_cache_stripe_t *stripe = STRIPE_OF(cache, hash);
+    const time_t now = time( NULL );
+    file_cache_entry_t *entry, *loaded;
+
+    if( !cache->max_entries )
+        return _file_cache_load( path, hash, now, 0 );
+
+    cthread_mutex_lock( &stripe->lock );
+    if( (entry = _file_cache_find( stripe, path, hash )) ) {
+        if( now < entry->expires ) {
+            _file_cache_use( stripe, entry );
+            cthread_mutex_unlock( &stripe->lock );
+            return entry;
+        }
+        _file_cache_remove( stripe, entry );
+    }
+    cthread_mutex_unlock( &stripe->lock );
+
+    /* the file system is accessed without holding the lock */
+    if( !(loaded = _file_cache_load( path, hash, now, cache->ttl )) )
+        return NULL;
+
+    cthread_mutex_lock( &stripe->lock );
+    if( (entry = _file_cache_find( stripe, path, hash )) ) {
+        if( now < entry->expires ) {
+            /* another thread loaded the same file in the meantime */
+            _file_cache_use( stripe, entry );
+            cthread_mutex_unlock( &stripe->lock );
+            _file_cache_destroy( loaded );
+            return entry;
+        }
+        _file_cache_remove( stripe, entry );
+    }
+    /* without descriptor budget an open file is not cached at all */
+    if( loaded->fd == -1 || cache->max_fds ) {
+        _file_cache_trim( cache, stripe, loaded->fd != -1 );
+        _file_cache_insert( stripe, loaded );
+    }
+    cthread_mutex_unlock( &stripe->lock );
+    return loaded;
+}
+
+file_cache_entry_t * file_cache_peek( void *data, const char *path )
+{
+    file_cache_t *cache = (file_cache_t*)data;
+    const unsigned long hash = strhash( path );
+    file_cache_stripe_t *stripe = STRIPE_OF(cache, hash);
+    file_cache_entry_t *entry;
+
+    if( !cache->max_entries ) return NULL;
+
+    cthread_mutex_lock( &stripe->lock );
+    if( (entry = _file_cache_find( stripe, path, hash )) ) {
+        if( time( NULL ) < entry->expires )
+            _file_cache_use( stripe, entry );
+        else
+            entry = NULL;
+    }
+    cthread_mutex_unlock( &stripe->lock );
+    return entry;
+}
+
+void file_cache_release( void *data, file_cache_entry_t *entry )
+{
+    file_cache_t *cache = (file_cache_t*)data;
+    file_cache_stripe_t *stripe;
+    int destroy;
+    if( !entry ) return;
+
+    stripe = STRIPE_OF(cache, entry->hash);
+    cthread_mutex_lock( &stripe->lock );
+    destroy = (--entry->refs == 0 && !entry->cached);
+    cthread_mutex_unlock( &stripe->lock );
+    if( destroy ) _file_cache_destroy( entry );
+}
+
+void file_cache_free( void *data )
+{
+    int i;
+    file_cache_t *cache = (file_cache_t*)data;
+    if( !cache ) return;
+
+    for( i = 0; i < FILE_CACHE_STRIPES; ++i ) {
+        file_cache_stripe_t *stripe = &cache->stripes[i];
+        file_cache_entry_t *entry, *next;
+        for( entry = stripe->lru_head; entry; entry = next ) {
+            next = entry->lru_next;
+            _file_cache_destroy( entry );
+        }
+        free( stripe->table );
+        cthread_mutex_destroy( &stripe->lock );
+    }
+    free( cache );
+}
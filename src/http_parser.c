@@ -0,0 +1,156 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file http_parser.c
+ * Request header state machine. Lines end with CRLF or a bare LF, empty
+ * lines before the request line are skipped (RFC 7230, section 3.5).
+ */
+
+#include <string.h>
+
+#include "char_defines.h"
+#include "http_parser.h"
+
+enum _HTTP_PARSER_STATES {
+    HPS_START = 0,      /* empty lines before the request line */
+    HPS_METHOD,
+    HPS_TARGET_START,
+    HPS_TARGET,
+    HPS_VERSION,
+    HPS_LINE_LF,        /* CR at the end of the request line was seen */
+    HPS_FIELD_START,    /* beginning of a header line */
+    HPS_NAME,
+    HPS_VALUE_START,    /* whitespace in front of the value */
+    HPS_VALUE,
+    HPS_END_LF,         /* CR of the empty line was seen */
+    HPS_DONE
+};
+
+void http_parser_init( http_parser_t *parser )
+{
+    parser->state = HPS_START;
+    parser->pos = 0;
+    parser->num_fields = 0;
+    parser->method.off = parser->method.len = 0;
+    parser->target.off = parser->target.len = 0;
+    parser->version.off = parser->version.len = 0;
+}
+
+int http_parser_line_done( const http_parser_t *parser )
+{
+    return parser->state >= HPS_FIELD_START;
+}
+
+int http_parser_execute( http_parser_t *parser, const char *buf, size_t len )
+{
+    size_t pos = parser->pos;
+    int state = parser->state;
+    int ret = HTTP_PARSER_AGAIN;
+    http_field_t *field = &parser->fields[parser->num_fields];
+
+    while( pos < len && ret == HTTP_PARSER_AGAIN ) {
+        const char ch = buf[pos];
+        switch( state ) {
+        case HPS_START:
+            if( ch != ASCII_CR && ch != ASCII_LF ) {
+                parser->method.off = pos;
+                state = HPS_METHOD;
+                continue;
+            }
+            break;
+        case HPS_METHOD:
+            if( ch == ASCII_SPACE ) {
+                parser->method.len = pos - parser->method.off;
+                state = HPS_TARGET_START;
+            } else if( ch == ASCII_CR || ch == ASCII_LF || ch == ASCII_TAB )
+                ret = HTTP_PARSER_MALFORMED;
+            break;
+        case HPS_TARGET_START:
+            if( ch == ASCII_SPACE || ch == ASCII_CR || ch == ASCII_LF )
+                ret = HTTP_PARSER_MALFORMED;
+            else {
+                parser->target.off = pos;
+                state = HPS_TARGET;
+            }
+            break;
+        case HPS_TARGET:
+            /* a request line without version is a HTTP/0.9 style request */
+            if( ch == ASCII_SPACE || ch == ASCII_CR || ch == ASCII_LF ) {
+                parser->target.len = pos - parser->target.off;
+                parser->version.off = pos + 1;
+                state = (ch == ASCII_SPACE) ? HPS_VERSION : (ch == ASCII_CR) ? HPS_LINE_LF : HPS_FIELD_START;
+            }
+            break;
+        case HPS_VERSION:
+            if( ch == ASCII_CR || ch == ASCII_LF ) {
+                parser->version.len = pos - parser->version.off;
+                state = (ch == ASCII_CR) ? HPS_LINE_LF : HPS_FIELD_START;
+            }
+            break;
+        case HPS_LINE_LF:
+            if( ch != ASCII_LF ) ret = HTTP_PARSER_MALFORMED;
+            state = HPS_FIELD_START;
+            break;
+        case HPS_FIELD_START:
+            if( ch == ASCII_CR )
+                state = HPS_END_LF;
+            else if( ch == ASCII_LF )
+                state = HPS_DONE;
+            else if( ch == ASCII_SPACE || ch == ASCII_TAB || ch == ASCII_COLON )
+                /* folded lines are obsolete, empty names are invalid */
+                ret = HTTP_PARSER_MALFORMED;
+            else if( parser->num_fields == HTTP_PARSER_MAX_FIELDS )
+                ret = HTTP_PARSER_TOO_MANY_FIELDS;
+            else {
+                field->name.off = pos;
+                state = HPS_NAME;
+            }
+            break;
+        case HPS_NAME:
+            if( ch == ASCII_COLON ) {
+                field->name.len = pos - field->name.off;
+                state = HPS_VALUE_START;
+            } else if( ch == ASCII_SPACE || ch == ASCII_TAB || ch == ASCII_CR || ch == ASCII_LF )
+                /* no whitespace between name and colon (RFC 7230, section 3.2.4) */
+                ret = HTTP_PARSER_MALFORMED;
+            break;
+        case HPS_VALUE_START:
+            if( ch == ASCII_SPACE || ch == ASCII_TAB )
+                break;
+            field->value.off = parser->value_end = pos;
+            state = HPS_VALUE;
+            continue;
+        case HPS_VALUE:
+            {   /* values are the bulk of the header, find their end in one go */
+                const char *lf = (const char*)memchr( &buf[pos], ASCII_LF, len - pos );
+                const size_t end = lf ? (size_t)(lf - buf) : len;
+                size_t last = end;
+                /* only the new part can contain the end of the value */
+                while( last > pos && (buf[last-1] == ASCII_SPACE || buf[last-1] == ASCII_TAB
+                                      || buf[last-1] == ASCII_CR) )
+                    --last;
+                if( last > pos ) parser->value_end = last;
+                pos = end;
+                if( !lf ) continue;
+                field->value.len = parser->value_end - field->value.off;
+                ++parser->num_fields;
+                ++field;
+                state = HPS_FIELD_START;
+            }
+            break;
+        case HPS_END_LF:
+            if( ch != ASCII_LF ) ret = HTTP_PARSER_MALFORMED;
+            state = HPS_DONE;
+            break;
+        }
+        ++pos;
+        if( state == HPS_DONE && ret == HTTP_PARSER_AGAIN ) ret = HTTP_PARSER_DONE;
+    }
+
+    parser->pos = pos;
+    parser->state = state;
+    return ret;
+}
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "cfile.h"
 #include "http_defines.h"
 #include "http_reply.h"
 #include "http_time.h"
@@ -18,10 +19,17 @@
 #include "version.h"
 
 #ifdef _WIN32
-    #include <winsock.h>
+    #include <winsock2.h>
+    #define strcasecmp _stricmp
 #else
     #define SOCKET_ERROR -1
+    #include <errno.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
+    #ifdef __linux__
+        #include <sys/sendfile.h>
+        #define SENDFILE_SUPPORT 1
+    #endif
 #endif
 
 #ifndef __cplusplus
@@ -50,9 +58,13 @@ static const struct {
     {HTTP_STATUS_SEE_OTHER, "See Other"},
     {HTTP_STATUS_FOUND, "Found"},
     {HTTP_STATUS_INTERNAL_SERVER_ERROR, "Internal Server Error"},
+    {HTTP_STATUS_SERVICE_UNAVAILABLE, "Service Unavailable"},
     {HTTP_STATUS_METHOD_NOT_ALLOWED, "Method Not Allowed"},
     {HTTP_STATUS_NOT_MODIFIED, "Not Modified"},
     {HTTP_STATUS_NO_CONTENT, "No Content"},
+    {HTTP_STATUS_PARTIAL_CONTENT, "Partial Content"},
+    {HTTP_STATUS_RANGE_NOT_SATISFIABLE, "Requested Range Not Satisfiable"},
+    {HTTP_STATUS_HEADER_FIELDS_TOO_LARGE, "Request Header Fields Too Large"},
     {HTTP_STATUS_VERSION_NOT_SUPPORTED, "HTTP Version Not Supported"},
     {0, 0}
 };
@@ -85,41 +97,203 @@ void send_buffer_init( send_buffer_t *sendbuf, const int fd,
     sendbuf->flags = flags;
     sendbuf->bufsize = bufsize;
     sendbuf->curpos = 0;
+    memset( &sendbuf->body, 0, sizeof(send_body_t) );
+}
+
+/* a deferred body is sent before anything else is added to the send buffer */
+inline static void _send_buffer_undefer( send_buffer_t *sendbuf )
+{
+    if( sendbuf->body.len ) send_buffer_flush_body( sendbuf );
 }
 
+/* send all buffers of an io vector */
+#ifdef _WIN32
+typedef WSABUF send_iov_t;
+#define IOV_SET(v, p, l) ((v).buf = (char*)(p), (v).len = (ULONG)(l))
+
+static int _send_iov( int fd, send_iov_t *iov, int iovcnt )
+{
+    DWORD sent = 0;
+    if( WSASend( fd, iov, iovcnt, &sent, 0, NULL, NULL ) != 0 )
+        return -1;
+    return (int)sent;
+}
+#else
+typedef struct iovec send_iov_t;
+#define IOV_SET(v, p, l) ((v).iov_base = (void*)(p), (v).iov_len = (l))
+
+static int _send_iov( int fd, send_iov_t *iov, int iovcnt )
+{
+    int total = 0;
+    while( iovcnt ) {
+        ssize_t ret = writev( fd, iov, iovcnt );
+        if( ret < 0 ) {
+            if( errno == EINTR ) continue;
+            return -1;
+        }
+        total += (int)ret;
+        /* skip what was sent, continue with the rest */
+        while( iovcnt && (size_t)ret >= iov->iov_len ) {
+            ret -= (ssize_t)iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if( iovcnt ) {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= (size_t)ret;
+        }
+    }
+    return total;
+}
+#endif
+
 inline static int _send_buffer_flush_internal( send_buffer_t *sendbuf )
 {
-    const int ret = send( sendbuf->sockdesc, sendbuf->buf, (int)sendbuf->curpos, 0);
+    send_iov_t iov;
+    int ret;
+    IOV_SET(iov, sendbuf->buf, sendbuf->curpos);
+    ret = _send_iov( sendbuf->sockdesc, &iov, 1 );
     sendbuf->curpos = 0;
     return ret;
 }
 
-int send_buffer_flush( send_buffer_t *sendbuf )
+/* send the buffered data with one call, as a chunk if the buffer is configured
+ * for chunked transfer encoding (see also http://en.wikipedia.org/wiki/Chunked_transfer_encoding),
+ * last appends the last part of a chunked http message */
+static int _send_buffer_flush_chunk( send_buffer_t *sendbuf, const int last )
 {
-    /* if the buffer is configured for chunked transfer encoding... */
+    send_iov_t iov[4];
+    char size[20];   /* 16 hex digits and CRLF */
+    int n = 0, ret;
+
+    _send_buffer_undefer( sendbuf );
     if( (sendbuf->flags & SBF_CHUNKED) && sendbuf->curpos ) {
-        /* see also http://en.wikipedia.org/wiki/Chunked_transfer_encoding */
-        char buf[16];
-        int len = sprintf( buf, "%lX" ASCII_CRLF, (long unsigned int)sendbuf->curpos );
-        len = send( sendbuf->sockdesc, buf, len, 0 );
-        len += _send_buffer_flush_internal( sendbuf );
-        len += send( sendbuf->sockdesc, ASCII_CRLF, sizeof(ASCII_CRLF)-1, 0 );
-        return len;
+        const int len = sprintf( size, "%lX" ASCII_CRLF, (long unsigned int)sendbuf->curpos );
+        IOV_SET(iov[n], size, len); ++n;
+        IOV_SET(iov[n], sendbuf->buf, sendbuf->curpos); ++n;
+        IOV_SET(iov[n], ASCII_CRLF, sizeof(ASCII_CRLF)-1); ++n;
+    }
+    else if( sendbuf->curpos ) {
+        IOV_SET(iov[n], sendbuf->buf, sendbuf->curpos); ++n;
     }
-    else if( sendbuf->curpos )
-        return _send_buffer_flush_internal( sendbuf );
+    if( last ) {
+        IOV_SET(iov[n], "0" ASCII_CRLF ASCII_CRLF, 5); ++n;
+    }
+    if( !n ) return 0;
+
+    ret = _send_iov( sendbuf->sockdesc, iov, n );
+    sendbuf->curpos = 0;
+    return ret;
+}
+
+int send_buffer_flush( send_buffer_t *sendbuf )
+{
+    return _send_buffer_flush_chunk( sendbuf, 0 );
+}
+
+/* copy a part of a file through the send buffer */
+static int _send_buffer_file_copy( send_buffer_t *sendbuf, int fd, off_t offset, off_t len )
+{
+    long ret;
+    send_buffer_flush( sendbuf );
+    while( len > 0 ) {
+        const size_t chunk = ((off_t)sendbuf->bufsize < len) ? sendbuf->bufsize : (size_t)len;
+        if( (ret = cfile_pread( fd, sendbuf->buf, chunk, offset )) <= 0 )
+            return 0;
+        sendbuf->curpos = (size_t)ret;
+        if( send_buffer_flush( sendbuf ) <= 0 )
+            return 0;
+        offset += ret;
+        len -= ret;
+    }
+    return 1;
+}
+
+/* send a file after the buffered data right away */
+static int _send_buffer_file( send_buffer_t *sendbuf, int fd, off_t offset, off_t len )
+{
+#if SENDFILE_SUPPORT
+    off_t sent = 0;
+
+    if( len <= 0 || (sendbuf->flags & SBF_CHUNKED) )
+        return _send_buffer_file_copy( sendbuf, fd, offset, len );
+
+    if( sendbuf->curpos ) {
+        /* the buffered header is held back until the first bytes of the
+         * file follow, so that both go out in the same segment */
+        const int ret = send( sendbuf->sockdesc, sendbuf->buf, (int)sendbuf->curpos, MSG_MORE );
+        sendbuf->curpos = 0;
+        if( ret < 0 ) return 0;
+    }
+
+    while( sent < len ) {
+        const ssize_t ret = sendfile( sendbuf->sockdesc, fd, &offset, (size_t)(len - sent) );
+        if( ret > 0 )
+            sent += ret;
+        else if( ret < 0 && errno == EINTR )
+            continue;
+        else if( ret < 0 && !sent && (errno == EINVAL || errno == ENOSYS) )
+            /* the file can't be mapped (e.g. a pipe or a special file system) */
+            return _send_buffer_file_copy( sendbuf, fd, offset, len );
+        else
+            return 0;   /* error or the file was truncated */
+    }
+    return 1;
+#else
+    return _send_buffer_file_copy( sendbuf, fd, offset, len );
+#endif
+}
 
-    return 0;
+int send_buffer_file( send_buffer_t *sendbuf, int fd, off_t offset, off_t len )
+{
+    if( sendbuf->flags & SBF_NO_BODY ) return 1;
+    _send_buffer_undefer( sendbuf );
+    if( (sendbuf->flags & (SBF_DEFER | SBF_CHUNKED)) == SBF_DEFER && len > 0 ) {
+        /* the file is sent after the buffered header by the event loop */
+        sendbuf->body.fd = fd;
+        sendbuf->body.offset = offset;
+        sendbuf->body.len = len;
+        return 1;
+    }
+    return _send_buffer_file( sendbuf, fd, offset, len );
 }
 
 int send_buffer_flush_last( send_buffer_t *sendbuf )
 {
-    int ret = send_buffer_flush( sendbuf );
-    if( sendbuf->flags & SBF_CHUNKED ) {
-        /* if we are sending with chunked transfer encoding,
-         * send the last part of a chunked http message */
-        ret += send( sendbuf->sockdesc, "0" ASCII_CRLF ASCII_CRLF, 5, 0 );
+    /* if we are sending with chunked transfer encoding,
+     * send the last part of a chunked http message */
+    return _send_buffer_flush_chunk( sendbuf,
+                (sendbuf->flags & (SBF_CHUNKED | SBF_NO_BODY)) == SBF_CHUNKED );
+}
+
+int send_buffer_hold( send_buffer_t *sendbuf, void (*release)( void *owner, void *ref ),
+                      void *owner, void *ref )
+{
+    if( !sendbuf->body.len || sendbuf->body.release ) return 0;
+    sendbuf->body.release = release;
+    sendbuf->body.owner = owner;
+    sendbuf->body.ref = ref;
+    return 1;
+}
+
+int send_buffer_flush_body( send_buffer_t *sendbuf )
+{
+    const send_body_t body = sendbuf->body;
+    int ret;
+
+    if( !body.len ) return send_buffer_flush( sendbuf ) >= 0;
+    memset( &sendbuf->body, 0, sizeof(send_body_t) );
+    if( body.data ) {
+        send_iov_t iov[2];
+        IOV_SET(iov[0], sendbuf->buf, sendbuf->curpos);
+        IOV_SET(iov[1], body.data, body.len);
+        ret = _send_iov( sendbuf->sockdesc, iov, 2 ) >= 0;
+        sendbuf->curpos = 0;
     }
+    else
+        ret = _send_buffer_file( sendbuf, body.fd, body.offset, body.len );
+    if( body.release )
+        body.release( body.owner, body.ref );
     return ret;
 }
 
@@ -130,8 +304,8 @@ void send_buffer_simple_http_header(send_buffer_t *sendbuf, const int http_statu
     send_buffer_http_header(sendbuf, http_status, &it, version);
 }
 
-void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status,
-                             const kv_item *header_info, const int version)
+/* status line and Date header field */
+static void _send_buffer_status_line( send_buffer_t *sendbuf, const int http_status, const int version )
 {
     char buf[150];
     int len;
@@ -149,6 +323,23 @@ void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status,
     send_buffer_string_data( sendbuf, ASCII_CRLF HTTP_HEADER_DATE ": ",
                              4 + sizeof(HTTP_HEADER_DATE) - 1 );
     send_buffer_string_data( sendbuf, http_time_now( buf ), 29 );
+}
+
+void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status,
+                             const kv_item *header_info, const int version)
+{
+    const kv_item *item;
+
+    _send_buffer_status_line( sendbuf, http_status, version );
+
+    /* the connection can only be kept open if the client can tell where the reply ends */
+    if( (sendbuf->flags & SBF_KEEP_ALIVE) && !(sendbuf->flags & (SBF_CHUNKED | SBF_HEAD))
+        && http_status != HTTP_STATUS_NO_CONTENT && http_status != HTTP_STATUS_NOT_MODIFIED ) {
+        for( item = header_info; item; item = item->next ) {
+            if( item->key && strcasecmp( item->key, HTTP_HEADER_CONTENT_LENGTH ) == 0 ) break;
+        }
+        if( !item ) sendbuf->flags &= ~SBF_KEEP_ALIVE;
+    }
 
     while( header_info ) {
         if( header_info->key ) {
@@ -160,16 +351,17 @@ void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status,
         }
         header_info = header_info->next;
     }
-    if( version == HTTP_VERSION_1_1 ) {
+    if( sendbuf->flags & SBF_KEEP_ALIVE ) {
+        /* persistent connection, HTTP/1.0 clients need the explicit keep-alive */
+        send_buffer_string_data( sendbuf, ASCII_CRLF HTTP_HEADER_CONNECTION, 2 + sizeof(HTTP_HEADER_CONNECTION)-1 );
+        send_buffer_string_data( sendbuf, ": keep-alive", 12 );
+    }
+    else if( version == HTTP_VERSION_1_1 ) {
 
-        /* since we don't support persistent connections, send Connection: close header for HTTP/1.1
+        /* the connection is closed after the reply, send Connection: close header for HTTP/1.1
          * see http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html (section 14.10) */
         send_buffer_string_data( sendbuf, ASCII_CRLF HTTP_HEADER_CONNECTION, 2 + sizeof(HTTP_HEADER_CONNECTION)-1 );
         send_buffer_string_data( sendbuf, ": close", 7 );
-
-        /* -- optional: tell the browser that we don't support range requests */
-        /*send_buffer_string_data( sendbuf, ASCII_CRLF HTTP_HEADER_ACCEPT_RANGES, 2 + sizeof(HTTP_HEADER_ACCEPT_RANGES)-1 );
-          send_buffer_string_data( sendbuf, ": none", 6 ); */
     }
     if( sendbuf->flags & SBF_CHUNKED ) {
         send_buffer_string_data( sendbuf, ASCII_CRLF, 2 );
@@ -177,15 +369,62 @@ void send_buffer_http_header(send_buffer_t *sendbuf, const int http_status,
         send_buffer_string_data( sendbuf, ": chunked" ASCII_CRLF ASCII_CRLF, 13 );
         /* send the header, chunked data is following. */
         _send_buffer_flush_internal( sendbuf );
-        return;
     }
-    send_buffer_string_data( sendbuf, ASCII_CRLF ASCII_CRLF, 4 );
+    else
+        send_buffer_string_data( sendbuf, ASCII_CRLF ASCII_CRLF, 4 );
+    /* a reply to a HEAD request ends with the header */
+    if( sendbuf->flags & SBF_HEAD )
+        sendbuf->flags |= SBF_NO_BODY;
+}
+
+int send_buffer_cached_reply( send_buffer_t *sendbuf, const int http_status, const char *fields,
+                              const size_t fields_len, const void *body, const size_t body_len,
+                              const int version )
+{
+    send_iov_t iov[4];
+    const char *end;
+    size_t end_len;
+    int ret;
+
+    _send_buffer_undefer( sendbuf );
+    _send_buffer_status_line( sendbuf, http_status, version );
+    if( sendbuf->flags & SBF_KEEP_ALIVE )
+        end = ASCII_CRLF HTTP_HEADER_CONNECTION ": keep-alive" ASCII_CRLF ASCII_CRLF;
+    else if( version == HTTP_VERSION_1_1 )
+        end = ASCII_CRLF HTTP_HEADER_CONNECTION ": close" ASCII_CRLF ASCII_CRLF;
+    else
+        end = ASCII_CRLF ASCII_CRLF;
+    end_len = strlen( end );
+
+    if( (sendbuf->flags & SBF_DEFER) && fields_len + end_len <= sendbuf->bufsize - sendbuf->curpos ) {
+        /* the header is sent together with the body by the event loop */
+        memcpy( &sendbuf->buf[sendbuf->curpos], fields, fields_len );
+        memcpy( &sendbuf->buf[sendbuf->curpos + fields_len], end, end_len );
+        sendbuf->curpos += fields_len + end_len;
+        if( body_len && !(sendbuf->flags & SBF_HEAD) ) {
+            sendbuf->body.data = (const char*)body;
+            sendbuf->body.len = (off_t)body_len;
+        }
+        return (int)(sendbuf->curpos + body_len);
+    }
+
+    IOV_SET(iov[0], sendbuf->buf, sendbuf->curpos);
+    IOV_SET(iov[1], fields, fields_len);
+    IOV_SET(iov[2], end, end_len);
+    IOV_SET(iov[3], body, body_len);
+
+    ret = _send_iov( sendbuf->sockdesc, iov, (body_len && !(sendbuf->flags & SBF_HEAD)) ? 4 : 3 );
+    sendbuf->curpos = 0;
+    return ret;
 }
 
 void send_buffer_string_data(send_buffer_t *sendbuf, char * str, size_t len)
 {
-    size_t buf_avail = sendbuf->bufsize - sendbuf->curpos;
+    size_t buf_avail;
 
+    if( sendbuf->flags & SBF_NO_BODY ) return;
+    _send_buffer_undefer( sendbuf );
+    buf_avail = sendbuf->bufsize - sendbuf->curpos;
     while( len > buf_avail ) {
         memcpy(&sendbuf->buf[sendbuf->curpos], str, buf_avail);
         sendbuf->curpos += buf_avail;
@@ -207,6 +446,8 @@ void send_buffer_string(send_buffer_t *sendbuf, const char * str)
 
 void send_buffer_char(send_buffer_t *sendbuf, const char ch)
 {
+    if( sendbuf->flags & SBF_NO_BODY ) return;
+    _send_buffer_undefer( sendbuf );
     if( !(sendbuf->curpos < sendbuf->bufsize) )
         send_buffer_flush(sendbuf);
     sendbuf->buf[sendbuf->curpos] = ch;
@@ -215,6 +456,8 @@ void send_buffer_char(send_buffer_t *sendbuf, const char ch)
 
 void send_buffer_data_char(send_buffer_t *sendbuf, const char ch)
 {
+    if( sendbuf->flags & SBF_NO_BODY ) return;
+    _send_buffer_undefer( sendbuf );
     if( !(sendbuf->curpos < sendbuf->bufsize) )
         send_buffer_flush(sendbuf);
     sendbuf->buf[sendbuf->curpos] = ch;
@@ -253,11 +496,32 @@ void send_buffer_json_ascii(send_buffer_t *sendbuf, const char *str)
 void send_buffer_error_info(send_buffer_t *sendbuf, const char *filename,
                             const int status, const int http_ver )
 {
-    char numbuf[12];
+    send_buffer_error_info_header( sendbuf, filename, status, NULL, http_ver );
+}
+
+void send_buffer_error_info_header(send_buffer_t *sendbuf, const char *filename,
+                                   const int status, const kv_item *header_info, const int http_ver )
+{
+    char numbuf[12], lenbuf[24];
     const char *status_msg = get_statusmsg_from_http_status(status);
-    send_buffer_simple_http_header( sendbuf, status, HTTP_CONTENT_TYPE_HTML, http_ver);
+    const int numlen = sprintf( numbuf, "%d ", status );
+    kv_item header[2] = { {HTTP_HEADER_CONTENT_TYPE, HTTP_CONTENT_TYPE_HTML, 0},
+                          {HTTP_HEADER_CONTENT_LENGTH, lenbuf, 0} };
+
+    header[0].next = header[1].next = (kv_item*)header_info;
+
+    /* the page size is known in advance, with a Content-Length
+     * the connection can be kept open after the error page */
+    if( !(sendbuf->flags & SBF_CHUNKED) ) {
+        size_t len = 19 + 2 * (numlen + strlen(status_msg)) + 25 + 5
+                     + 30 + strlen(get_version_string()) + 24;
+        if( filename ) len += 22 + strlen(filename) + 7;
+        sprintf( lenbuf, "%lu", (unsigned long)len );
+        header[0].next = &header[1];
+    }
+    send_buffer_http_header( sendbuf, status, header, http_ver );
     send_buffer_string_data( sendbuf, "<html><head><title>", 19 );
-    send_buffer_string_data( sendbuf, numbuf, sprintf( numbuf, "%d ", status ) );
+    send_buffer_string_data( sendbuf, numbuf, numlen );
     send_buffer_string( sendbuf, status_msg );
     send_buffer_string_data( sendbuf, "</title></head><body><h1>", 25 );
     send_buffer_string( sendbuf, numbuf );
@@ -9,13 +9,17 @@
 #include "http_defines.h"
 #define HTTP_REQUEST_IMPL_
 #include "http_request.h"
+#include "event_loop.h"
 #include "str_utils.h"
 #include "kv_iter.h"
+#include "http_parser.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 
 /*int _recv_data_timed( const int fd, char *buf, const int buflen, const unsigned int timeout_sec ); */
 /*int _recv_data_timed_rrt( const int fd, char *buf, const int buflen, const unsigned int timeout_sec ); */
@@ -26,8 +30,12 @@
     #define strncasecmp _strnicmp
 #else
     #include <sys/socket.h>
+    #include <poll.h>
 #endif
 
+/* largest value of off_t */
+#define OFF_T_MAX ((off_t)(((unsigned long long)1 << (sizeof(off_t) * CHAR_BIT - 1)) - 1))
+
 #ifndef __cplusplus
     #ifdef _MSC_VER
     /* inline keyword is not available in Microsoft C Compiler */
@@ -156,7 +164,7 @@ void free_req_info(http_req_info_t * req_info)
     kvlist_free(req_info->get_vars);
     kvlist_free(req_info->post_vars);
     free_post_info( req_info->post_info );
-    kvlist_free(req_info->header_info);
+    free(req_info->header_info);
     kvlist_free(req_info->cookie_info);
     free(req_info);
 }
@@ -170,6 +178,60 @@ inline static char *url_decode_new_l( const char *str, const size_t len )
     return buf;
 }
 
+/* parse a decimal byte position, returns the end of the number or NULL */
+static const char * _parse_byte_pos( const char *str, off_t *pos )
+{
+    off_t val = 0;
+    if( !isdigit( (unsigned char)*str ) ) return NULL;
+    for( ; isdigit( (unsigned char)*str ); ++str ) {
+        const int digit = *str - '0';
+        /* values that overflow are far behind the end of any file */
+        if( val > (OFF_T_MAX - digit) / 10 ) val = OFF_T_MAX;
+        else val = val * 10 + digit;
+    }
+    *pos = val;
+    return str;
+}
+
+int http_request_parse_range( const char *value, const off_t size, http_range_t *ranges, const int max_ranges )
+{
+    int count = 0, specs = 0;
+
+    if( strncasecmp( value, "bytes=", 6 ) != 0 ) return -1;
+    value += 6;
+    for( ;; ) {
+        off_t first = 0, last = OFF_T_MAX;
+        while( *value == ASCII_SPACE || *value == ASCII_TAB ) ++value;
+        if( *value == '-' ) {
+            /* suffix range, the last n bytes */
+            off_t suffix;
+            if( !(value = _parse_byte_pos( value + 1, &suffix )) ) return -1;
+            if( suffix == 0 ) first = size;
+            else if( suffix < size ) first = size - suffix;
+        } else if( *value != ',' ) {
+            if( !(value = _parse_byte_pos( value, &first )) || *value++ != '-' ) return -1;
+            if( isdigit( (unsigned char)*value ) ) {
+                value = _parse_byte_pos( value, &last );
+                if( last < first ) return -1;
+            }
+        } else {
+            /* empty list elements are allowed */
+            ++value;
+            continue;
+        }
+        if( ++specs > max_ranges ) return -1;
+        if( first < size ) {
+            ranges[count].first = first;
+            ranges[count].last = (last < size) ? last : size - 1;
+            ++count;
+        }
+        while( *value == ASCII_SPACE || *value == ASCII_TAB ) ++value;
+        if( *value == 0 ) break;
+        if( *value++ != ',' ) return -1;
+    }
+    return specs ? count : -1;
+}
+
 const char * http_request_type_to_str( const int type )
 {
     int i;
@@ -262,9 +324,76 @@ static int _parse_url( char *str, size_t slen, http_req_info_t *reqinfo, const i
     return RRT_OKAY;
 }
 
+/* store received bytes that belong to the next request, returns 0 on error */
+static int _pending_set( thread_arg_t *args, const char *data, size_t len )
+{
+    char *pending = (char*)malloc( len + 1 );
+    if( !pending ) return 0;
+    memcpy( pending, data, len );
+    pending[len] = 0;
+    free( args->pending );
+    args->pending = pending;
+    args->pending_len = len;
+    return 1;
+}
+
+/* move up to buflen pending bytes into buf, returns the number of bytes */
+static size_t _pending_take( thread_arg_t *args, char *buf, size_t buflen )
+{
+    size_t len = args->pending_len;
+    if( len > buflen ) len = buflen;
+    memcpy( buf, args->pending, len );
+    args->pending_len -= len;
+    if( args->pending_len ) {
+        memmove( args->pending, &args->pending[len], args->pending_len + 1 );
+    } else {
+        free( args->pending );
+        args->pending = NULL;
+    }
+    return len;
+}
+
+int http_request_pending_append( thread_arg_t *args, const char *data, size_t len )
+{
+    char *pending = (char*)realloc( args->pending, args->pending_len + len + 1 );
+    if( !pending ) return 0;
+    memcpy( &pending[args->pending_len], data, len );
+    args->pending = pending;
+    args->pending_len += len;
+    pending[args->pending_len] = 0;
+    return 1;
+}
+
+int http_request_pending( const thread_arg_t *args )
+{
+    /* same rules as http_request_read(), malformed requests are read to get
+     * their error reply */
+    http_parser_t parser;
+    if( !args->pending_len ) return 0;
+    http_parser_init( &parser );
+    return http_parser_execute( &parser, args->pending, args->pending_len ) != HTTP_PARSER_AGAIN;
+}
+
+/* check if a comma separated header value contains the given token */
+static int _header_has_token( const char *value, const char *token )
+{
+    const size_t toklen = strlen( token );
+    while( *value ) {
+        while( *value == ASCII_SPACE || *value == ASCII_COMMA ) ++value;
+        if( strncasecmp( value, token, toklen ) == 0 ) {
+            const char end = value[toklen];
+            if( !end || end == ASCII_SPACE || end == ASCII_COMMA ) return 1;
+        }
+        while( *value && *value != ASCII_COMMA ) ++value;
+    }
+    return 0;
+}
+
 int _recv_data_timed( const int fd, char *buf, const int buflen, const unsigned int timeout_sec )
 {
     int ret;
+#ifdef _WIN32
+    /* windows fd_sets are socket arrays, a single socket always fits */
     struct timeval tv;
     fd_set addr_set;
 
@@ -275,22 +404,68 @@ int _recv_data_timed( const int fd, char *buf, const int buflen, const unsigned
     FD_SET( fd, &addr_set );
 
     ret = select( fd+1, &addr_set, NULL, NULL, &tv );
+#else
+    /* poll() has no FD_SETSIZE limit for the descriptor number */
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do {
+        ret = poll( &pfd, 1, (int)timeout_sec * 1000 );
+    } while( ret == -1 && errno == EINTR );
+#endif
 
     if( ret == -1 ) {
         return RECV_SELECT_ERROR;
     }
     else if( ret ) {
-        /* FD_ISSET( fd, &addr_set ) should be true */
+        /* the socket is readable, or recv reports the error */
         return recv( fd, buf, buflen, 0 );
     }
     else
         return RECV_SELECT_TIMEOUT;
 }
 
+int _recv_data_conn( thread_arg_t *args, char *buf, const int buflen )
+{
+    int ret;
+#ifdef _WIN32
+    /* shutting a socket down does not interrupt a blocking recv
+     * on windows, wait for the deadline of the connection */
+    if( args->deadline_kind != EVENT_DEADLINE_NONE ) {
+        struct timeval tv;
+        fd_set addr_set;
+        long remaining = (long)(args->deadline - (unsigned long)GetTickCount());
+        if( remaining < 0 ) remaining = 0;
+
+        tv.tv_sec = remaining / 1000;
+        tv.tv_usec = (remaining % 1000) * 1000;
+        FD_ZERO( &addr_set );
+        FD_SET( args->fd, &addr_set );
+        if( (ret = select( args->fd+1, &addr_set, NULL, NULL, &tv )) <= 0 )
+            return ret ? RECV_SELECT_ERROR : RECV_SELECT_TIMEOUT;
+    }
+    ret = recv( args->fd, buf, buflen, 0 );
+#else
+    /* the event loop enforces the deadline, no need to wait for readiness */
+    do {
+        ret = (int)recv( args->fd, buf, buflen, 0 );
+    } while( ret == -1 && errno == EINTR && !args->timed_out );
+#endif
 
-int _recv_data_timed_rrt( const int fd, char *buf, const int buflen, const unsigned int timeout_sec )
+    if( ret <= 0 && args->timed_out )
+        return RECV_SELECT_TIMEOUT;
+    if( ret > 0 && args->deadline_kind == EVENT_DEADLINE_BODY ) {
+        /* the body made progress */
+        event_loop_deadline( args, EVENT_DEADLINE_BODY );
+    }
+    return ret;
+}
+
+/* map the _recv_data_* return values to request read return types */
+static int _recv_rrt( int ret )
 {
-    int ret =_recv_data_timed( fd, buf, buflen, timeout_sec );
     switch( ret ) {
     case RECV_SELECT_TIMEOUT:
         return RRT_SOCKET_TIMEOUT;
@@ -302,6 +477,11 @@ int _recv_data_timed_rrt( const int fd, char *buf, const int buflen, const unsig
     return ret;
 }
 
+int _recv_data_timed_rrt( const int fd, char *buf, const int buflen, const unsigned int timeout_sec )
+{
+    return _recv_rrt( _recv_data_timed( fd, buf, buflen, timeout_sec ) );
+}
+
 inline static int _parse_cookie_info( kv_item** root, const char* cstr, size_t slen )
 {
     kv_item * lcurr = NULL;
@@ -337,19 +517,55 @@ inline static int _parse_cookie_info( kv_item** root, const char* cstr, size_t s
 }
 
 
+/* Copy the header fields found by the parser into one allocated block, which
+ * holds the list items followed by the zero terminated names and values */
+static int _header_fields( http_req_info_t *reqinfo, const http_parser_t *parser,
+                           const char *buf, const int flags )
+{
+    size_t size = parser->num_fields * sizeof(kv_item);
+    char *strings;
+    kv_item *items;
+    unsigned int i;
+
+    if( !parser->num_fields ) return RRT_OKAY;
+    for( i = 0; i < parser->num_fields; ++i )
+        size += parser->fields[i].name.len + parser->fields[i].value.len + 2;
+    if( !(items = (kv_item*)malloc( size )) )
+        return RRT_ALLOCATION_ERROR;
+    reqinfo->header_info = items;
+
+    strings = (char*)&items[parser->num_fields];
+    for( i = 0; i < parser->num_fields; ++i ) {
+        const http_field_t *field = &parser->fields[i];
+        items[i].key = strings;
+        memcpy( strings, &buf[field->name.off], field->name.len );
+        strings += field->name.len;
+        *strings++ = 0;
+        items[i].value = strings;
+        memcpy( strings, &buf[field->value.off], field->value.len );
+        strings += field->value.len;
+        *strings++ = 0;
+        items[i].next = (i + 1 < parser->num_fields) ? &items[i + 1] : NULL;
+
+        if( (flags & REQ_READ_FLAG_FILL_COOKIES) && strcasecmp( items[i].key, HTTP_HEADER_COOKIE ) == 0
+            && _parse_cookie_info( &reqinfo->cookie_info, items[i].value, field->value.len ) != RRT_OKAY )
+            return RRT_ALLOCATION_ERROR;
+    }
+    return RRT_OKAY;
+}
+
 http_req_info_t* http_request_read( thread_arg_t *args, const int flags, int *err, char* getbuf, size_t buflen )
 {
-    char *pbuf = NULL, *buf = NULL, *tmp = NULL;
+    char *pbuf = NULL, *buf = NULL;
 	#ifdef _WIN32
 		SSIZE_T received; 
 	#else
 		ssize_t received;
 	#endif
-	unsigned int i; int j;
+    int j;
     http_req_info_t *reqinfo;
-    kv_item * lcurr = NULL;
-    kv_item * ltemp = NULL;
-    size_t slen = 0;
+    http_parser_t parser;
+    size_t slen;
 
     if( !( reqinfo = (http_req_info_t*)malloc(sizeof(http_req_info_t)) ) ) {
         /* allocation error */
@@ -375,168 +591,112 @@ http_req_info_t* http_request_read( thread_arg_t *args, const int flags, int *er
     reqinfo->req_method = REQ_METHOD_UNKNOWN;
     if( err ) *err = RRT_OKAY;
 
-    /* selected via select() by main thread, ready to recv... */
-    received = recv( args->fd, buf, (int)buflen, 0 );
-    if( received == SOCKET_ERROR ) {
-        if( err ) *err = RRT_SOCKET_ERR;
-        goto request_read_end;
-    } else if( received == 0 ) {
-        if( err ) *err = RRT_MALFORMED_REQUEST;
-        goto request_read_end;
-    } else if( received < 4 ) {
-        /* try to receive more bytes */
-        slen = received;
-        received = _recv_data_timed_rrt( args->fd, &buf[slen], (int)(buflen-slen), REQUEST_RECV_TIMEOUT );
+    if( args->pending_len ) {
+        /* start with the bytes left over from the previous (pipelined) request */
+        received = _pending_take( args, buf, buflen );
+    }
+    else {
+        /* selected by the event loop, ready to recv... */
+        received = _recv_data_conn( args, buf, (int)buflen );
         if( received < 0 ) {
-            if( err ) *err = (int)received;
+            if( err ) *err = _recv_rrt( (int)received );
+            goto request_read_end;
+        } else if( received == 0 ) {
+            if( err ) *err = RRT_CONNECTION_CLOSED;
             goto request_read_end;
         }
-        received += slen;
     }
 
-    if( received < 4 ) {
-        if( err ) *err = RRT_MALFORMED_REQUEST;
-        goto request_read_end;
+    /* parse the header while it is received, the parser continues where it
+     * stopped, the complete header has to fit into the buffer */
+    http_parser_init( &parser );
+    while( (j = http_parser_execute( &parser, buf, (size_t)received )) == HTTP_PARSER_AGAIN ) {
+        int ret;
+        if( (size_t)received == buflen ) {
+            /* only an overlong request line is a too long uri, otherwise
+             * the header fields do not fit into the buffer */
+            if( err ) *err = http_parser_line_done( &parser ) ? RRT_TOO_MANY_HEADER_FIELDS
+                                                              : RRT_HEADER_LINE_SIZE_EXCEEDED;
+            goto request_read_end;
+        }
+        ret = _recv_data_conn( args, &buf[received], (int)(buflen-received) );
+        if( ret <= 0 ) {
+            if( err ) *err = ret ? _recv_rrt( ret ) : RRT_MALFORMED_REQUEST;
+            goto request_read_end;
+        }
+        received += ret;
     }
-
-    buf[received] = 0;
-    pbuf = buf;
-
-    /* find first space in what should sth. like "GET /index.html HTTP/1.1" */
-    if( NULL == (tmp = strchr(pbuf, ASCII_SPACE)) ) {
-        if( err ) *err = RRT_MALFORMED_REQUEST;
+    if( j != HTTP_PARSER_DONE ) {
+        if( err ) *err = (j == HTTP_PARSER_TOO_MANY_FIELDS) ? RRT_TOO_MANY_HEADER_FIELDS
+                                                            : RRT_MALFORMED_REQUEST;
         goto request_read_end;
     }
-    *tmp = 0;
+    buf[received] = 0;
 
     /* check for request type in request type array */
     for( j=0; _req_types[j].str != 0; ++j ) {
-        if( strcmp(_req_types[j].str, pbuf) == 0 ) {
+        if( strlen(_req_types[j].str) == parser.method.len
+            && memcmp(_req_types[j].str, &buf[parser.method.off], parser.method.len) == 0 ) {
             reqinfo->req_method = _req_types[j].req_method;
             break;
         }
     }
 
-    /* now proceed with the requested url/file */
-    pbuf = tmp+1;
+    /* now proceed with the requested url/file, the character behind it
+     * (space or line end) is not needed anymore */
+    pbuf = &buf[parser.target.off];
+    slen = parser.target.len;
+    pbuf[slen] = 0;
     /* ignore first slash character of uri */
-    if( pbuf[0] && pbuf[0] == ASCII_SLASH ) ++pbuf;
-
-    /* find next space or \r.. */
-    for( i=0; ; ++i ) {
-        if( pbuf[i] == ASCII_SPACE || buf[i] == ASCII_CR ) {
-            pbuf[i] = 0; break;
-        }
-        else if( !pbuf[i] ) { /* end of string before space or \r */
-            /* each line in the request has to be smaller than bufsize.. */
-            if( err ) *err = RRT_HEADER_LINE_SIZE_EXCEEDED;
-            goto request_read_end;
-        }
+    if( pbuf[0] == ASCII_SLASH ) {
+        ++pbuf;
+        --slen;
     }
 
     /* parse and decode requested url, tokenize get parameters */
-    if( (j = _parse_url( pbuf, i, reqinfo, flags )) < 0 ) {
+    if( (j = _parse_url( pbuf, slen, reqinfo, flags )) < 0 ) {
         if( err ) *err = j;
         goto request_read_end;
     }
 
     /* check if protocol version was sent, default is set to HTTP/1.0 */
-    pbuf = &pbuf[i+1];
-    if( *pbuf != ASCII_LF ) {
-        char *pch = strstr( pbuf, ASCII_CRLF );
-        if( pch == NULL ) {
-            if( err ) *err = RRT_MALFORMED_REQUEST;
-            goto request_read_end;
-        }
-        *pch = 0;
-        if( strcmp( pbuf, HTTP_VER_STRING_1_1) == 0 )
-            reqinfo->http_version = HTTP_VERSION_1_1;
-        pbuf = pch + 1;
-    }
-    ++pbuf;
+    if( parser.version.len == sizeof(HTTP_VER_STRING_1_1)-1
+        && memcmp( &buf[parser.version.off], HTTP_VER_STRING_1_1, parser.version.len ) == 0 )
+        reqinfo->http_version = HTTP_VERSION_1_1;
 
-    /* now pbuf should point to next line of http request or the trailing 0 character */
-    if( err ) *err = RRT_OKAY;
-    /* extract all other header informations into key/value pair list */
-    while( pbuf && pbuf[0] ) {
-
-        char *pch = strstr(pbuf, ASCII_CRLF);
-
-        if( pch == NULL ) {
-            /* try to read more data from socket */
-            slen = &buf[received] - pbuf;
-            /* move data to beginning of buffer, include trailing 0 (slen+1) */
-            memmove( &buf[0], pbuf, slen+1 );
-            /* try to receive until buffer is full, timeout, socket error or until no more data can be received */
-            //received = http_request_recv_b( args->fd, &buf[slen], buflen-slen, REQUEST_RECV_TIMEOUT, &closed );
-            //received = _recv_data_timed( args->fd, &buf[slen], buflen-slen, REQUEST_RECV_TIMEOUT );
-            received = _recv_data_timed_rrt( args->fd, &buf[slen], (int)(buflen-slen), REQUEST_RECV_TIMEOUT );
-            if( received < 0 ) {
-                if( err ) *err = (int)received;
-                goto request_read_end;
-            }
-            received += slen;
-            buf[received] = 0;
-
-            if( (pch = strstr( &buf[slen], ASCII_CRLF )) == NULL ) {
-                if( err ) *err = RRT_MALFORMED_REQUEST;
-                goto request_read_end;
-            }
-            pbuf = buf;
-        }
-        else if( pch == pbuf ) { /* end of header */
-            pbuf += 2;  /* pbuf should now point to beginning of data or trailing \0 of header */
-            break;
-        }
-
-        if(pch) {
-            char *pdblp;
-
-            pch[0] = 0;
-            pdblp = strchr(pbuf, ASCII_COLON);
-
-            if( pdblp ) {
-                pdblp[0] = 0;
-
-                ltemp = (kv_item*)malloc(sizeof(kv_item));
-                if(!lcurr) {
-                    reqinfo->header_info = ltemp;
-                } else {
-                    lcurr->next = ltemp;
-                }
-                lcurr = ltemp;
-                lcurr->next = NULL;
-
-                lcurr->key = (char*)malloc( strlen(pbuf)+1 );
-                strcpy(lcurr->key, pbuf);
-
-                pbuf = pdblp +1;
-                if( pbuf[0]==ASCII_SPACE ) pbuf += 1;
-
-                slen = strlen(pbuf);
-                lcurr->value = (char*)malloc( slen+1 );
-                strcpy(lcurr->value, pbuf);
-
-                if( (flags & REQ_READ_FLAG_FILL_COOKIES) && strcasecmp(lcurr->key, HTTP_HEADER_COOKIE) == 0 ) {
-                    _parse_cookie_info( &reqinfo->cookie_info, lcurr->value, slen );
-                }
+    /* copy all other header informations into the key/value pair list */
+    if( (j = _header_fields( reqinfo, &parser, buf, flags )) != RRT_OKAY ) {
+        if( err ) *err = j;
+        goto request_read_end;
+    }
 
-            }
-            else { /* No colon found */
-                if( err ) *err = RRT_MALFORMED_REQUEST;
-                return reqinfo;
-            }
-            pbuf = pch + 2;
+    /* pbuf points to the beginning of data or to the trailing 0 of the header */
+    pbuf = &buf[parser.pos];
+
+    {   /* persistent connection: default for HTTP/1.1, on request for HTTP/1.0 */
+        const char *connection = kvlist_get_value_from_key( HTTP_HEADER_CONNECTION, reqinfo->header_info );
+        if( reqinfo->http_version == HTTP_VERSION_1_1 )
+            reqinfo->keep_alive = !(connection && _header_has_token( connection, "close" ));
+        else
+            reqinfo->keep_alive = connection && _header_has_token( connection, "keep-alive" );
+
+        /* data after the header of a request without body is the
+         * beginning of the next (pipelined) request */
+        if( reqinfo->req_method != REQUEST_POST && pbuf && pbuf < &buf[received] ) {
+            if( !_pending_set( args, pbuf, &buf[received] - pbuf ) )
+                reqinfo->keep_alive = 0;
         }
     }
 
-
     if( reqinfo->req_method == REQUEST_POST ) {
         char *transfer_encoding = kvlist_get_value_from_key( HTTP_HEADER_TRANSER_ENCODING, reqinfo->header_info );
         char *content_type = kvlist_get_value_from_key( HTTP_HEADER_CONTENT_TYPE, reqinfo->header_info );
         char *content_length = kvlist_get_value_from_key( HTTP_HEADER_CONTENT_LENGTH, reqinfo->header_info );
 
 
+        /* the header is complete, the body has to make progress from now on */
+        event_loop_deadline( args, EVENT_DEADLINE_BODY );
+
         if( NULL == (reqinfo->post_info = (postdata_t*)malloc( sizeof(postdata_t) )) ) {
             if( err ) *err = RRT_ALLOCATION_ERROR;
             goto request_read_end;
@@ -629,7 +789,7 @@ http_req_info_t* http_request_read( thread_arg_t *args, const int flags, int *er
         /* if request = x www form & we want to fill out post_vars... */
         if( reqinfo->post_info->content_type == REQ_POST_CONTENT_TYPE_X_WWW_FORM && (flags & REQ_READ_FLAG_FILL_POST_VARS) ) {
             /* read url encoded post variables */
-            if( (received = http_request_read_post_vars_urlencoded( args->fd, reqinfo )) != RRT_OKAY ) {
+            if( (received = http_request_read_post_vars_urlencoded( args, reqinfo )) != RRT_OKAY ) {
                 if( err ) *err = (int)received;
                 goto request_read_end;
             }
@@ -654,11 +814,11 @@ http_req_info_t* http_request_read( thread_arg_t *args, const int flags, int *er
     return reqinfo;
 }
 
-int http_request_recv_until_timeout_or_error(const int fd, char *buf, size_t buflen )
+int http_request_recv_until_timeout_or_error( thread_arg_t *args, char *buf, size_t buflen )
 {
     int ret;
     do {
-        ret =_recv_data_timed( fd, buf, (int)buflen, 3 );
+        ret = _recv_data_conn( args, buf, (int)buflen );
     } while( ret > 0 );
 
     if( ret == RECV_SELECT_TIMEOUT ) return RRT_SOCKET_TIMEOUT;
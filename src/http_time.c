@@ -48,6 +48,18 @@ char * http_time( char *buf, const time_t time )
 	return buf;
 }
 
+/* inverse of gmtime(), mktime() would use the local time zone. The days since
+ * the epoch are calculated as in http://howardhinnant.github.io/date_algorithms.html */
+static time_t _http_timegm( const struct tm *ts )
+{
+    const long year = ts->tm_year + 1900L - (ts->tm_mon < 2);
+    const long era = (year >= 0 ? year : year - 399) / 400;
+    const long yoe = year - era * 400;
+    const long doy = (153 * (ts->tm_mon + (ts->tm_mon > 1 ? -2 : 10)) + 2) / 5 + ts->tm_mday - 1;
+    const long days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    return (time_t)days * 86400 + ts->tm_hour * 3600 + ts->tm_min * 60 + ts->tm_sec;
+}
+
 /* parses timestr for a possible http date string, and if successful
  * fill time with the correct time_t value.
  * see also http://www.w3.org/Protocols/rfc2616/rfc2616-sec3.html#sec3.3.1
@@ -83,7 +95,7 @@ int http_time_mktime( const char *timestr,  time_t *time )
 			    && mon_buf[2] == _ymonths[ts.tm_mon][2] ) break;
 		}
         if( ts.tm_mon < 12 ) { /* okay */
-			if( time ) *time = mktime( &ts );
+			if( time ) *time = _http_timegm( &ts );
 			return 0;
 		}
 	}
@@ -84,6 +84,8 @@
 #include "str_utils.h"
 #include "settings.h"
 #include "cfile.h"
+#include "file_cache.h"
+#include "event_loop.h"
 #include "log.h"
 
 #include "cresource.h"
@@ -203,7 +205,8 @@ static int lsp_echo( lua_State *L )
     if( n && !es->headers_sent )
         _lsp_send_headers( es );
 
-    {
+    /* the output of pages requested with HEAD is discarded */
+    if( !(es->args->sendbuf->flags & SBF_NO_BODY) ) {
         size_t len;
         const char* s;
         for( i=1; i<=n; ++i ) {
@@ -284,7 +287,7 @@ static int lsp_http_header( lua_State *L )
  * and with general web server settings. */
 inline
 static void _fill_environment( lua_State *L, const http_req_info_t *ri, 
-                               const thread_arg_t *args )
+                               thread_arg_t *args )
 {
     const server_settings_t *pSettings = args->pSettings;
     kv_item *iter;
@@ -293,7 +296,7 @@ static void _fill_environment( lua_State *L, const http_req_info_t *ri,
     /* server: (like the $_SERVER variable in php ) */
     lua_pushstring( L, "server");
     lua_newtable( L );
-    lua_set_tablefield_string ( L, "remote_addr", args->client_addr );
+    lua_set_tablefield_string ( L, "remote_addr", event_loop_client_addr( args ) );
     lua_set_tablefield_integer( L, "remote_port", args->client_port );
     lua_set_tablefield_integer( L, "server_port", pSettings->port );
     lua_set_tablefield_string ( L, "www_root", (pSettings->wwwroot?pSettings->wwwroot:"") );
@@ -430,7 +433,7 @@ int luasp_process( http_req_info_t *ri, thread_arg_t *args )
     /* check for resources if not disabled */
     if( !pSettings->disable_er ) {
         /* look for file name in embedded resources */
-        cresource_t *efile = get_cresource( ri->filename );
+        cresource_t *efile = webthread_get_resource( args, ri->filename );
         if( efile != NULL ) {
             lst.dp = lst.dp_cur = efile->data;
             lst.dp_end = efile->data + (efile->size);
@@ -440,9 +443,14 @@ int luasp_process( http_req_info_t *ri, thread_arg_t *args )
     /* If no embedded resource was set or found and a
      * www root directory was set, try to find and open the given file. */
     if( !lst.dp && pSettings->wwwroot ) {
-        cfile_stat_t st;
-        if( cfile_getstat( ri->filename, &st ) == CFILE_SUCCESS ) {
-            if( st.type != CFILE_TYPE_REGULAR || !(lst.fp = fopen(ri->filename, "rb")) ) {
+        /* the cached lookup answers missing pages without touching the file
+         * system, the page itself is read through its own stream */
+        file_cache_entry_t *file = file_cache_get( args->pDataFileCache, ri->filename );
+        const int status = file ? file->status : CFILE_DOES_NOT_EXIST;
+        const int regular = file && file->st.type == CFILE_TYPE_REGULAR && file->fd != -1;
+        file_cache_release( args->pDataFileCache, file );
+        if( status == CFILE_SUCCESS ) {
+            if( !regular || !(lst.fp = fopen(ri->filename, "rb")) ) {
                 /* not a regular file or error opening file */
                 send_buffer_error_info( args->sendbuf, ri->filename, 
                                         HTTP_STATUS_FORBIDDEN, ri->http_version );
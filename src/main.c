@@ -27,6 +27,7 @@
     #include <arpa/inet.h>
     #include <netdb.h>
     #include <unistd.h>
+    #include <sys/resource.h>
 
     #define closesocket(s) close(s);
     #define APP_BASENAME basename(argv[0])
@@ -45,10 +46,17 @@
 
 #include "ip_socket_utils.h"
 #include "webthread.h"
+#include "event_loop.h"
 #include "cmdline.h"
 #include "settings.h"
 #include "server_commands.h"
 #include "websession.h"
+#include "file_cache.h"
+#include "content_cache.h"
+#include "cresource_bundle.h"
+#if DEFLATE_SUPPORT
+    #include "block_deflate.h"
+#endif
 #if LUA_SUPPORT
     #include "luasp.h"
 #endif
@@ -59,11 +67,21 @@ SETLOGMODULENAME("main");
 #define THREAD_STACK_SIZE 512000
 #define DEFAULT_CONFIG_FILE "cranberry-server.ini"
 
+/* A listener shard, with its own listen sockets, event loop and web thread
+ * workers. Without SO_REUSEPORT sharding there is a single shard. */
+typedef struct {
+    thread_arg_t args;          /* base arguments for the shard's connections */
+    int listenfd4;              /* Listen file descriptor for ipv4 */
+    int listenfd6;              /* Listen file descriptor for ipv6 */
+    c_thread thread;            /* event loop thread, shard 0 runs in the main thread */
+    int thread_running;
+    int cpu;                    /* cpu the shard is pinned to, -1 if none */
+} server_shard_t;
+
 /* Local globals */
 static int main_exit_code = EXIT_SUCCESS; /* Return value of main program */
-static int main_loop      =  1;           /* The main loop loops while main_loop is 1*/
-static int listenfd4      = -1;           /* Listen file descriptor for ipv4 */
-static int listenfd6      = -1;           /* Listen file descriptor for ipv6 */
+static server_shard_t *main_shards = NULL;/* Listener shards, own all client connections */
+static unsigned int main_num_shards = 0;  /* Number of listener shards */
 static int exit_sig_caught=  0;           /* Set to 1 if a signal was caught */
 
 static void server_deinitialize( thread_arg_t *args );
@@ -71,13 +89,67 @@ static void server_deinitialize( thread_arg_t *args );
 /* exit signal handler */
 void exit_signal_handler( int sig )
 {
+    unsigned int i;
     printf("\n--\nSignal %d caught...\n", sig);
-    main_loop = 0;
     exit_sig_caught = 1;
-    if( listenfd4 != -1 )
-        closesocket(listenfd4);
-    if( listenfd6 != -1 )
-        closesocket(listenfd6);
+    for( i = 0; i < main_num_shards; ++i ) {
+        if( main_shards[i].args.pDataEventLoop )
+            event_loop_stop( main_shards[i].args.pDataEventLoop );
+    }
+}
+
+/* Create, bind and listen on a server socket, a backlog of 0 is the
+ * system maximum. Returns -1 on error. */
+static int server_listen( const int family, const struct sockaddr *addr,
+                          const int addrlen, const int reuseport, const int backlog )
+{
+    int vTrue = 1;
+    int fd = (int)socket( family, SOCK_STREAM, 0 );
+    const char *ipver = (family == AF_INET6) ? "IPv6" : "IPv4";
+
+    if( fd < 0 ) {
+        LOG( log_ERROR, "socket creation error (%s)", ipver );
+        return -1;
+    }
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, (char*)&vTrue, sizeof(int) );
+    #ifdef SO_REUSEPORT
+    if( reuseport && setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, (char*)&vTrue, sizeof(int) ) < 0 ) {
+        LOG( log_ERROR, "SO_REUSEPORT error (%s): %s", ipver, strerror(errno) );
+        closesocket( fd );
+        return -1;
+    }
+    #endif
+
+    if( bind( fd, addr, addrlen ) < 0 ) {
+        /* binding IPv4 fails if the IPv6 socket also accepts IPv4 connections */
+        LOG( (family == AF_INET6) ? log_ERROR : log_DEBUG, "bind error (%s): %s", ipver, strerror(errno) );
+        closesocket( fd );
+        return -1;
+    }
+    if( listen( fd, backlog ? backlog : SOMAXCONN ) < 0 ) {
+        LOG( log_ERROR, "listen error (%s): %s", ipver, strerror(errno) );
+        closesocket( fd );
+        return -1;
+    }
+    return fd;
+}
+
+/* Event loop thread of a listener shard */
+static CTHREAD_RETURN server_shard_thread( CTHREAD_ARG arg )
+{
+    server_shard_t *shard = (server_shard_t*)arg;
+
+    #ifndef _WIN32
+    {   /* signals are handled by the main thread */
+        sigset_t set;
+        sigfillset( &set );
+        pthread_sigmask( SIG_BLOCK, &set, NULL );
+    }
+    #endif
+
+    if( !event_loop_run( shard->args.pDataEventLoop ) && !exit_sig_caught )
+        LOG( log_ERROR, "event loop error (shard cpu %d)", shard->args.cpu );
+    return (CTHREAD_RETURN) 0;
 }
 
 /* Web server main */
@@ -85,25 +157,16 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
 {
     int IPv4 = 0;
     int IPv6 = 0;
-    int highfd;
 
-    size_t hit = 0;             /* counter for number of hits */
     char *config_file = NULL;   /* ini config file to load */
 
-    fd_set addr_set;
-
-    thread_arg_t *arguments, baseargs = {0};
+    thread_arg_t baseargs = {0};
     server_settings_t* pSettings = NULL;
 
     /* static = initialized to zeros */
-    static struct sockaddr_in cli_addr4 =   {0};
-    static struct sockaddr_in6 cli_addr6 =  {0};
     static struct sockaddr_in serv_addr4 =  {0};
     static struct sockaddr_in6 serv_addr6 = {0};
 
-    socklen_t length;
-    c_thread mythread;      /* Posix/Windows thread */
-
     #ifdef _WIN32
         /* Initialization of sockets for MS Windows. */
         WSADATA wsa_data;
@@ -153,6 +216,17 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
 
     /* TODO i18n for webserver, for web interface we can use a lua based solution */
 
+    /* map the resource bundle before a relative path would refer to the www root */
+    if( pSettings->resource_bundle ) {
+        if( !(baseargs.pDataResourceBundle = cresource_bundle_open( pSettings->resource_bundle )) ) {
+            LOG( log_ERROR, "Cannot open resource bundle (%s), exiting...", pSettings->resource_bundle );
+            main_exit_code = EXIT_FAILURE;
+            goto label_exit;
+        }
+        LOG( log_INFO, "resource bundle %s with %lu resources", pSettings->resource_bundle,
+             cresource_bundle_count( (cresource_bundle_t*)baseargs.pDataResourceBundle ) );
+    }
+
     /* try to change directory to servers wwwroot, if set... */
     if( pSettings->wwwroot && chdir(pSettings->wwwroot) == -1 ) {
         LOG( log_ERROR, "Cannot change to www root directory (%s), exiting...", pSettings->wwwroot);
@@ -191,6 +265,17 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
         goto label_exit;
     }
 
+    #ifndef _WIN32
+    {   /* every client connection needs a descriptor, raise the soft limit */
+        struct rlimit rl;
+        if( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max ) {
+            rl.rlim_cur = rl.rlim_max;
+            if( setrlimit( RLIMIT_NOFILE, &rl ) != 0 )
+                LOG( log_INFO, "cannot raise open file limit: %s", strerror(errno) );
+        }
+    }
+    #endif
+
     /* Get address informations */
     if( !server_getaddrinfo( &baseargs, &IPv4, &serv_addr4, &IPv6, &serv_addr6 ) ) {
         LOG( log_ERROR, "getaddrinfo error: no addrinfo found.");
@@ -198,54 +283,83 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
         goto label_exit;
     }
 
-    /* Setup the network socket(s) */
-    /* IPv6 */
-    if( IPv6 ) {
-        if( (listenfd6 = (int)socket(AF_INET6, SOCK_STREAM, 0)) < 0 ) {
-            LOG( log_ERROR, "socket creation error (IPv6)");
-            IPv6 = 0;
-        } else {
-            int vTrue = 1;
-            setsockopt( listenfd6, SOL_SOCKET, SO_REUSEADDR, (char*)&vTrue, sizeof(int) );
-        }
-    }
-    /* IPv4 */
-    if( IPv4 ) {
-        if( (listenfd4 = (int)socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
-            LOG( log_ERROR, "socket creation error (IPv4)");
-            IPv4 = 0;
-        } else {
-            int vTrue = 1;
-            setsockopt( listenfd4, SOL_SOCKET, SO_REUSEADDR, (char*)&vTrue, sizeof(int) );
+    /* Set up the listener shards */
+    {
+        int reuseport = 0;
+        unsigned int i, num_shards = 1;
+        if( pSettings->listen_shards ) {
+            #ifdef SO_REUSEPORT
+                reuseport = 1;
+                num_shards = (pSettings->listen_shards < 0) ? cthread_cpu_count()
+                                                            : (unsigned int)pSettings->listen_shards;
+            #else
+                LOG( log_WARNING, "SO_REUSEPORT is not supported, using a single listener" );
+            #endif
         }
-    }
+        /* store the effective number of shards, the web thread module uses it */
+        pSettings->listen_shards = reuseport ? (int)num_shards : 0;
 
-    /* Bind the listeners */
-    if( IPv6 && bind(listenfd6, (struct sockaddr *)&serv_addr6,sizeof(struct sockaddr_in6)) < 0 ) {
-        LOG( log_ERROR, "bind error (IPv6): %s", strerror(errno) );
-        IPv6 = 0;
-    }
-    if( IPv4 && bind(listenfd4, (struct sockaddr *)&serv_addr4,sizeof(serv_addr4)) < 0 ) {
-        if( !IPv6 )
-            LOG( log_ERROR, "bind error (IPv4): %s", strerror(errno) );
-        IPv4 = 0;
+        if( !(main_shards = (server_shard_t*)calloc( num_shards, sizeof(server_shard_t) )) ) {
+            LOG( log_ERROR, "Memory allocation error." );
+            main_exit_code = EXIT_FAILURE;
+            goto label_exit;
+        }
+        for( i = 0; i < num_shards; ++i ) {
+            server_shard_t *shard = &main_shards[i];
+            shard->listenfd4 = shard->listenfd6 = -1;
+            shard->cpu = -1;
+            ++main_num_shards;
+
+            if( IPv6 ) shard->listenfd6 = server_listen( AF_INET6, (struct sockaddr *)&serv_addr6,
+                                                         sizeof(serv_addr6), reuseport,
+                                                         pSettings->listen_backlog );
+            if( IPv4 ) shard->listenfd4 = server_listen( AF_INET, (struct sockaddr *)&serv_addr4,
+                                                         sizeof(serv_addr4), reuseport,
+                                                         pSettings->listen_backlog );
+            if( shard->listenfd4 == -1 && shard->listenfd6 == -1 ) {
+                LOG_FILE( log_ERROR, "socket error: could not set up IPv4 or IPv6 socket." );
+                main_exit_code = EXIT_FAILURE;
+                goto label_exit;
+            }
+        }
+        if( reuseport ) {
+            /* shard i is pinned to the i-th cpu the server may run on */
+            unsigned int num_cpus = cthread_cpu_count();
+            unsigned int *cpus = (unsigned int*)malloc( num_cpus * sizeof(unsigned int) );
+            num_cpus = cpus ? cthread_cpu_list( cpus, num_cpus ) : 0;
+            for( i = 0; i < num_shards && num_cpus; ++i )
+                main_shards[i].cpu = (int)cpus[i % num_cpus];
+            free( cpus );
+        }
     }
 
-    if( IPv6 && listen(listenfd6,64) < 0 ) IPv6 = 0;
-    if( IPv4 && listen(listenfd4,64) < 0 ) IPv4 = 0;
-
-    if( !IPv4 && !IPv6 ) {
-        LOG_FILE( log_ERROR, "socket error: could not set up IPv4 or IPv6 socket." );
-        main_exit_code = EXIT_FAILURE;
-        goto label_exit;
-    }
+    #ifndef _WIN32
+        /* set thread stack size - on some systems
+         * (e.g. AIX) the default posix thread stack size is very very small */
+        cthread_attr_setstacksize( THREAD_STACK_SIZE );
+    #endif
 
     /* Initialize server modules */
     LOG( log_INFO, "initializing server modules...");
 
+    baseargs.cpu = -1;
     if( !( (baseargs.pDataSrvCmds = server_commands_init())
-        && (baseargs.pDataSrvThreads = webthread_init())
-        && (baseargs.pDataSrvSessions = websession_init( &baseargs )) ))
+        && (baseargs.pDataSrvSessions = websession_init( &baseargs ))
+        && (baseargs.pDataFileCache = file_cache_init( pSettings->file_cache_entries,
+                                                       pSettings->file_cache_fds,
+                                                       pSettings->file_cache_ttl ))
+        && (baseargs.pDataContentCache = content_cache_init(
+                (size_t)pSettings->content_cache_limit_mb * 1024 * 1024,
+                (size_t)pSettings->content_cache_file_limit_kb * 1024 ))
+        #if DEFLATE_SUPPORT
+        && (baseargs.pDataDeflateCache = content_cache_init(
+                pSettings->deflate ? (size_t)pSettings->deflate_cache_limit_mb * 1024 * 1024 : 0,
+                (size_t)pSettings->deflate_cache_file_limit_kb * 1024 ))
+        && (baseargs.pDataBlockDeflate = block_deflate_init(
+                pSettings->deflate ? pSettings->deflate_threads : 0, pSettings->deflate,
+                (size_t)pSettings->deflate_block_kb * 1024 ))
+        #endif
+        ))
     {
         LOG( log_ERROR, "Initialization error." );
         main_exit_code = EXIT_FAILURE;
@@ -261,92 +375,53 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
     }
     #endif
 
-    #ifndef _WIN32
-        /* set thread stack size - on some systems
-         * (e.g. AIX) the default posix thread stack size is very very small */
-        cthread_attr_setstacksize( THREAD_STACK_SIZE );
-    #endif
-
-    LOG( log_INFO, "Entering main loop" );
-
-    /* Server main loop */
-    while( main_loop ) {
-
-        FD_ZERO( &addr_set );
-        highfd = -1;
-        if( IPv6 ) {
-            FD_SET( listenfd6, &addr_set );
-            if( listenfd6 > highfd ) highfd = listenfd6;
-        }
-        if( IPv4 ) {
-            FD_SET( listenfd4, &addr_set );
-            if( listenfd4 > highfd ) highfd = listenfd4;
-        }
-
-        /* wait for an incoming connection */
-        if( (select(highfd + 1, &addr_set, NULL, NULL, NULL) < 0 ) ) {
-            if( exit_sig_caught ) {
-                if( FD_ISSET( listenfd4, &addr_set ) ) closesocket( listenfd4 );
-                if( FD_ISSET( listenfd6, &addr_set ) ) closesocket( listenfd6 );
-                break;
+    {   /* Every shard gets its own web thread workers and event loop, both are
+         * created last, every accepted connection gets a copy of the fully
+         * initialized shard arguments. */
+        unsigned int i;
+        for( i = 0; i < main_num_shards; ++i ) {
+            server_shard_t *shard = &main_shards[i];
+            memcpy( &shard->args, &baseargs, sizeof(thread_arg_t) );
+            shard->args.cpu = shard->cpu;
+
+            if( !(shard->args.pDataSrvThreads = webthread_init( &shard->args )) ) {
+                LOG( log_ERROR, "Initialization error." );
+                main_exit_code = EXIT_FAILURE;
+                goto label_exit;
             }
-            LOG( log_ERROR, "socket error: select" );
-            main_exit_code = EXIT_FAILURE;
-            goto label_exit;
-        }
-
-        ++hit;
-
-        /* allocate memory for webserver thread arguments */
-        arguments = (thread_arg_t*)malloc( sizeof(thread_arg_t) );
-        /* copy baseargs (contains pointers to settings and module data) */
-        memcpy( arguments, &baseargs, sizeof(thread_arg_t) );
-
-        if( IPv6 && FD_ISSET( listenfd6, &addr_set ) ) {
-            length = sizeof(cli_addr6);
-            arguments->fd = (int)accept( listenfd6, (struct sockaddr *)&(cli_addr6), &length );
-        }
-        else if( IPv4 && FD_ISSET( listenfd4, &addr_set ) ) {
-            length = sizeof(cli_addr4);
-            arguments->fd = (int)accept( listenfd4, (struct sockaddr *)&(cli_addr4), &length );
-        }
-
-        if( arguments->fd < 0 ) {
-            free( arguments );
-
-            if( !exit_sig_caught ) {
-                LOG( log_ERROR, "accept error (hit %lu)", hit );
-                continue;
+            if( !(shard->args.pDataEventLoop = event_loop_init( &shard->args ))
+                || (shard->listenfd6 != -1 && !event_loop_add_listener( shard->args.pDataEventLoop, shard->listenfd6 ))
+                || (shard->listenfd4 != -1 && !event_loop_add_listener( shard->args.pDataEventLoop, shard->listenfd4 )) )
+            {
+                LOG( log_ERROR, "event loop initialization error." );
+                main_exit_code = EXIT_FAILURE;
+                goto label_exit;
+            }
+            if( i > 0 ) {
+                if( !cthread_create( &shard->thread, server_shard_thread, shard ) ) {
+                    LOG( log_ERROR, "listener shard thread creation error (%u)", i );
+                    main_exit_code = EXIT_FAILURE;
+                    goto label_exit;
+                }
+                shard->thread_running = 1;
+            }
+            if( shard->args.cpu >= 0 ) {
+                c_thread thread = i ? shard->thread : cthread_self();
+                if( !cthread_set_affinity( &thread, shard->args.cpu ) )
+                    LOG( log_WARNING, "could not pin listener shard to cpu %d", shard->args.cpu );
             }
-
-            if( FD_ISSET( listenfd4, &addr_set ) ) closesocket( listenfd4 );
-            if( FD_ISSET( listenfd6, &addr_set ) ) closesocket( listenfd6 );
-            break;
-        }
-        if( IPv6 && FD_ISSET( listenfd6, &addr_set ) ) {
-            arguments->client_addr = malloc(INET6_ADDRSTRLEN); arguments->client_addr[0] = 0;
-            inet_ntop( AF_INET6, &(cli_addr6.sin6_addr), arguments->client_addr, INET6_ADDRSTRLEN, &cli_addr6);
-            arguments->client_port = cli_addr6.sin6_port;
-        }
-        else if( IPv4 && FD_ISSET( listenfd4, &addr_set ) ) {
-            arguments->client_addr = malloc(INET_ADDRSTRLEN); arguments->client_addr[0] = 0;
-            inet_ntop( AF_INET, &(cli_addr4.sin_addr), arguments->client_addr, INET_ADDRSTRLEN, &cli_addr4);
-            arguments->client_port = cli_addr4.sin_port;
-        }
-        arguments->hit = hit;
-
-        /* create webthread to handle the incoming request. */
-        if( !cthread_create( &mythread, webthread, arguments ) ) {
-            LOG( log_ERROR, "thread creation error (hit %lu)", hit );
-            if( FD_ISSET( listenfd4, &addr_set ) ) closesocket( listenfd4 );
-            if( FD_ISSET( listenfd6, &addr_set ) ) closesocket( listenfd6 );
-            free( arguments );
         }
-        else
-            cthread_detach( &mythread );
+        if( pSettings->listen_shards )
+            LOG( log_INFO, "started %u SO_REUSEPORT listener shards", main_num_shards );
+    }
 
-    } /* while(main_loop) */
+    LOG( log_INFO, "Entering main loop" );
 
+    /* Server main loop (shard 0), returns after a signal was caught */
+    if( !event_loop_run( main_shards[0].args.pDataEventLoop ) && !exit_sig_caught ) {
+        LOG( log_ERROR, "event loop error" );
+        main_exit_code = EXIT_FAILURE;
+    }
 
     /* exit label */
     label_exit:
@@ -365,11 +440,39 @@ MAIN_RETURN_TYPE server_main(ARGC_TYPE argc, ARGV_TYPE argv)
 
 static void server_deinitialize( thread_arg_t *args )
 {
+    unsigned int i;
     if( args == NULL ) return;
 
-    webthread_free( args->pDataSrvThreads );
+    /* stop the other listener shards */
+    for( i = 0; i < main_num_shards; ++i ) {
+        if( main_shards[i].args.pDataEventLoop )
+            event_loop_stop( main_shards[i].args.pDataEventLoop );
+        if( main_shards[i].thread_running )
+            cthread_join( &main_shards[i].thread );
+    }
+    /* stop the workers first, they might still use the other modules */
+    for( i = 0; i < main_num_shards; ++i )
+        webthread_free( main_shards[i].args.pDataSrvThreads );
+    for( i = 0; i < main_num_shards; ++i ) {
+        server_shard_t *shard = &main_shards[i];
+        if( shard->listenfd4 != -1 ) { closesocket( shard->listenfd4 ); }
+        if( shard->listenfd6 != -1 ) { closesocket( shard->listenfd6 ); }
+        event_loop_free( shard->args.pDataEventLoop );
+        shard->args.pDataEventLoop = NULL;
+    }
+    main_num_shards = 0;
+    free( main_shards );
+    main_shards = NULL;
+
     server_commands_free( args->pDataSrvCmds );
     websession_free( args->pDataSrvSessions );
+    file_cache_free( args->pDataFileCache );
+    content_cache_free( args->pDataContentCache );
+    content_cache_free( args->pDataDeflateCache );
+    #if DEFLATE_SUPPORT
+        block_deflate_free( args->pDataBlockDeflate );
+    #endif
+    cresource_bundle_close( (cresource_bundle_t*)args->pDataResourceBundle );
     settings_free( (server_settings_t*)args->pSettings );
     #if LUA_SUPPORT
         luasp_free( args->pDataLuaScripting );
@@ -33,9 +33,9 @@ int http_request_read_multipart_vars( thread_arg_t* args, http_req_info_t* req_i
 
     /* read */
     if( !endOfData && pbuf && pbuf[0] == 0 ) {
-        int ret = _recv_data_timed_rrt( args->fd, &post_info->buf[0], post_info->buflen - 1, REQUEST_RECV_TIMEOUT );
+        int ret = _recv_data_conn( args, &post_info->buf[0], post_info->buflen - 1 );
         if( ret < 0 )
-            return ret;
+            return (ret == RECV_SELECT_TIMEOUT) ? RRT_SOCKET_TIMEOUT : RRT_SOCKET_ERR;
         else if( ret == 0 )
             return RRT_OKAY;
 
@@ -15,13 +15,13 @@
 
 #define POSTBUF_INCREMENTS MIN_POST_FORM_BUF_SIZE
 
-int http_request_recv_post_and_throw_away(const int fd, http_req_info_t* req_info, 
+int http_request_recv_post_and_throw_away( thread_arg_t *args, http_req_info_t* req_info,
                                           char* buf, size_t buflen )
 {
     if( req_info->post_info ) {
         int ret;
         while( req_info->post_info->bytes_read < req_info->post_info->content_length ) {
-            ret = _recv_data_timed( fd, buf, (int)buflen, REQUEST_RECV_TIMEOUT );
+            ret = _recv_data_conn( args, buf, (int)buflen );
             if(ret > 0 ) req_info->post_info->bytes_read += ret;
             else return ret;
         }
@@ -29,7 +29,7 @@ int http_request_recv_post_and_throw_away(const int fd, http_req_info_t* req_inf
     return 1;
 }
 
-int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t *req_info )
+int http_request_read_post_vars_urlencoded( thread_arg_t *args, http_req_info_t *req_info )
 {
     postdata_t *post_info = req_info->post_info;
     char *pch, *pbuf, *psearch, *rbuf;
@@ -40,8 +40,8 @@ int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t *req_i
     pbuf = post_info->buf;
     
     if( !EoD && pbuf && pbuf[0] == 0 ) {
-        ret = _recv_data_timed_rrt( fd, &post_info->buf[0], post_info->buflen-1, REQUEST_RECV_TIMEOUT );
-        if( ret < 0 ) return ret;
+        ret = _recv_data_conn( args, &post_info->buf[0], post_info->buflen-1 );
+        if( ret < 0 ) return (ret == RECV_SELECT_TIMEOUT) ? RRT_SOCKET_TIMEOUT : RRT_SOCKET_ERR;
         else if( ret == 0 ) return RRT_OKAY;
         
         post_info->buf[ret] = 0;
@@ -74,7 +74,7 @@ int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t *req_i
             }
 
             psearch = &post_info->buf[post_info->bufbytes];
-            ret = _recv_data_timed( fd, psearch, post_info->buflen - 1 - post_info->bufbytes, REQUEST_RECV_TIMEOUT );
+            ret = _recv_data_conn( args, psearch, post_info->buflen - 1 - post_info->bufbytes );
             if( ret < 0 ) {
                 if( ret == RECV_SELECT_TIMEOUT ) return RRT_SOCKET_TIMEOUT;
                 return RRT_SOCKET_ERR;
@@ -136,7 +136,7 @@ int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t *req_i
             }
 
             psearch = &post_info->buf[post_info->bufbytes];
-            ret = _recv_data_timed( fd, psearch, post_info->buflen - 1 - post_info->bufbytes, REQUEST_RECV_TIMEOUT );
+            ret = _recv_data_conn( args, psearch, post_info->buflen - 1 - post_info->bufbytes );
             if( ret < 0 ) {
                 if( ret == RECV_SELECT_TIMEOUT ) return RRT_SOCKET_TIMEOUT;
                 return RRT_SOCKET_ERR;
@@ -172,7 +172,7 @@ int http_request_read_post_vars_urlencoded( const int fd, http_req_info_t *req_i
 
     if( !EoD ) { /* read rest of data */
         while( post_info->bytes_read < post_info->content_length ) {
-            ret = _recv_data_timed( fd, post_info->buf, post_info->buflen, REQUEST_RECV_TIMEOUT );
+            ret = _recv_data_conn( args, post_info->buf, post_info->buflen );
             if(ret >=0 ) post_info->bytes_read += ret;
             else if( ret == RECV_SELECT_TIMEOUT ) return RRT_SOCKET_TIMEOUT;
             else return RRT_SOCKET_ERR;
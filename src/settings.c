@@ -23,6 +23,30 @@
 #define WEBSRV_PORT_DEFAULT 8181
 #define LUASP_SESSION_TIMEOUT_DEFAULT 1800
 #define SERVERLOG_DEFAULT "cranberry-server.log"
+#define WORKERS_DEFAULT 8
+#define WORKERS_MAX 1024
+#define QUEUE_SIZE_DEFAULT 256
+#define QUEUE_SIZE_MAX 65536
+#define IO_WORKERS_DEFAULT 8
+#define IO_QUEUE_SIZE_DEFAULT 256
+#define KEEPALIVE_TIMEOUT_DEFAULT 5
+#define REQUEST_HEADER_TIMEOUT_DEFAULT 10
+#define REQUEST_BODY_TIMEOUT_DEFAULT 10
+#define KEEPALIVE_MAX_REQUESTS_DEFAULT 100
+#define LISTEN_SHARDS_MAX 256
+#define RETRY_AFTER_DEFAULT 1
+#define SCRIPT_WORKERS_DEFAULT 4
+#define FILE_CACHE_ENTRIES_DEFAULT 1024
+#define FILE_CACHE_FDS_DEFAULT 256
+#define FILE_CACHE_TTL_DEFAULT 2
+#define CONTENT_CACHE_LIMIT_MB_DEFAULT 16
+#define CONTENT_CACHE_FILE_LIMIT_KB_DEFAULT 64
+#define DEFLATE_CACHE_LIMIT_MB_DEFAULT 16
+#define DEFLATE_CACHE_FILE_LIMIT_KB_DEFAULT 1024
+#define DEFLATE_THREADS_DEFAULT 4
+#define DEFLATE_BLOCK_KB_DEFAULT 128
+#define DEFLATE_BLOCK_KB_MIN 32
+#define SCRIPT_QUEUE_SIZE_DEFAULT 64
 
 #define INI_SECTION_SERVER          "server"
 #define INI_SECTION_SCRIPTING       "scripting"
@@ -57,6 +81,7 @@ server_settings_t * settings_init( void ) {
 void settings_free(server_settings_t *pSettings ) {
     if( NULL == pSettings ) return;
     free( pSettings->wwwroot );
+    free( pSettings->resource_bundle );
     free( pSettings->logfile );
     free( pSettings );
 }
@@ -86,6 +111,27 @@ static void _settings_setdefault( server_settings_t *pSettings, int OverwriteExi
         pSettings->loglevel_console = log_ERROR;
 
     pSettings->ipv6 = 1;
+    pSettings->workers = WORKERS_DEFAULT;
+    pSettings->queue_size = QUEUE_SIZE_DEFAULT;
+    pSettings->io_workers = IO_WORKERS_DEFAULT;
+    pSettings->io_queue_size = IO_QUEUE_SIZE_DEFAULT;
+    pSettings->keepalive_timeout = KEEPALIVE_TIMEOUT_DEFAULT;
+    pSettings->keepalive_max_requests = KEEPALIVE_MAX_REQUESTS_DEFAULT;
+    pSettings->request_header_timeout = REQUEST_HEADER_TIMEOUT_DEFAULT;
+    pSettings->request_body_timeout = REQUEST_BODY_TIMEOUT_DEFAULT;
+    pSettings->io_engine = IO_ENGINE_IO_URING;
+    pSettings->listen_shards = 0;
+    pSettings->listen_backlog = 0;
+    pSettings->max_static_requests = 0;
+    pSettings->max_embedded_requests = 0;
+    pSettings->max_lua_requests = 0;
+    pSettings->retry_after = RETRY_AFTER_DEFAULT;
+    pSettings->file_cache_entries = FILE_CACHE_ENTRIES_DEFAULT;
+    pSettings->file_cache_fds = FILE_CACHE_FDS_DEFAULT;
+    pSettings->file_cache_ttl = FILE_CACHE_TTL_DEFAULT;
+    pSettings->content_cache_limit_mb = CONTENT_CACHE_LIMIT_MB_DEFAULT;
+    pSettings->content_cache_file_limit_kb = CONTENT_CACHE_FILE_LIMIT_KB_DEFAULT;
+    pSettings->precompressed = 1;
 
     if( OverwriteExisting || pSettings->port == WEBSRV_PORT_NOT_SET )
         pSettings->port = WEBSRV_PORT_DEFAULT;
@@ -95,12 +141,18 @@ static void _settings_setdefault( server_settings_t *pSettings, int OverwriteExi
             pSettings->scripting.enabled = 1;
         pSettings->scripting.error_output_socket = 1;
         pSettings->scripting.session_timeout = LUASP_SESSION_TIMEOUT_DEFAULT;
+        pSettings->scripting.workers = SCRIPT_WORKERS_DEFAULT;
+        pSettings->scripting.queue_size = SCRIPT_QUEUE_SIZE_DEFAULT;
         if( OverwriteExisting || pSettings->scripting.cache == SETTING_VAL_NOT_SET )
             pSettings->scripting.cache = LUASP_CACHING_NONE;
     #endif
     #if DEFLATE_SUPPORT
         if( OverwriteExisting || pSettings->deflate == SETTING_VAL_NOT_SET )
             pSettings->deflate = 0;
+        pSettings->deflate_cache_limit_mb = DEFLATE_CACHE_LIMIT_MB_DEFAULT;
+        pSettings->deflate_cache_file_limit_kb = DEFLATE_CACHE_FILE_LIMIT_KB_DEFAULT;
+        pSettings->deflate_threads = DEFLATE_THREADS_DEFAULT;
+        pSettings->deflate_block_kb = DEFLATE_BLOCK_KB_DEFAULT;
     #endif
     if( OverwriteExisting || pSettings->disable_er == SETTING_VAL_NOT_SET )
         pSettings->disable_er = 0;
@@ -182,15 +234,88 @@ int settings_loadini(server_settings_t *pSettings, const char* filename, int Def
     pSettings->loglevel_console = ini_dictionary_getint( ini, INI_SECTION_SERVER, "loglevel_console", log_ERROR );
     pSettings->ipv6 = ini_dictionary_getboolean( ini, INI_SECTION_SERVER, "ipv6", 1 );
 
+    {   /* worker pool */
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "workers", WORKERS_DEFAULT );
+        pSettings->workers = (val < 1) ? 1 : (val > WORKERS_MAX) ? WORKERS_MAX : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "queue_size", QUEUE_SIZE_DEFAULT );
+        pSettings->queue_size = (val < 1) ? 1 : (val > QUEUE_SIZE_MAX) ? QUEUE_SIZE_MAX : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "io_workers", IO_WORKERS_DEFAULT );
+        pSettings->io_workers = (val < 0) ? 0 : (val > WORKERS_MAX) ? WORKERS_MAX : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "io_queue_size", IO_QUEUE_SIZE_DEFAULT );
+        pSettings->io_queue_size = (val < 1) ? 1 : (val > QUEUE_SIZE_MAX) ? QUEUE_SIZE_MAX : val;
+        str = ini_dictionary_getstring( ini, INI_SECTION_SERVER, "io_engine", "io_uring" );
+        pSettings->io_engine = (strcmp( str, "poll" ) == 0 || strcmp( str, "select" ) == 0) ? IO_ENGINE_POLL
+                             : (strcmp( str, "epoll" ) == 0) ? IO_ENGINE_EPOLL : IO_ENGINE_IO_URING;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "listen_shards", 0 );
+        pSettings->listen_shards = (val < -1) ? 0 : (val > LISTEN_SHARDS_MAX) ? LISTEN_SHARDS_MAX : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "listen_backlog", 0 );
+        pSettings->listen_backlog = (val < 0) ? 0 : val;
+    }
+
+    {   /* admission control */
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "max_static_requests", 0 );
+        pSettings->max_static_requests = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "max_embedded_requests", 0 );
+        pSettings->max_embedded_requests = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "max_lua_requests", 0 );
+        pSettings->max_lua_requests = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "retry_after", RETRY_AFTER_DEFAULT );
+        pSettings->retry_after = (val < 0) ? 0 : val;
+    }
+
+    {   /* www root file and content cache */
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "file_cache_entries", FILE_CACHE_ENTRIES_DEFAULT );
+        pSettings->file_cache_entries = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "file_cache_fds", FILE_CACHE_FDS_DEFAULT );
+        pSettings->file_cache_fds = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "file_cache_ttl", FILE_CACHE_TTL_DEFAULT );
+        pSettings->file_cache_ttl = (val < 1) ? 1 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "content_cache_limit_mb", CONTENT_CACHE_LIMIT_MB_DEFAULT );
+        pSettings->content_cache_limit_mb = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "content_cache_file_limit_kb", CONTENT_CACHE_FILE_LIMIT_KB_DEFAULT );
+        pSettings->content_cache_file_limit_kb = (val < 0) ? 0 : val;
+        pSettings->precompressed = ini_dictionary_getboolean( ini, INI_SECTION_SERVER, "precompressed", 1 );
+    }
+
+    {   /* persistent connections */
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "keepalive_timeout", KEEPALIVE_TIMEOUT_DEFAULT );
+        pSettings->keepalive_timeout = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "keepalive_max_requests", KEEPALIVE_MAX_REQUESTS_DEFAULT );
+        pSettings->keepalive_max_requests = (val < 1) ? 1 : val;
+    }
+
+    {   /* request receive timeouts */
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "request_header_timeout", REQUEST_HEADER_TIMEOUT_DEFAULT );
+        pSettings->request_header_timeout = (val < 1) ? 1 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "request_body_timeout", REQUEST_BODY_TIMEOUT_DEFAULT );
+        pSettings->request_body_timeout = (val < 1) ? 1 : val;
+    }
+
     if( pSettings->disable_er == SETTING_VAL_NOT_SET )
         pSettings->disable_er = ini_dictionary_getint( ini, INI_SECTION_SERVER, "disable_embedded_res", 0 );
 
+    if( !pSettings->resource_bundle ) {
+        str = ini_dictionary_getstring( ini, INI_SECTION_SERVER, "resource_bundle", NULL );
+        if( str && str[0] && (pSettings->resource_bundle = malloc( strlen(str) + 1 )) )
+            strcpy( pSettings->resource_bundle, str );
+    }
+
 
     #if DEFLATE_SUPPORT
     if( pSettings->deflate == SETTING_VAL_NOT_SET )
         pSettings->deflate = ini_dictionary_getint( ini, INI_SECTION_SERVER, "deflate", 0 );
         if( pSettings->deflate > 9 ) pSettings->deflate = 9;
         else if( pSettings->deflate < 0 ) pSettings->deflate = 0;
+    {
+        int val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "deflate_cache_limit_mb", DEFLATE_CACHE_LIMIT_MB_DEFAULT );
+        pSettings->deflate_cache_limit_mb = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "deflate_cache_file_limit_kb", DEFLATE_CACHE_FILE_LIMIT_KB_DEFAULT );
+        pSettings->deflate_cache_file_limit_kb = (val < 0) ? 0 : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "deflate_threads", DEFLATE_THREADS_DEFAULT );
+        pSettings->deflate_threads = (val < 0) ? 0 : (val > WORKERS_MAX) ? WORKERS_MAX : val;
+        val = ini_dictionary_getint( ini, INI_SECTION_SERVER, "deflate_block_kb", DEFLATE_BLOCK_KB_DEFAULT );
+        pSettings->deflate_block_kb = (val < DEFLATE_BLOCK_KB_MIN) ? DEFLATE_BLOCK_KB_MIN : val;
+    }
     #endif
 
     /* load scripting settings ---------------------------------------------- */
@@ -199,6 +324,12 @@ int settings_loadini(server_settings_t *pSettings, const char* filename, int Def
                 pSettings->scripting.enabled = ini_dictionary_getboolean( ini, INI_SECTION_SCRIPTING, "enabled", 1 );
         pSettings->scripting.error_output_socket = ini_dictionary_getboolean( ini, INI_SECTION_SCRIPTING, "error_output_socket", 1 );
         pSettings->scripting.session_timeout = ini_dictionary_getint( ini, INI_SECTION_SCRIPTING, "session_timeout", LUASP_SESSION_TIMEOUT_DEFAULT );
+        {   /* script worker pool */
+            int val = ini_dictionary_getint( ini, INI_SECTION_SCRIPTING, "workers", SCRIPT_WORKERS_DEFAULT );
+            pSettings->scripting.workers = (val < 0) ? 0 : (val > WORKERS_MAX) ? WORKERS_MAX : val;
+            val = ini_dictionary_getint( ini, INI_SECTION_SCRIPTING, "queue_size", SCRIPT_QUEUE_SIZE_DEFAULT );
+            pSettings->scripting.queue_size = (val < 1) ? 1 : (val > QUEUE_SIZE_MAX) ? QUEUE_SIZE_MAX : val;
+        }
         if( pSettings->scripting.cache == SETTING_VAL_NOT_SET ) {
             pSettings->scripting.cache = LUASP_CACHING_NONE;
             if( ini_dictionary_getboolean( ini, INI_SECTION_SCRIPTING, "caching", 0 ) ) {
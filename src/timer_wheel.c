@@ -0,0 +1,152 @@
+/* cranberry-server. A small C web server application with lua scripting,
+ * session and sqlite support. https://github.com/jahnf/cranberry-server
+ * For licensing see LICENSE file or
+ * https://github.com/jahnf/cranberry-server/blob/master/LICENSE
+ */
+
+/** @file timer_wheel.c
+ * Hierarchical timer wheel. Level 0 has one slot per tick of the current
+ * round, a slot of level n holds the timers of TIMER_WHEEL_SLOTS^n ticks.
+ * When a level starts a new round the matching slot of the level above
+ * is cascaded, i.e. its timers are sorted into the levels below.
+ */
+
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK  ((unsigned long)TIMER_WHEEL_SLOTS - 1)
+/* maximum number of ticks between now and the deadline that fit into the wheel */
+#define TIMER_WHEEL_RANGE (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+/* slot index of a tick at the given level */
+#define TIMER_WHEEL_INDEX(tick, level) (((tick) >> (TIMER_WHEEL_BITS * (level))) & TIMER_WHEEL_MASK)
+
+/* put an entry into the slot of its expiry tick */
+static void _timer_wheel_insert( timer_wheel_t *wheel, timer_entry_t *entry )
+{
+    const long delta = (long)(entry->expires - wheel->tick);
+    timer_entry_t **slot;
+    int level;
+
+    if( delta < 0 ) {
+        /* already expired, handled with the next tick */
+        slot = &wheel->slots[0][wheel->tick & TIMER_WHEEL_MASK];
+    }
+    else if( (unsigned long)delta >= TIMER_WHEEL_RANGE ) {
+        /* too far ahead, park it in the last slot of the top level
+         * and sort it in again once that slot is cascaded */
+        const unsigned long tick = wheel->tick + TIMER_WHEEL_RANGE - 1;
+        slot = &wheel->slots[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_INDEX(tick, TIMER_WHEEL_LEVELS - 1)];
+    }
+    else {
+        for( level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level ) {
+            if( (unsigned long)delta < (1UL << (TIMER_WHEEL_BITS * (level + 1))) )
+                break;
+        }
+        slot = &wheel->slots[level][TIMER_WHEEL_INDEX(entry->expires, level)];
+    }
+
+    entry->slot = slot;
+    entry->prev = NULL;
+    if( (entry->next = *slot) ) entry->next->prev = entry;
+    *slot = entry;
+}
+
+/* sort the timers of the current slot of a level into the levels below,
+ * returns the slot index */
+static unsigned long _timer_wheel_cascade( timer_wheel_t *wheel, int level )
+{
+    const unsigned long index = TIMER_WHEEL_INDEX(wheel->tick, level);
+    timer_entry_t *entry = wheel->slots[level][index], *next;
+
+    wheel->slots[level][index] = NULL;
+    for( ; entry; entry = next ) {
+        next = entry->next;
+        _timer_wheel_insert( wheel, entry );
+    }
+    return index;
+}
+
+void timer_wheel_init( timer_wheel_t *wheel, unsigned long now, unsigned int resolution )
+{
+    memset( wheel, 0, sizeof(timer_wheel_t) );
+    wheel->resolution = resolution ? resolution : 1;
+    wheel->tick = now / wheel->resolution;
+}
+
+void timer_entry_init( timer_entry_t *entry, void *data )
+{
+    entry->next = entry->prev = NULL;
+    entry->slot = NULL;
+    entry->expires = 0;
+    entry->data = data;
+}
+
+void timer_wheel_add( timer_wheel_t *wheel, timer_entry_t *entry, unsigned long deadline )
+{
+    if( TIMER_ENTRY_ARMED(entry) )
+        timer_wheel_remove( wheel, entry );
+    /* round up, a timer must not expire before its deadline */
+    entry->expires = deadline / wheel->resolution + (deadline % wheel->resolution ? 1 : 0);
+    _timer_wheel_insert( wheel, entry );
+    ++wheel->count;
+}
+
+void timer_wheel_remove( timer_wheel_t *wheel, timer_entry_t *entry )
+{
+    if( !TIMER_ENTRY_ARMED(entry) ) return;
+    if( entry->prev ) entry->prev->next = entry->next;
+    else *entry->slot = entry->next;
+    if( entry->next ) entry->next->prev = entry->prev;
+    entry->next = entry->prev = NULL;
+    entry->slot = NULL;
+    --wheel->count;
+}
+
+timer_entry_t * timer_wheel_expire( timer_wheel_t *wheel, unsigned long now )
+{
+    const unsigned long target = now / wheel->resolution;
+    timer_entry_t *entry, *expired = NULL;
+    int level;
+
+    if( !wheel->count ) {
+        /* nothing to cascade, just catch up */
+        if( (long)(target - wheel->tick) >= 0 ) wheel->tick = target + 1;
+        return NULL;
+    }
+
+    for( ; (long)(target - wheel->tick) >= 0; ++wheel->tick ) {
+        const unsigned long index = wheel->tick & TIMER_WHEEL_MASK;
+        /* a new round of level 0 starts, refill it from the levels above */
+        if( !index ) {
+            for( level = 1; level < TIMER_WHEEL_LEVELS; ++level ) {
+                if( _timer_wheel_cascade( wheel, level ) ) break;
+            }
+        }
+        while( (entry = wheel->slots[0][index]) ) {
+            timer_wheel_remove( wheel, entry );
+            entry->next = expired;
+            expired = entry;
+        }
+    }
+    return expired;
+}
+
+long timer_wheel_next( const timer_wheel_t *wheel, unsigned long now )
+{
+    unsigned long tick = wheel->tick;
+    long diff;
+    int i;
+
+    if( !wheel->count ) return -1;
+
+    /* first occupied slot of this level 0 round, or the start of the
+     * next round where timers of the upper levels might move down */
+    for( i = 0; i < TIMER_WHEEL_SLOTS; ++i, ++tick ) {
+        if( wheel->slots[0][tick & TIMER_WHEEL_MASK] || !(tick & TIMER_WHEEL_MASK) )
+            break;
+    }
+    diff = (long)(tick * wheel->resolution - now);
+    return diff < 0 ? 0 : diff;
+}
@@ -39,7 +39,14 @@
 #endif
 
 #include "cfile.h"
+#include "char_defines.h"
+#include "file_cache.h"
+#include "content_cache.h"
+#if DEFLATE_SUPPORT
+    #include "block_deflate.h"
+#endif
 #include "webthread.h"
+#include "event_loop.h"
 #include "http_defines.h"
 #include "http_request.h"
 #include "http_time.h"
@@ -54,224 +61,574 @@ SETLOGMODULENAME("webthread");
 
 /* embedded resources */
 #include "cresource.h"
+#include "cresource_bundle.h"
 
 /* Buffer sizes */
 #define SENDBUF_SIZE 8192
 #define DEFLATE_BUFSIZE 2048
 
-#define STR(x) #x
+/* Maximum number of ranges of a byte range request, the complete
+ * file is sent for requests with more ranges */
+#define MAX_RANGES 16
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
 
-typedef struct reg_thread_t reg_thread_t;
-struct reg_thread_t {
-    c_thread thread_id;
-    time_t start_time;
-    reg_thread_t *next;
+/* Request classes with separate admission limits */
+enum {
+    REQUEST_CLASS_NONE = -1,    /* not limited (server commands, errors) */
+    REQUEST_CLASS_STATIC = 0,   /* static files */
+    REQUEST_CLASS_EMBEDDED,     /* embedded resources */
+    REQUEST_CLASS_LUA,          /* lua pages */
+    REQUEST_CLASSES
 };
 
-/* Server thread register struct */
+/* Read status of a request that was handed over to a script worker,
+ * the connection must not be touched afterwards */
+#define REQUEST_HANDED_OVER -1
+
+static const char *_request_class_names[REQUEST_CLASSES] = { "static", "embedded", "lua" };
+
+/* Web thread module data */
 typedef struct {
-    c_mutex mutex_threadcount;
-    unsigned long ulThreadCount;
-    c_mutex mutex_threadlist;
-    reg_thread_t *threads; /* list of running server threads */
-} thread_register_t;
+    c_pool web;                 /* readable connections, dispatched by the event loop */
+    c_pool io;                  /* static file requests that need file system access,
+                                   handed over by the web workers */
+    #if LUA_SUPPORT
+    c_pool script;              /* lua page requests, handed over by the web workers */
+    #endif
+    volatile long inflight[REQUEST_CLASSES];  /* requests in progress per class */
+    long max_inflight[REQUEST_CLASSES];       /* admission limits, 0 for no limit */
+    kv_item retry_after;        /* Retry-After header of overload replies, no key if off */
+    char retry_after_buf[12];
+} webthread_pool_t;
+
+static int _webthread_serve( thread_arg_t *args, http_req_info_t *req_info );
 
-/* Server threads register initialization */
-void * webthread_init()
+/* Admit a request of a class, returns 0 if the limit of the class is reached */
+static int _webthread_admit( webthread_pool_t *pool, int rclass )
 {
-    thread_register_t* pThreadRegister =
-            (thread_register_t*)malloc(sizeof(thread_register_t));
-    pThreadRegister->threads = NULL;
-    pThreadRegister->ulThreadCount = 0;
-    cthread_mutex_init( &pThreadRegister->mutex_threadcount );
-    cthread_mutex_init( &pThreadRegister->mutex_threadlist );
-    return pThreadRegister;
+    if( !pool->max_inflight[rclass] ) return 1;
+    if( cthread_atomic_add( &pool->inflight[rclass], 1 ) <= pool->max_inflight[rclass] )
+        return 1;
+    cthread_atomic_add( &pool->inflight[rclass], -1 );
+    return 0;
 }
 
-/* Returns the number of running server threads */
-unsigned long webthread_count(void *init_data)
+/* A request of a class that was admitted is done */
+static void _webthread_release( webthread_pool_t *pool, int rclass )
 {
-    unsigned long c;
-    thread_register_t* pWebThreadData = (thread_register_t*)init_data;
-    cthread_mutex_lock( &pWebThreadData->mutex_threadcount );
-    c = pWebThreadData->ulThreadCount;
-    cthread_mutex_unlock( &pWebThreadData->mutex_threadcount );
-    return c;
+    if( rclass != REQUEST_CLASS_NONE && pool->max_inflight[rclass] )
+        cthread_atomic_add( &pool->inflight[rclass], -1 );
 }
 
-/* Server threads deinitialization */
-void webthread_free( void *init_data )
+/* Overload reply, tells the client when to try again */
+static void _webthread_overloaded( webthread_pool_t *pool, send_buffer_t *sendbuf, const int http_ver )
+{
+    send_buffer_error_info_header( sendbuf, NULL, HTTP_STATUS_SERVICE_UNAVAILABLE,
+                                   pool->retry_after.key ? &pool->retry_after : NULL, http_ver );
+}
+
+/* Start the workers of a pool, they are pinned to
+ * a cpu if cpu >= 0. Returns 0 on error. */
+static int _webthread_start_workers( c_pool *workers, unsigned int num, unsigned int queue_size,
+                                     void (*run)( c_pool *workers ), int cpu )
+{
+    unsigned int i;
+    if( !cthread_pool_init( workers, num, queue_size, run, NULL ) ) {
+        LOG( log_ERROR, "worker thread creation error" );
+        return 0;
+    }
+    for( i = 0; cpu >= 0 && i < workers->num_workers; ++i ) {
+        if( !cthread_set_affinity( &workers->workers[i], cpu ) )
+            LOG( log_WARNING, "could not pin worker thread to cpu %d", cpu );
+    }
+    return 1;
+}
+
+/* Close a connection that is still queued when the workers stop */
+static void _webthread_discard( void *data )
 {
-    unsigned int i; /* we want to be able to compile on non-C99 compilers */
-    thread_register_t* pThreadRegister = (thread_register_t*)init_data;
-    if( !pThreadRegister ) return;
+    thread_arg_t *conn = (thread_arg_t*)data;
+    free_req_info( (http_req_info_t*)conn->request );
+    event_loop_close( conn );
+}
 
-    /* This function requires that no more threads are started
-       and registered after the call to webthread_free */
+/* Reject a connection with 503 Service Unavailable, without waiting
+ * for a worker. The request is not parsed. */
+static void _webthread_reject( webthread_pool_t *pool, thread_arg_t *conn )
+{
+    char buf[1024];
+    send_buffer_t sendbuf;
 
-    /* Give all server threads some time to finish */
-    for( i=0; i < 30; ++i ) {
-        if( webthread_count(init_data) == 0 ) break;
-        cthread_sleep( 333 );
+    #ifdef MSG_DONTWAIT
+    /* consume what the client has sent so far, closing a socket with
+     * unread data resets the connection before the reply is read */
+    if( recv( conn->fd, buf, sizeof(buf), MSG_DONTWAIT ) < 0 ) { /* ignore */ }
+    #endif
+
+    send_buffer_init( &sendbuf, conn->fd, buf, sizeof(buf), SBF_NONE );
+    _webthread_overloaded( pool, &sendbuf, HTTP_VERSION_1_0 );
+    send_buffer_flush_last( &sendbuf );
+}
+
+/* Web worker main function, handles readable connections */
+static void _webthread_web_worker( c_pool *workers )
+{
+    thread_arg_t *conn;
+    while( (conn = (thread_arg_t*)cthread_pool_pop( workers )) )
+        webthread( conn );
+}
+
+/* Script and i/o worker main function, answers the requests that were
+ * handed over and the requests that follow on their connections */
+static void _webthread_handed_over_worker( c_pool *workers )
+{
+    thread_arg_t *conn;
+    while( (conn = (thread_arg_t*)cthread_pool_pop( workers )) ) {
+        http_req_info_t *req_info = (http_req_info_t*)conn->request;
+        conn->request = NULL;
+        _webthread_serve( conn, req_info );
     }
-    cthread_mutex_lock( &pThreadRegister->mutex_threadcount );
-    cthread_mutex_lock( &pThreadRegister->mutex_threadlist );
-    cthread_mutex_unlock( &pThreadRegister->mutex_threadcount );
-    cthread_mutex_unlock( &pThreadRegister->mutex_threadlist );
-    cthread_mutex_destroy( &pThreadRegister->mutex_threadcount );
-    cthread_mutex_destroy( &pThreadRegister->mutex_threadlist );
-    free( pThreadRegister );
 }
 
-/* Register a thread to the thread register */
-static void register_thread( thread_arg_t *args )
+cresource_t * webthread_get_resource( thread_arg_t *args, const char *name )
+{
+    cresource_t *resource;
+    if( args->pDataResourceBundle
+        && (resource = cresource_bundle_get( (cresource_bundle_t*)args->pDataResourceBundle, name )) )
+        return resource;
+    return get_cresource( name );
+}
+
+/* Web thread module initialization, starts the worker threads */
+void * webthread_init( thread_arg_t *args )
 {
-    thread_register_t* pThreadRegister = (thread_register_t*)args->pDataSrvThreads;
-    reg_thread_t* pRegThread = (reg_thread_t*)malloc( sizeof(reg_thread_t) );
+    server_settings_t *pSettings = (server_settings_t*)args->pSettings;
+    unsigned int workers = pSettings->workers;
+    unsigned int io_workers = pSettings->io_workers;
+    webthread_pool_t *pool = (webthread_pool_t*)malloc( sizeof(webthread_pool_t) );
+    #if LUA_SUPPORT
+    unsigned int script_workers = pSettings->scripting.enabled ? pSettings->scripting.workers : 0;
+    #endif
+    if( !pool ) return NULL;
+
+    memset( pool, 0, sizeof(webthread_pool_t) );
+    pool->max_inflight[REQUEST_CLASS_STATIC] = pSettings->max_static_requests;
+    pool->max_inflight[REQUEST_CLASS_EMBEDDED] = pSettings->max_embedded_requests;
+    pool->max_inflight[REQUEST_CLASS_LUA] = pSettings->max_lua_requests;
+    if( pSettings->retry_after ) {
+        sprintf( pool->retry_after_buf, "%u", pSettings->retry_after );
+        pool->retry_after.key = HTTP_HEADER_RETRY_AFTER;
+        pool->retry_after.value = pool->retry_after_buf;
+    }
+
+    /* the workers and request limits are split between the listener shards */
+    if( pSettings->listen_shards > 1 ) {
+        int i;
+        workers = (workers + pSettings->listen_shards - 1) / pSettings->listen_shards;
+        io_workers = (io_workers + pSettings->listen_shards - 1) / pSettings->listen_shards;
+        #if LUA_SUPPORT
+        script_workers = (script_workers + pSettings->listen_shards - 1) / pSettings->listen_shards;
+        #endif
+        for( i = 0; i < REQUEST_CLASSES; ++i )
+            pool->max_inflight[i] = (pool->max_inflight[i] + pSettings->listen_shards - 1)
+                                    / pSettings->listen_shards;
+    }
+
+    /* the i/o and script workers are started first, the web workers hand over to them */
+    if( io_workers ) {
+        if( !_webthread_start_workers( &pool->io, io_workers, pSettings->io_queue_size,
+                                       _webthread_handed_over_worker, args->cpu ) ) {
+            webthread_free( pool );
+            return NULL;
+        }
+        LOG( log_INFO, "started %u i/o workers, queue size %lu", pool->io.num_workers,
+             (unsigned long)cthread_ring_capacity( &pool->io.queue ) );
+    }
+
+    #if LUA_SUPPORT
+    if( script_workers ) {
+        if( !_webthread_start_workers( &pool->script, script_workers, pSettings->scripting.queue_size,
+                                       _webthread_handed_over_worker, args->cpu ) ) {
+            webthread_free( pool );
+            return NULL;
+        }
+        LOG( log_INFO, "started %u script workers, queue size %lu", pool->script.num_workers,
+             (unsigned long)cthread_ring_capacity( &pool->script.queue ) );
+    }
+    #endif
 
-    pRegThread->start_time = time(0);
-    pRegThread->thread_id = cthread_self();
+    if( !_webthread_start_workers( &pool->web, workers, pSettings->queue_size,
+                                   _webthread_web_worker, args->cpu ) ) {
+        webthread_free( pool );
+        return NULL;
+    }
+    LOG( log_INFO, "started %u web thread workers, queue size %lu", pool->web.num_workers,
+         (unsigned long)cthread_ring_capacity( &pool->web.queue ) );
+    return pool;
+}
 
-    cthread_mutex_lock( &pThreadRegister->mutex_threadlist );
-    cthread_mutex_lock( &pThreadRegister->mutex_threadcount );
+int webthread_dispatch( void *init_data, thread_arg_t *conn )
+{
+    webthread_pool_t *pool = (webthread_pool_t*)init_data;
 
-    pRegThread->next = pThreadRegister->threads;
-    pThreadRegister->threads = pRegThread;
-    ++pThreadRegister->ulThreadCount;
+    if( cthread_pool_push( &pool->web, conn ) )
+        return 1;
 
-    cthread_mutex_unlock( &pThreadRegister->mutex_threadcount );
-    cthread_mutex_unlock( &pThreadRegister->mutex_threadlist );
+    if( !pool->web.stop ) {
+        LOG( log_WARNING, "queue full, rejecting connection (hit %lu)", (unsigned long)conn->hit );
+        _webthread_reject( pool, conn );
+    }
+    return 0;
 }
 
-/* Unregister a thread from the thread register */
-static void unregister_thread( thread_arg_t *args )
+/* Web thread module deinitialization, stops and joins all workers */
+void webthread_free( void *init_data )
 {
-    thread_register_t* pThreadRegister = (thread_register_t*)args->pDataSrvThreads;
-    reg_thread_t *iter, *current, *prev = 0;
-    c_thread self = cthread_self();
+    webthread_pool_t *pool = (webthread_pool_t*)init_data;
+    if( !pool ) return;
 
-    cthread_mutex_lock( &pThreadRegister->mutex_threadlist );
+    /* This function requires that no more connections are dispatched
+       after the call to webthread_free. The web workers are stopped
+       first, they might still hand over requests to the i/o and script workers. */
+    cthread_pool_destroy( &pool->web, _webthread_discard );
+    cthread_pool_destroy( &pool->io, _webthread_discard );
+    #if LUA_SUPPORT
+    cthread_pool_destroy( &pool->script, _webthread_discard );
+    #endif
+    free( pool );
+}
 
-        iter = pThreadRegister->threads;
-        while( iter ) {
+/* Release the cache entries of deferred reply bodies (see send_buffer_hold()) */
+static void _webthread_release_file( void *cache, void *entry )
+{
+    file_cache_release( cache, (file_cache_entry_t*)entry );
+}
 
-            current = iter;
-            iter = iter->next;
+static void _webthread_release_content( void *cache, void *entry )
+{
+    content_cache_release( cache, (content_cache_entry_t*)entry );
+}
 
-            if( cthread_equal(current->thread_id, self) ) {
-                if( prev ) prev->next = iter;
-                else pThreadRegister->threads = iter;
+#if DEFLATE_SUPPORT
+static void _webthread_release_buffer( void *owner, void *buffer )
+{
+    (void)owner;
+    free( buffer );
+}
+#endif
 
-                cthread_mutex_lock( &pThreadRegister->mutex_threadcount );
-                --pThreadRegister->ulThreadCount;
-                cthread_mutex_unlock( &pThreadRegister->mutex_threadcount );
+/* Sends a reply from the content or deflate cache and releases the entry
+ * once its body is sent */
+static void _webthread_send_cached( thread_arg_t *args, http_req_info_t *req_info,
+                                    void *cache, content_cache_entry_t *cached )
+{
+    if( send_buffer_cached_reply( args->sendbuf, HTTP_STATUS_OK, cached->fields, cached->fields_len,
+                                  cached->data, cached->size, req_info->http_version ) < 0 )
+        LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+    if( !send_buffer_hold( args->sendbuf, _webthread_release_content, cache, cached ) )
+        content_cache_release( cache, cached );
+}
 
-                free(current);
-                break;
-            }
-            else {
-                prev = current;
-            }
+/* Formats the entity tag of a static file from its modification time and
+ * size, representations in a content encoding get the encoding appended */
+static char * _webthread_etag( char *buf, const cfile_stat_t *st, const char *encoding )
+{
+    if( encoding )
+        sprintf( buf, "\"%lx-%lx-%s\"", (unsigned long)st->mtime, (unsigned long)st->size, encoding );
+    else
+        sprintf( buf, "\"%lx-%lx\"", (unsigned long)st->mtime, (unsigned long)st->size );
+    return buf;
+}
+
+/* Checks the tags of an If-None-Match header against an entity tag, tags of
+ * the same resource in another content encoding match as well (weak
+ * comparison). The matching tag is copied to etag, it is the one that the
+ * client has and that has to be sent with the 304 reply. */
+static int _webthread_none_match( const char *tags, char *etag, const size_t etag_size )
+{
+    const size_t len = strlen( etag ) - 1;   /* without the closing quote */
+    while( *tags ) {
+        const char *tag, *end;
+        if( *tags == ' ' || *tags == ASCII_TAB || *tags == ',' ) {
+            ++tags;
+            continue;
+        }
+        if( *tags == '*' ) return 1;
+        if( tags[0] == 'W' && tags[1] == '/' ) tags += 2;
+        if( *tags != '"' || !(end = strchr( tags + 1, '"' )) ) return 0;
+        tag = tags;
+        tags = end + 1;
+        if( strncmp( tag, etag, len ) == 0 && (tag[len] == '"' || tag[len] == '-')
+            && (size_t)(tags - tag) < etag_size ) {
+            memcpy( etag, tag, tags - tag );
+            etag[tags - tag] = 0;
+            return 1;
         }
+    }
+    return 0;
+}
 
-    cthread_mutex_unlock( &pThreadRegister->mutex_threadlist );
+/* Returns 1 if a conditional GET can be answered with 304 Not Modified,
+ * If-None-Match takes precedence over If-Modified-Since, see
+ * http://tools.ietf.org/html/rfc7232#section-6 */
+static int _webthread_not_modified( http_req_info_t *req_info, char *etag, const size_t etag_size,
+                                    const time_t mtime )
+{
+    const char *cond;
+    time_t since;
+
+    if( (cond = kvlist_get_value_from_key( HTTP_HEADER_IF_NONE_MATCH, req_info->header_info )) )
+        return _webthread_none_match( cond, etag, etag_size );
+    if( mtime && (cond = kvlist_get_value_from_key( HTTP_HEADER_IF_MODIFIED_SINCE, req_info->header_info ))
+        && http_time_mktime( cond, &since ) == 0 )
+        return mtime <= since;
+    return 0;
 }
 
-/* free a thread argument struct */
-void free_thread_arg(thread_arg_t *arg)
+/* Returns the number of satisfiable ranges of a byte range request for a
+ * static file, or -1 if the complete file is sent. The Range header is ignored
+ * if the If-Range entity tag or date does not match the file. */
+static int _webthread_ranges( http_req_info_t *req_info, const cfile_stat_t *st, const char *etag,
+                              const char *last_modified, http_range_t *ranges )
 {
-    if( !arg ) return;
-    free( arg->client_addr );
-    free( arg );
+    const char *range = kvlist_get_value_from_key( HTTP_HEADER_RANGE, req_info->header_info );
+    const char *if_range;
+
+    if( !range ) return -1;
+    if( (if_range = kvlist_get_value_from_key( HTTP_HEADER_IF_RANGE, req_info->header_info )) ) {
+        while( *if_range == ' ' ) ++if_range;
+        if( strcmp( if_range, (*if_range == '"') ? etag : last_modified ) != 0 ) return -1;
+    }
+    return http_request_parse_range( range, st->size, ranges, MAX_RANGES );
 }
 
-/* Server thread that handles a request */
-CTHREAD_RET webthread(CTHREAD_ARG data)
+/* Formats the header of a part of a multipart/byteranges reply */
+static int _webthread_range_part( char *buf, const char *boundary, const char *mimetype,
+                                  const http_range_t *range, const off_t size )
 {
-    char send_buffer[SENDBUF_SIZE];     /* Request send buffer memory */
-    char small_string_buf[32];          /* Small string buffer */
+    return sprintf( buf, ASCII_CRLF "--%s" ASCII_CRLF HTTP_HEADER_CONTENT_TYPE ": %.128s"
+                         ASCII_CRLF HTTP_HEADER_CONTENT_RANGE ": bytes " OFFT_FMT "-" OFFT_FMT "/" OFFT_FMT
+                         ASCII_CRLF ASCII_CRLF, boundary, mimetype, OFFT_FMT_CAST range->first,
+                         OFFT_FMT_CAST range->last, OFFT_FMT_CAST size );
+}
 
-    send_buffer_t sendbuf;              /* send buffer object */
-    int ret_val = 0;                    /* thread return value, 0 = SUCCESS */
-    int srv_cmd = 0;
+/* Returns the header fields that a 206 reply has in common with the 200
+ * reply of the whole file (RFC 7233, section 4.1) */
+static kv_item * _webthread_partial_header( const char *content_type, const char *etag,
+                                            const char *last_modified, const int negotiated )
+{
+    kv_item *header = kvlist_new_item( HTTP_HEADER_CONTENT_TYPE, content_type );
+    header = kvlist_new_item_push_front( HTTP_HEADER_ETAG, etag, header );
+    header = kvlist_new_item_push_front( HTTP_HEADER_LAST_MODIFIED, last_modified, header );
+    header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL, "max-age=" STR(STATIC_CACHE_AGE_MAX), header );
+    if( negotiated )
+        header = kvlist_new_item_push_front( HTTP_HEADER_VARY, HTTP_HEADER_ACCEPT_ENCODING, header );
+    return header;
+}
 
-    http_req_info_t *req_info = NULL;
-    thread_arg_t *args = (thread_arg_t*)data;
-    server_settings_t *pSettings = (server_settings_t*)args->pSettings;
+/* Answers a byte range request for a static file. A single range is sent as
+ * it is, several ranges as multipart/byteranges message, both zero-copy from
+ * the file. A request without satisfiable range gets a 416 reply. */
+static void _webthread_send_ranges( thread_arg_t *args, http_req_info_t *req_info, const int fd,
+                                    const cfile_stat_t *st, const char *etag, const char *last_modified,
+                                    const int negotiated, const http_range_t *ranges, const int count )
+{
+    send_buffer_t *sendbuf = args->sendbuf;
+    kv_item *header;
+    char buf[256];
+    int i;
 
-    /* register thread at the thread register */
-    register_thread( args );
+    if( !count ) {
+        sprintf( buf, "bytes */" OFFT_FMT, OFFT_FMT_CAST st->size );
+        header = kvlist_new_item( HTTP_HEADER_CONTENT_RANGE, buf );
+        header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, "0", header );
+        send_buffer_http_header( sendbuf, HTTP_STATUS_RANGE_NOT_SATISFIABLE, header, req_info->http_version );
+    }
+    else if( count == 1 ) {
+        header = _webthread_partial_header( req_info->mimetype, etag, last_modified, negotiated );
+        sprintf( buf, "bytes " OFFT_FMT "-" OFFT_FMT "/" OFFT_FMT, OFFT_FMT_CAST ranges[0].first,
+                 OFFT_FMT_CAST ranges[0].last, OFFT_FMT_CAST st->size );
+        header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_RANGE, buf, header );
+        sprintf( buf, OFFT_FMT, OFFT_FMT_CAST (ranges[0].last - ranges[0].first + 1) );
+        header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, buf, header );
+        send_buffer_http_header( sendbuf, HTTP_STATUS_PARTIAL_CONTENT, header, req_info->http_version );
+        if( !send_buffer_file( sendbuf, fd, ranges[0].first, ranges[0].last - ranges[0].first + 1 ) )
+            LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+    }
+    else {
+        char boundary[20];
+        off_t length = 0;
 
-    /* read the http_request, here we can use the send buffer also for receiving */
-    req_info = http_request_read( args, REQ_FILL_ALL, &ret_val, send_buffer, sizeof(send_buffer) );
+        sprintf( boundary, "%08lx%08lx", (unsigned long)rand(), (unsigned long)st->mtime );
+        for( i = 0; i < count; ++i ) {
+            length += _webthread_range_part( buf, boundary, req_info->mimetype, &ranges[i], st->size );
+            length += ranges[i].last - ranges[i].first + 1;
+        }
+        length += sprintf( buf, ASCII_CRLF "--%s--" ASCII_CRLF, boundary );
 
-    if( ret_val != RRT_OKAY ) {
-        /* try to read (and ignore) the rest of post request data */
-        if( req_info->post_info ) {
-            if( req_info->post_info->content_length )
-                http_request_recv_post_and_throw_away( args->fd, req_info, send_buffer, sizeof(send_buffer) );
-            else
-                http_request_recv_until_timeout_or_error( args->fd, send_buffer, sizeof(send_buffer) );
+        sprintf( buf, HTTP_CONTENT_TYPE_MULTIPART_BYTERANGES "; boundary=%s", boundary );
+        header = _webthread_partial_header( buf, etag, last_modified, negotiated );
+        sprintf( buf, OFFT_FMT, OFFT_FMT_CAST length );
+        header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, buf, header );
+        send_buffer_http_header( sendbuf, HTTP_STATUS_PARTIAL_CONTENT, header, req_info->http_version );
+        for( i = 0; i < count; ++i ) {
+            send_buffer_string_data( sendbuf, buf,
+                    _webthread_range_part( buf, boundary, req_info->mimetype, &ranges[i], st->size ) );
+            if( !send_buffer_file( sendbuf, fd, ranges[i].first, ranges[i].last - ranges[i].first + 1 ) ) {
+                LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+                break;
+            }
         }
+        send_buffer_string_data( sendbuf, buf, sprintf( buf, ASCII_CRLF "--%s--" ASCII_CRLF, boundary ) );
     }
+    kvlist_free( header );
+}
 
-    /* init send buffer */
-    send_buffer_init( &sendbuf, args->fd, send_buffer, SENDBUF_SIZE, SBF_NONE );
-    args->sendbuf = &sendbuf;
+/* Looks up a precompressed variant of a static file in an encoding that the
+ * client accepts, i.e. "file.gz" or "file.deflate" next to the file. Variants
+ * that are older than the file itself are ignored. */
+static file_cache_entry_t * _webthread_precompressed( thread_arg_t *args, http_req_info_t *req_info,
+                                                      const cfile_stat_t *st, const char **encoding )
+{
+    static const char * const variants[][2] = { { "gzip", ".gz" }, { "deflate", ".deflate" } };
+    const size_t len = strlen( req_info->filename );
+    file_cache_entry_t *variant;
+    const char *client_ae;
+    char *path;
+    int i;
 
-    /* reply on errors */
-    if( ret_val != RRT_OKAY ) {
-        switch( ret_val ) {
-        case RRT_ALLOCATION_ERROR:
-            LOG_FILE( log_ERROR, "Memory allocation error while reading request" );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_INTERNAL_SERVER_ERROR, req_info->http_version );
-            break;
-        case RRT_MISSING_CONTENT_LENGTH:
-            LOG_FILE( log_WARNING, "Request is missing required content length" );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_LENGTH_REQUIRED, req_info->http_version );
-            break;
-        case RRT_FORM_FIELD_SIZE_EXCEEDED:
-            LOG_FILE( log_WARNING, "Form field size exceeded." );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_ENT_TOO_LARGE, req_info->http_version );
-            break;
-        case RRT_SOCKET_TIMEOUT:
-            LOG_FILE( log_WARNING, "Timeout during reading request." );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_TIMEOUT, req_info->http_version );
-            break;
-        case RRT_HEADER_LINE_SIZE_EXCEEDED:
-            LOG_FILE( log_WARNING, "Request-URI Too Long." );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_URI_TOO_LONG, req_info->http_version );
-            break;
-        case RRT_MALFORMED_REQUEST:
-            LOG_FILE( log_WARNING, "Malformed http request." );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_BAD_REQUEST, req_info->http_version );
-            break;
-        default:
-            LOG_FILE( log_ERROR, "Error during reading http request." );
-            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_INTERNAL_SERVER_ERROR, req_info->http_version );
-            break;
+    if( !((server_settings_t*)args->pSettings)->precompressed ||
+        !(req_info->mt_flags & MIMETYPE_FLAG_COMPRESSABLE) ||
+        !(client_ae = kvlist_get_value_from_key( HTTP_HEADER_ACCEPT_ENCODING, req_info->header_info )) ||
+        !(path = (char*)malloc( len + sizeof(".deflate") )) )
+        return NULL;
+
+    memcpy( path, req_info->filename, len );
+    for( i = 0; i < (int)(sizeof(variants) / sizeof(variants[0])); ++i ) {
+        if( !strstr( client_ae, variants[i][0] ) ) continue;
+        strcpy( &path[len], variants[i][1] );
+        if( (variant = file_cache_get( args->pDataFileCache, path )) ) {
+            if( variant->status == CFILE_SUCCESS && variant->st.type == CFILE_TYPE_REGULAR
+                && variant->fd != -1 && variant->st.mtime >= st->mtime ) {
+                *encoding = variants[i][0];
+                free( path );
+                return variant;
+            }
+            file_cache_release( args->pDataFileCache, variant );
         }
-        goto clean_up_thread;
     }
+    free( path );
+    return NULL;
+}
 
-    /* check if request type is supported */
-    switch( req_info->req_method ) {
-    case REQUEST_GET:
-    case REQUEST_POST:
-        /* only GET and POST are currently supported*/
-        break;
-    default: {
-        const char *req_method_str = http_request_type_to_str(req_info->req_method);
-        send_buffer_http_header( args->sendbuf, HTTP_STATUS_METHOD_NOT_ALLOWED, NULL, req_info->http_version );
-        LOG_FILE( log_ERROR, "Request type '%s' not supported (%d).", 
-                             req_method_str ? req_method_str : "UNKNOWN", req_info->req_method );
-        goto clean_up_thread;
-        break;
+#if DEFLATE_SUPPORT
+/* Writes compressed blocks through the send buffer, returns 0 once the
+ * client can't be reached anymore */
+static int _webthread_send_block( void *ctx, const char *data, size_t len )
+{
+    send_buffer_t *sendbuf = (send_buffer_t*)ctx;
+    while( len ) {
+        const size_t part = (len < sendbuf->bufsize - sendbuf->curpos) ? len : sendbuf->bufsize - sendbuf->curpos;
+        memcpy( &sendbuf->buf[sendbuf->curpos], data, part );
+        sendbuf->curpos += part;
+        data += part;
+        len -= part;
+        if( sendbuf->curpos == sendbuf->bufsize && send_buffer_flush( sendbuf ) <= 0 )
+            return 0;
+    }
+    return 1;
+}
+
+/* Answers a request with the compressed content of a static file from the
+ * deflate cache, on a miss the whole file is compressed and put into the
+ * cache. Content that doesn't make it into the cache is sent as it is, it
+ * is not compressed a second time. HEAD requests compress as well, their
+ * Content-Length is the one of the GET. Returns 0 if the file is too large
+ * to be compressed at once, nothing is sent then. */
+static int _webthread_send_deflated( thread_arg_t *args, http_req_info_t *req_info,
+                                     const int fd, const cfile_stat_t *st,
+                                     const char *last_modified )
+{
+    void *cache = args->pDataDeflateCache;
+    content_cache_entry_t *cached;
+    unsigned char *in, *out;
+    mz_ulong out_size;
+    size_t done = 0;
+    long ret;
+    int sent = 0;
+    z_stream stream;
+
+    if( !content_cache_fits( cache, st->size ) || strlen( req_info->mimetype ) >= 128 )
+        return 0;
+    if( (cached = content_cache_get( cache, req_info->filename, st->mtime, st->size )) ) {
+        _webthread_send_cached( args, req_info, cache, cached );
+        return 1;
+    }
+
+    out_size = mz_deflateBound( NULL, (mz_ulong)st->size );
+    in = (unsigned char*)malloc( (size_t)st->size + 1 );
+    out = (unsigned char*)malloc( out_size );
+    if( in && out ) {
+        while( done < (size_t)st->size &&
+               (ret = cfile_pread( fd, &in[done], (size_t)st->size - done, (off_t)done )) > 0 )
+            done += ret;
+
+        memset( &stream, 0, sizeof(stream) );
+        stream.next_in = in;
+        stream.avail_in = (unsigned int)done;
+        stream.next_out = out;
+        stream.avail_out = (unsigned int)out_size;
+
+        /* Compression. (use init that does not sent zlib headers (IE can't handle it) */
+        if( done == (size_t)st->size &&
+            mz_deflateInitwoHeader( &stream, ((server_settings_t*)args->pSettings)->deflate ) == Z_OK ) {
+            if( mz_deflate( &stream, Z_FINISH ) == Z_STREAM_END ) {
+                char fields[512], etag[64];
+                const int fields_len = sprintf( fields,
+                        ASCII_CRLF HTTP_HEADER_CACHE_CONTROL ": max-age=" STR(STATIC_CACHE_AGE_MAX)
+                        ASCII_CRLF HTTP_HEADER_CONTENT_ENCODING ": deflate"
+                        ASCII_CRLF HTTP_HEADER_CONTENT_LENGTH ": %lu"
+                        ASCII_CRLF HTTP_HEADER_CONTENT_TYPE ": %s"
+                        ASCII_CRLF HTTP_HEADER_ETAG ": %s"
+                        ASCII_CRLF HTTP_HEADER_LAST_MODIFIED ": %s"
+                        ASCII_CRLF HTTP_HEADER_VARY ": " HTTP_HEADER_ACCEPT_ENCODING,
+                        (unsigned long)stream.total_out, req_info->mimetype,
+                        _webthread_etag( etag, st, "deflate" ), last_modified );
+                if( (cached = content_cache_put( cache, req_info->filename, st->mtime, st->size,
+                                                 fields, fields_len, out, stream.total_out )) )
+                    _webthread_send_cached( args, req_info, cache, cached );
+                else {
+                    /* the cache is full or the file changed meanwhile */
+                    if( send_buffer_cached_reply( args->sendbuf, HTTP_STATUS_OK, fields, fields_len,
+                                                  out, stream.total_out, req_info->http_version ) < 0 )
+                        LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+                    if( send_buffer_hold( args->sendbuf, _webthread_release_buffer, NULL, out ) )
+                        out = NULL;
+                }
+                sent = 1;
+            }
+            if( deflateEnd( &stream ) != Z_OK ) {
+                LOG( log_ERROR, "deflateEnd() failed!" );
+            }
         }
     }
+    free( in );
+    free( out );
+    return sent;
+}
+#endif
+
+/* Answers a request that was read and admitted, the reply is collected
+ * in the send buffer of the connection */
+static void _webthread_reply( thread_arg_t *args, http_req_info_t *req_info,
+                              const int srv_cmd, cresource_t *efile )
+{
+    char small_string_buf[32];          /* Small string buffer */
+    server_settings_t *pSettings = (server_settings_t*)args->pSettings;
 
-    /* check if request addresses a built in server command */
-    if( (srv_cmd = is_server_command(args->pDataSrvCmds, req_info->filename)) ) {
+    if( srv_cmd ) {
         /* server command */
         server_command_run_by_id( args->pDataSrvCmds, srv_cmd, req_info, args );
     #if LUA_SUPPORT
@@ -279,54 +636,126 @@ CTHREAD_RET webthread(CTHREAD_ARG data)
     } else if( pSettings->scripting.enabled && req_info->scripting == SSS_LUA ) {
         luasp_process( req_info, args );
     #endif
-    } else {  /* static content */
-        cfile_stat_t st;
-
-        /* check for embedded resources if not disabled */
-        if( !pSettings->disable_er ) {
-            /* look for filename in embedded resources */
-            cresource_t *efile = get_cresource(req_info->filename);
-            if( efile != NULL ) {
-                /* TODO make it possible to send embedded resources with deflate
-                 *  -> This is only good if the connection to the server is very slow
-                 *  otherwise it might be faster to just send the data which is in memory already */
-                kv_item *header = kvlist_new_item( HTTP_HEADER_CONTENT_TYPE, req_info->mimetype );
-                sprintf( small_string_buf, OFFT_FMT, OFFT_FMT_CAST efile->size );
-
-                header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, small_string_buf, header );
-                header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
-                        "max-age=" STR(EMBEDDED_RES_CACHE_AGE_MAX), header );
-
-                send_buffer_http_header( args->sendbuf, HTTP_STATUS_OK, header, req_info->http_version );
-                send_buffer_flush( args->sendbuf );
-                send( args->fd, (const char*)efile->data, efile->size, 0);
-                kvlist_free( header );
+    } else if( efile ) {  /* embedded resource */
+        /* the entity tag is compiled in with the resource, so the header
+         * fields are rendered in one go and sent with the data in one call */
+        char fields[512], etag[64];
+        int fields_len;
+        const char *client_ae;
+        /* compressible resources are compiled in with a deflate variant, which
+         * is sent as it is to clients that accept it, the replies of those
+         * depend on the Accept-Encoding field of the request */
+        const int negotiated = efile->deflate_size && pSettings->precompressed;
+        const int deflated = negotiated &&
+            (client_ae = kvlist_get_value_from_key( HTTP_HEADER_ACCEPT_ENCODING, req_info->header_info ))
+              && strstr( client_ae, "deflate" );
+        const char *vary = negotiated ? ASCII_CRLF HTTP_HEADER_VARY ": " HTTP_HEADER_ACCEPT_ENCODING : "";
+        const unsigned char *data = deflated ? efile->deflate_data : efile->data;
+        const unsigned long size = deflated ? efile->deflate_size : efile->size;
+        int not_modified;
 
-                goto clean_up_thread;
-            }
+        strncpy( etag, efile->etag, sizeof(etag) - 1 );
+        etag[sizeof(etag) - 1] = 0;
+        if( (not_modified = _webthread_not_modified( req_info, etag, sizeof(etag), 0 )) ) {
+            /* the client has the resource already */
+            fields_len = sprintf( fields,
+                    ASCII_CRLF HTTP_HEADER_CACHE_CONTROL ": max-age=" STR(EMBEDDED_RES_CACHE_AGE_MAX)
+                    ASCII_CRLF HTTP_HEADER_ETAG ": %s%s", etag, vary );
+        } else {
+            /* the tag of the deflate variant is the one of the resource with the
+             * encoding appended, i.e. inserted before the closing quote */
+            fields_len = sprintf( fields,
+                    ASCII_CRLF HTTP_HEADER_CACHE_CONTROL ": max-age=" STR(EMBEDDED_RES_CACHE_AGE_MAX)
+                    "%s"
+                    ASCII_CRLF HTTP_HEADER_CONTENT_LENGTH ": %lu"
+                    ASCII_CRLF HTTP_HEADER_CONTENT_TYPE ": %.128s"
+                    ASCII_CRLF HTTP_HEADER_ETAG ": %.*s%s%s",
+                    deflated ? ASCII_CRLF HTTP_HEADER_CONTENT_ENCODING ": deflate" : "", size,
+                    efile->mimetype ? efile->mimetype : req_info->mimetype,
+                    (int)strlen( etag ) - (deflated ? 1 : 0), etag, deflated ? "-deflate\"" : "", vary );
         }
+        if( send_buffer_cached_reply( args->sendbuf, not_modified ? HTTP_STATUS_NOT_MODIFIED : HTTP_STATUS_OK,
+                                      fields, fields_len, data, not_modified ? 0 : size,
+                                      req_info->http_version ) < 0 )
+            LOG( log_WARNING, "sending resource '%s' failed", req_info->filename );
+    } else {  /* static content */
+        /* look up the requested file in the www root dir */
+        file_cache_entry_t *file = pSettings->wwwroot
+                                 ? file_cache_get( args->pDataFileCache, req_info->filename ) : NULL;
 
-        /* check for the requested file in the www root dir */
-        if( pSettings->wwwroot &&
-                cfile_getstat( req_info->filename, &st ) == CFILE_SUCCESS ) {
-
-            FILE *pFile;
+        if( file && file->status == CFILE_SUCCESS ) {
+            const cfile_stat_t st = file->st;
             /* check if file is readable */
-            if( st.type == CFILE_TYPE_REGULAR && (pFile = fopen(req_info->filename, "rb")) ) {
-                int ret;
+            if( st.type == CFILE_TYPE_REGULAR && file->fd != -1 ) {
+                long ret;
                 kv_item *header = kvlist_new_item( HTTP_HEADER_CONTENT_TYPE, req_info->mimetype );
+                char etag[64], last_modified[32];
+                const int not_modified = _webthread_not_modified( req_info, _webthread_etag( etag, &st, NULL ),
+                                                                  sizeof(etag), st.mtime );
+                http_range_t ranges[MAX_RANGES];
+                /* last_modified is set by the range check, unless the reply is 304 */
+                const int range_count = not_modified ? -1
+                        : _webthread_ranges( req_info, &st, etag, http_time( last_modified, st.mtime ), ranges );
+                const char *encoding = NULL;
+                file_cache_entry_t *variant = (!not_modified && range_count < 0)
+                                            ? _webthread_precompressed( args, req_info, &st, &encoding ) : NULL;
+                /* files that might be sent compressed are negotiated by the
+                 * Accept-Encoding field, caches have to know that */
+                const int negotiated = (req_info->mt_flags & MIMETYPE_FLAG_COMPRESSABLE)
+                                     && (pSettings->precompressed || pSettings->deflate);
                 /* with deflate support we compress static data of certain types */
                 #if DEFLATE_SUPPORT
                 const char *client_ae;
-                if( pSettings->deflate &&  /* check if deflate is on in settings */
+                const int deflate = pSettings->deflate &&  /* check if deflate is on in settings */
                     (req_info->mt_flags & MIMETYPE_FLAG_COMPRESSABLE) &&  /* check mimetype flags.. */
                     (client_ae = kvlist_get_value_from_key(HTTP_HEADER_ACCEPT_ENCODING, req_info->header_info))
-                      && strstr(client_ae,"deflate") ) /* and check if client accepts deflate encoding */
-                {
+                      && strstr(client_ae,"deflate"); /* and check if client accepts deflate encoding */
+                #endif
+
+                if( negotiated )
+                    header = kvlist_new_item_push_front( HTTP_HEADER_VARY, HTTP_HEADER_ACCEPT_ENCODING, header );
+                if( not_modified ) {
+                    /* the client has the current version already */
+                    kv_item *validators = kvlist_new_item( HTTP_HEADER_ETAG, etag );
+                    validators = kvlist_new_item_push_front( HTTP_HEADER_LAST_MODIFIED,
+                                                             http_time( last_modified, st.mtime ), validators );
+                    validators = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
+                                       "max-age=" STR(STATIC_CACHE_AGE_MAX), validators );
+                    if( negotiated )
+                        validators = kvlist_new_item_push_front( HTTP_HEADER_VARY, HTTP_HEADER_ACCEPT_ENCODING,
+                                                                 validators );
+                    send_buffer_http_header( args->sendbuf, HTTP_STATUS_NOT_MODIFIED, validators, req_info->http_version );
+                    kvlist_free( validators );
+                } else if( range_count >= 0 ) {
+                    /* byte range request, ranges are always served from the file itself */
+                    _webthread_send_ranges( args, req_info, file->fd, &st, etag, last_modified,
+                                            negotiated, ranges, range_count );
+                } else if( variant ) {
+                    /* precompressed file, sent as it is with the type of the original */
+                    header = kvlist_new_item_push_front( HTTP_HEADER_LAST_MODIFIED, last_modified, header );
+                    header = kvlist_new_item_push_front( HTTP_HEADER_ETAG, _webthread_etag( etag, &st, encoding ), header );
+                    header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_ENCODING, encoding, header );
+                    sprintf( small_string_buf, OFFT_FMT, OFFT_FMT_CAST variant->st.size );
+                    header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, small_string_buf, header );
+                    header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
+                                       "max-age=" STR(STATIC_CACHE_AGE_MAX), header );
+                    send_buffer_http_header( args->sendbuf, HTTP_STATUS_OK, header, req_info->http_version );
+                    if( !send_buffer_file( args->sendbuf, variant->fd, 0, variant->st.size ) )
+                        LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+                    if( !send_buffer_hold( args->sendbuf, _webthread_release_file, args->pDataFileCache, variant ) )
+                        file_cache_release( args->pDataFileCache, variant );
+                } else
+                #if DEFLATE_SUPPORT
+                if( deflate && _webthread_send_deflated( args, req_info, file->fd, &st, last_modified ) ) {
+                    /* compressed only once, sent with its exact length */
+                } else if( deflate ) {
                     z_stream stream;
+                    off_t infile_offset = 0;
                     size_t infile_remaining = st.size;
                     unsigned char deflate_buf[DEFLATE_BUFSIZE];
 
+                    header = kvlist_new_item_push_front( HTTP_HEADER_LAST_MODIFIED, last_modified, header );
+                    header = kvlist_new_item_push_front( HTTP_HEADER_ETAG, _webthread_etag( etag, &st, "deflate" ), header );
                     header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_ENCODING, "deflate", header );
                     /* Static content can and should be cached by browsers or proxies. */
                     header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
@@ -336,9 +765,18 @@ CTHREAD_RET webthread(CTHREAD_ARG data)
                     memset( &stream, 0, sizeof(stream) );
                     stream.next_in = deflate_buf;
                     stream.avail_in = 0;
-                    stream.next_out = (unsigned char*)send_buffer;
-                    stream.avail_out = SENDBUF_SIZE;
+                    stream.next_out = (unsigned char*)args->sendbuf->buf;
+                    stream.avail_out = (unsigned int)args->sendbuf->bufsize;
 
+                    if( block_deflate_parallel( args->pDataBlockDeflate, st.size ) ) {
+                        /* large files are compressed in blocks by the compression threads */
+                        if( req_info->http_version == HTTP_VERSION_1_1 ) args->sendbuf->flags |= SBF_CHUNKED;
+                        send_buffer_http_header( args->sendbuf, HTTP_STATUS_OK, header, req_info->http_version );
+                        if( !(args->sendbuf->flags & SBF_NO_BODY)
+                            && !block_deflate_file( args->pDataBlockDeflate, file->fd, st.size,
+                                                    _webthread_send_block, args->sendbuf ) )
+                            LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+                    } else
                     /* Compression. (use init that does not sent zlib headers (IE can't handle it) */
                     if( mz_deflateInitwoHeader(&stream, pSettings->deflate) != Z_OK ) {
                         LOG( log_ERROR, "deflateInit() failed!\n" );
@@ -350,18 +788,20 @@ CTHREAD_RET webthread(CTHREAD_ARG data)
                         if( req_info->http_version == HTTP_VERSION_1_1 ) args->sendbuf->flags |= SBF_CHUNKED;
                         send_buffer_http_header( args->sendbuf, HTTP_STATUS_OK, header, req_info->http_version );
                         send_buffer_flush( args->sendbuf );
-                        for( ; ; ) {
+                        while( !(args->sendbuf->flags & SBF_NO_BODY) ) {
                             if( !stream.avail_in ) {
                                 /* Input buffer is empty, so read more bytes from input file. */
                                 int p = 0;
-                                /* read data until we have WTBUFSIZE bytes or ret = 0 */
+                                /* read data until the buffer is full or the file ends */
                                 while( p < sizeof(deflate_buf) &&
-                                        (ret = (int)fread( &deflate_buf[p], 1, sizeof(deflate_buf), pFile)) ) {
+                                        (ret = cfile_pread( file->fd, &deflate_buf[p], sizeof(deflate_buf) - p,
+                                                            infile_offset )) > 0 ) {
                                     p += ret;
+                                    infile_offset += ret;
                                 }
                                 stream.next_in = deflate_buf;
                                 stream.avail_in = p;
-                                infile_remaining -= p;
+                                infile_remaining = p ? infile_remaining - p : 0;
                             }
 
                             status = mz_deflate( &stream, infile_remaining ? Z_NO_FLUSH : Z_FINISH );
@@ -369,10 +809,10 @@ CTHREAD_RET webthread(CTHREAD_ARG data)
                             if( (status == Z_STREAM_END) || (!stream.avail_out) ) {
                                 /* Output buffer is full, or compression is done
                                  * -> write buffer to output file. */
-                                args->sendbuf->curpos = SENDBUF_SIZE - stream.avail_out;
+                                args->sendbuf->curpos = args->sendbuf->bufsize - stream.avail_out;
                                 send_buffer_flush( args->sendbuf );
-                                stream.next_out = (unsigned char*)send_buffer;
-                                stream.avail_out = SENDBUF_SIZE;
+                                stream.next_out = (unsigned char*)args->sendbuf->buf;
+                                stream.avail_out = (unsigned int)args->sendbuf->bufsize;
                             }
 
                             if (status == Z_STREAM_END)
@@ -390,34 +830,342 @@ CTHREAD_RET webthread(CTHREAD_ARG data)
                 } else
                 #endif
                 {
-                    sprintf( small_string_buf, OFFT_FMT, OFFT_FMT_CAST st.size );
-                    header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, small_string_buf, header );
-                    /* Static content can and should be cached by browsers or proxies. */
-                    header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
-                                       "max-age=" STR(STATIC_CACHE_AGE_MAX), header );
-                    send_http_header( args->fd, HTTP_STATUS_OK, header, req_info->http_version );
-                    while ( (ret = (int)fread(send_buffer, 1, SENDBUF_SIZE, pFile)) ) {
-                            ret = send( args->fd, send_buffer, ret, 0 );
+                    if( content_cache_fits( args->pDataContentCache, st.size ) ) {
+                        /* small files are served from memory */
+                        content_cache_entry_t *cached = content_cache_get( args->pDataContentCache,
+                                                            req_info->filename, st.mtime, st.size );
+                        if( !cached && !(args->sendbuf->flags & SBF_HEAD) && strlen( req_info->mimetype ) < 128 ) {
+                            char fields[512];
+                            const int fields_len = sprintf( fields,
+                                    ASCII_CRLF HTTP_HEADER_ACCEPT_RANGES ": bytes"
+                                    ASCII_CRLF HTTP_HEADER_CACHE_CONTROL ": max-age=" STR(STATIC_CACHE_AGE_MAX)
+                                    ASCII_CRLF HTTP_HEADER_CONTENT_LENGTH ": " OFFT_FMT
+                                    ASCII_CRLF HTTP_HEADER_CONTENT_TYPE ": %s"
+                                    ASCII_CRLF HTTP_HEADER_ETAG ": %s"
+                                    ASCII_CRLF HTTP_HEADER_LAST_MODIFIED ": %s%s",
+                                    OFFT_FMT_CAST st.size, req_info->mimetype, etag, last_modified,
+                                    negotiated ? ASCII_CRLF HTTP_HEADER_VARY ": " HTTP_HEADER_ACCEPT_ENCODING : "" );
+                            if( fields_len > 0 )
+                                cached = content_cache_add( args->pDataContentCache, req_info->filename,
+                                                            file->fd, st.mtime, st.size, fields, fields_len );
+                        }
+                        if( cached ) {
+                            _webthread_send_cached( args, req_info, args->pDataContentCache, cached );
+                            kvlist_free( header );
+                            header = NULL;
+                        }
+                    }
+                    if( header ) {
+                        sprintf( small_string_buf, OFFT_FMT, OFFT_FMT_CAST st.size );
+                        header = kvlist_new_item_push_front( HTTP_HEADER_CONTENT_LENGTH, small_string_buf, header );
+                        /* Static content can and should be cached by browsers or proxies. */
+                        header = kvlist_new_item_push_front( HTTP_HEADER_CACHE_CONTROL,
+                                           "max-age=" STR(STATIC_CACHE_AGE_MAX), header );
+                        header = kvlist_new_item_push_front( HTTP_HEADER_ACCEPT_RANGES, "bytes", header );
+                        header = kvlist_new_item_push_front( HTTP_HEADER_ETAG, etag, header );
+                        header = kvlist_new_item_push_front( HTTP_HEADER_LAST_MODIFIED, last_modified, header );
+                        send_buffer_http_header( args->sendbuf, HTTP_STATUS_OK, header, req_info->http_version );
+                        if( args->sendbuf->flags & SBF_NO_BODY ) {
+                            /* HEAD request */
+                        } else if( (size_t)st.size <= args->sendbuf->bufsize - args->sendbuf->curpos ) {
+                            /* small files go out together with the header */
+                            off_t offset = 0;
+                            while( offset < st.size &&
+                                   (ret = cfile_pread( file->fd, &args->sendbuf->buf[args->sendbuf->curpos],
+                                                       (size_t)(st.size - offset), offset )) > 0 ) {
+                                args->sendbuf->curpos += ret;
+                                offset += ret;
+                            }
+                        } else if( !send_buffer_file( args->sendbuf, file->fd, 0, st.size ) ) {
+                            LOG( log_WARNING, "sending file '%s' failed", req_info->filename );
+                        }
                     }
                 }
                 kvlist_free( header );
-                fclose( pFile );
             }
             else
                 send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_FORBIDDEN, req_info->http_version );
         }
         else
             send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_NOT_FOUND, req_info->http_version );
+        /* a file that is sent by the event loop is released afterwards */
+        if( !file || !send_buffer_hold( args->sendbuf, _webthread_release_file, args->pDataFileCache, file ) )
+            file_cache_release( args->pDataFileCache, file );
+    }
+}
+
+/* Finishes a request that was answered, returns non-zero if the
+ * connection can be kept alive */
+static int _webthread_finish( thread_arg_t *args, http_req_info_t *req_info, const int rclass )
+{
+    /* chunked replies are terminated right away, others might still
+     * be collected with the replies of following pipelined requests */
+    if( args->sendbuf->flags & SBF_CHUNKED )
+        send_buffer_flush_last( args->sendbuf );
+    free_req_info( req_info );
+    _webthread_release( (webthread_pool_t*)args->pDataSrvThreads, rclass );
+    return args->sendbuf->flags & SBF_KEEP_ALIVE;
+}
+
+/* Returns 1 if a static file request might have to wait for the file system,
+ * i.e. the file lookup or the content of the file is not in memory. Missing
+ * files whose lookup is cached are answered right away. Precompressed variants
+ * are not considered, their lookups are cached like any other. */
+static int _webthread_needs_io( thread_arg_t *args, http_req_info_t *req_info )
+{
+    server_settings_t *pSettings = (server_settings_t*)args->pSettings;
+    file_cache_entry_t *file;
+    int needs_io = 1;
+
+    if( !pSettings->wwwroot ) return 0;
+    if( !(file = file_cache_peek( args->pDataFileCache, req_info->filename )) ) return 1;
+
+    if( file->status != CFILE_SUCCESS )
+        needs_io = 0;
+    else if( file->st.type == CFILE_TYPE_REGULAR && file->fd != -1 ) {
+        needs_io = !content_cache_contains( args->pDataContentCache, req_info->filename,
+                                            file->st.mtime, file->st.size );
+        #if DEFLATE_SUPPORT
+        if( needs_io && pSettings->deflate && (req_info->mt_flags & MIMETYPE_FLAG_COMPRESSABLE) ) {
+            const char *client_ae = kvlist_get_value_from_key( HTTP_HEADER_ACCEPT_ENCODING,
+                                                               req_info->header_info );
+            needs_io = !(client_ae && strstr( client_ae, "deflate" )
+                         && content_cache_contains( args->pDataDeflateCache, req_info->filename,
+                                                    file->st.mtime, file->st.size ));
+        }
+        #endif
     }
+    file_cache_release( args->pDataFileCache, file );
+    return needs_io;
+}
+
+/* Hands a request over to the workers of another pool, replies to earlier
+ * pipelined requests go out first. Returns 0 if the queue of the pool is full. */
+static int _webthread_hand_over( c_pool *workers, thread_arg_t *args,
+                                 http_req_info_t *req_info, const int rclass )
+{
+    send_buffer_flush( args->sendbuf );
+    args->request = req_info;
+    args->reply_flags = args->sendbuf->flags;
+    args->request_class = rclass;
+    if( cthread_pool_push( workers, args ) )
+        return 1;
+    args->request = NULL;
+    return 0;
+}
+
+/* Reads and answers a single request of a client connection. Replies are
+ * collected in the send buffer, it is up to the caller to flush it. Returns
+ * the request read status, keep_alive is set if the connection can be reused.
+ * Lua pages are handed over to the script workers and static files that are
+ * not in memory to the i/o workers, unless the request was handed over before. */
+static int _webthread_request( thread_arg_t *args, send_buffer_t *sendbuf,
+                               char *recv_buffer, const size_t recv_bufsize,
+                               const int handed_over, int *keep_alive )
+{
+    int ret_val = 0;                    /* request read status, 0 = SUCCESS */
+    int srv_cmd = 0;
+    int rclass = REQUEST_CLASS_NONE;    /* admitted request class */
+    cresource_t *efile = NULL;          /* requested embedded resource */
+
+    http_req_info_t *req_info = NULL;
+    server_settings_t *pSettings = (server_settings_t*)args->pSettings;
+    webthread_pool_t *pool = (webthread_pool_t*)args->pDataSrvThreads;
+
+    *keep_alive = 0;
+    ++args->requests;
+
+    req_info = http_request_read( args, REQ_FILL_ALL, &ret_val, recv_buffer, recv_bufsize );
+
+    if( ret_val == RRT_CONNECTION_CLOSED ) {
+        /* client closed an idle connection, nothing to reply */
+        free_req_info( req_info );
+        return ret_val;
+    }
+
+    if( ret_val != RRT_OKAY ) {
+        /* try to read (and ignore) the rest of post request data */
+        if( req_info->post_info ) {
+            if( req_info->post_info->content_length )
+                http_request_recv_post_and_throw_away( args, req_info, recv_buffer, recv_bufsize );
+            else
+                http_request_recv_until_timeout_or_error( args, recv_buffer, recv_bufsize );
+        }
+    }
+
+    /* the request is received, processing and replying takes as long as it takes */
+    event_loop_deadline( args, EVENT_DEADLINE_NONE );
+
+    /* reset the reply flags, pending replies of earlier requests stay in the buffer */
+    sendbuf->flags = (req_info->req_method == REQUEST_HEAD) ? SBF_HEAD : SBF_NONE;
+    args->sendbuf = sendbuf;
+
+    /* keep the connection open for the next request if the client wants it,
+     * the request limit is not reached and a request body was read completely */
+    if( ret_val == RRT_OKAY && req_info->keep_alive && pSettings->keepalive_timeout
+        && args->requests < pSettings->keepalive_max_requests
+        && (!req_info->post_info
+            || (!(req_info->post_info->flags & REQ_POST_FLAG_TE_CHUNKED)
+                && req_info->post_info->bytes_read == req_info->post_info->content_length)) )
+        sendbuf->flags |= SBF_KEEP_ALIVE;
+
+    /* the body of the last reply on the connection is sent by the event
+     * loop, together with the rest of the replies */
+    if( !(sendbuf->flags & SBF_KEEP_ALIVE) || !http_request_pending( args ) )
+        sendbuf->flags |= SBF_DEFER;
+
+    /* reply on errors */
+    if( ret_val != RRT_OKAY ) {
+        switch( ret_val ) {
+        case RRT_ALLOCATION_ERROR:
+            LOG_FILE( log_ERROR, "Memory allocation error while reading request" );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_INTERNAL_SERVER_ERROR, req_info->http_version );
+            break;
+        case RRT_MISSING_CONTENT_LENGTH:
+            LOG_FILE( log_WARNING, "Request is missing required content length" );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_LENGTH_REQUIRED, req_info->http_version );
+            break;
+        case RRT_FORM_FIELD_SIZE_EXCEEDED:
+            LOG_FILE( log_WARNING, "Form field size exceeded." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_ENT_TOO_LARGE, req_info->http_version );
+            break;
+        case RRT_SOCKET_TIMEOUT:
+            LOG_FILE( log_WARNING, "Timeout during reading request." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_TIMEOUT, req_info->http_version );
+            break;
+        case RRT_HEADER_LINE_SIZE_EXCEEDED:
+            LOG_FILE( log_WARNING, "Request-URI Too Long." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_REQUEST_URI_TOO_LONG, req_info->http_version );
+            break;
+        case RRT_TOO_MANY_HEADER_FIELDS:
+            LOG_FILE( log_WARNING, "Too many header fields in request." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_HEADER_FIELDS_TOO_LARGE, req_info->http_version );
+            break;
+        case RRT_MALFORMED_REQUEST:
+            LOG_FILE( log_WARNING, "Malformed http request." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_BAD_REQUEST, req_info->http_version );
+            break;
+        default:
+            LOG_FILE( log_ERROR, "Error during reading http request." );
+            send_buffer_error_info( args->sendbuf, req_info->filename, HTTP_STATUS_INTERNAL_SERVER_ERROR, req_info->http_version );
+            break;
+        }
+        goto clean_up_thread;
+    }
+
+    /* check if request type is supported */
+    switch( req_info->req_method ) {
+    case REQUEST_GET:
+    case REQUEST_POST:
+    case REQUEST_HEAD:
+        /* only GET, POST and HEAD are currently supported */
+        break;
+    default: {
+        const char *req_method_str = http_request_type_to_str(req_info->req_method);
+        const kv_item header = {HTTP_HEADER_CONTENT_LENGTH, "0", 0};
+        send_buffer_http_header( args->sendbuf, HTTP_STATUS_METHOD_NOT_ALLOWED, &header, req_info->http_version );
+        LOG_FILE( log_ERROR, "Request type '%s' not supported (%d).", 
+                             req_method_str ? req_method_str : "UNKNOWN", req_info->req_method );
+        goto clean_up_thread;
+        break;
+        }
+    }
+
+    /* check if request addresses a built in server command, other
+     * requests have to be admitted to their class first */
+    if( !(srv_cmd = is_server_command(args->pDataSrvCmds, req_info->filename)) ) {
+        #if LUA_SUPPORT
+        if( pSettings->scripting.enabled && req_info->scripting == SSS_LUA )
+            rclass = REQUEST_CLASS_LUA;
+        else
+        #endif
+        /* look for filename in embedded resources if not disabled */
+        if( !pSettings->disable_er && (efile = webthread_get_resource( args, req_info->filename )) )
+            rclass = REQUEST_CLASS_EMBEDDED;
+        else
+            rclass = REQUEST_CLASS_STATIC;
+        if( !_webthread_admit( pool, rclass ) ) {
+            LOG( log_WARNING, "%s request limit reached, rejecting request (hit %lu)",
+                 _request_class_names[rclass], (unsigned long)args->hit );
+            rclass = REQUEST_CLASS_NONE;
+            _webthread_overloaded( pool, args->sendbuf, req_info->http_version );
+            goto clean_up_thread;
+        }
+    }
+
+    #if LUA_SUPPORT
+    /* lua pages are answered by the script workers, which frees this worker
+     * for static requests */
+    if( rclass == REQUEST_CLASS_LUA && !handed_over && pool->script.num_workers ) {
+        if( _webthread_hand_over( &pool->script, args, req_info, rclass ) )
+            return REQUEST_HANDED_OVER;
+        LOG( log_WARNING, "script queue full, rejecting request (hit %lu)", (unsigned long)args->hit );
+        _webthread_overloaded( pool, args->sendbuf, req_info->http_version );
+        goto clean_up_thread;
+    }
+    #endif
+
+    /* static files that are not in memory are answered by the i/o workers,
+     * so that slow storage never holds up requests that are served from memory */
+    if( rclass == REQUEST_CLASS_STATIC && !handed_over && pool->io.num_workers
+        && _webthread_needs_io( args, req_info ) ) {
+        if( _webthread_hand_over( &pool->io, args, req_info, rclass ) )
+            return REQUEST_HANDED_OVER;
+        LOG( log_WARNING, "i/o queue full, rejecting request (hit %lu)", (unsigned long)args->hit );
+        _webthread_overloaded( pool, args->sendbuf, req_info->http_version );
+        goto clean_up_thread;
+    }
+
+    _webthread_reply( args, req_info, srv_cmd, efile );
 
     /* ---------------------------------------------- */
     clean_up_thread:
     /* ---------------------------------------------- */
-    send_buffer_flush_last( args->sendbuf );
-    closesocket(args->fd);
-    free_req_info(req_info);
-    unregister_thread(args);
-    free_thread_arg(args);
+    *keep_alive = _webthread_finish( args, req_info, rclass );
+
+    return ret_val;
+}
 
-    return (CTHREAD_RETURN) (long) ret_val;
+/* Answers the requests on a readable client connection. Script and i/o
+ * workers start with the request that was handed over to them. */
+static int _webthread_serve( thread_arg_t *args, http_req_info_t *req_info )
+{
+    char send_buffer[SENDBUF_SIZE];     /* Request send buffer memory */
+    char recv_buffer[SENDBUF_SIZE];     /* Request receive buffer memory */
+    send_buffer_t sendbuf;              /* send buffer object */
+    int ret_val = RRT_OKAY, keep_alive;
+    const int handed_over = (req_info != NULL);
+
+    send_buffer_init( &sendbuf, args->fd, send_buffer, SENDBUF_SIZE, SBF_NONE );
+
+    if( req_info ) {
+        sendbuf.flags = args->reply_flags;
+        args->sendbuf = &sendbuf;
+        _webthread_reply( args, req_info, 0, NULL );
+        keep_alive = _webthread_finish( args, req_info, args->request_class );
+    }
+    else
+        ret_val = _webthread_request( args, &sendbuf, recv_buffer, sizeof(recv_buffer), 0, &keep_alive );
+
+    /* answer pipelined requests in order, their replies are sent
+     * together once no more complete requests are pending */
+    while( ret_val != REQUEST_HANDED_OVER && keep_alive && http_request_pending( args ) )
+        ret_val = _webthread_request( args, &sendbuf, recv_buffer, sizeof(recv_buffer),
+                                      handed_over, &keep_alive );
+
+    /* the connection belongs to another worker now */
+    if( ret_val == REQUEST_HANDED_OVER )
+        return RRT_OKAY;
+
+    /* the event loop sends the rest and watches or closes the connection,
+     * it must not be used here afterwards */
+    event_loop_reply( args->pDataEventLoop, args, &sendbuf, keep_alive );
+
+    return ret_val;
+}
+
+/* Handles the requests on a readable client connection */
+int webthread( thread_arg_t *args )
+{
+    return _webthread_serve( args, NULL );
 }
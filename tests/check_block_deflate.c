@@ -0,0 +1,148 @@
+/*
+ * check_block_deflate.c
+ *  parallel block deflate TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "../src/miniz.c"
+
+#include "block_deflate.h"
+#include "cfile.h"
+
+#define BLOCK_SIZE (32 * 1024)
+#define FILE_SIZE (10 * BLOCK_SIZE + 1234)
+
+static char path[64];
+static char *content;
+
+typedef struct {
+    char *data;
+    size_t len;
+    int calls_left;     /* the writer fails once this reaches 0 */
+} output_t;
+
+static int _write( void *ctx, const char *data, size_t len )
+{
+    output_t *out = (output_t*)ctx;
+    if( !out->calls_left-- ) return 0;
+    out->data = (char*)realloc( out->data, out->len + len );
+    memcpy( out->data + out->len, data, len );
+    out->len += len;
+    return 1;
+}
+
+/* compress the test file and check that it inflates to the original content */
+static void _check_roundtrip( void *bd, off_t size )
+{
+    output_t out = { NULL, 0, -1 };
+    size_t inflated_len = 0;
+    void *inflated;
+    int fd = cfile_open_read( path );
+
+    ck_assert(fd != -1);
+    ck_assert(block_deflate_file( bd, fd, size, _write, &out ) == 1);
+    inflated = tinfl_decompress_mem_to_heap( out.data, out.len, &inflated_len, 0 );
+    ck_assert(inflated != NULL);
+    ck_assert(inflated_len == (size_t)size && memcmp( inflated, content, (size_t)size ) == 0);
+    ck_assert(out.len < (size_t)size / 2);
+    free( inflated );
+    free( out.data );
+    cfile_close( fd );
+}
+
+static void setup( void )
+{
+    FILE *f;
+    int i, fd;
+    strcpy( path, "/tmp/check_block_deflate_XXXXXX" );
+    ck_assert((fd = mkstemp( path )) != -1);
+    close( fd );
+    content = (char*)malloc( FILE_SIZE );
+    srand( 1 );
+    for( i = 0; i < FILE_SIZE; ++i )
+        content[i] = "cranberry server "[(i % 17 + (rand() % 64 == 0)) % 17];
+    f = fopen( path, "wb" );
+    ck_assert(f != NULL);
+    ck_assert(fwrite( content, 1, FILE_SIZE, f ) == FILE_SIZE);
+    fclose( f );
+}
+
+static void teardown( void )
+{
+    unlink( path );
+    free( content );
+}
+
+/* The concatenated blocks form one raw deflate stream */
+START_TEST (block_deflate_roundtrip)
+{
+    void *bd = block_deflate_init( 3, 6, BLOCK_SIZE );
+    ck_assert(bd != NULL);
+    ck_assert(block_deflate_parallel( bd, FILE_SIZE ));
+    ck_assert(!block_deflate_parallel( bd, BLOCK_SIZE ));
+    _check_roundtrip( bd, FILE_SIZE );
+    /* the last block is a full block */
+    _check_roundtrip( bd, 8 * BLOCK_SIZE );
+    block_deflate_free( bd );
+
+    /* without threads the blocks are compressed by the caller */
+    bd = block_deflate_init( 0, 1, BLOCK_SIZE );
+    ck_assert(bd != NULL && !block_deflate_parallel( bd, FILE_SIZE ));
+    _check_roundtrip( bd, FILE_SIZE );
+    block_deflate_free( bd );
+}
+END_TEST
+
+/* Errors of the writer and files that are shorter than expected stop the compression */
+START_TEST (block_deflate_errors)
+{
+    void *bd = block_deflate_init( 2, 6, BLOCK_SIZE );
+    output_t out = { NULL, 0, 3 };
+    int fd = cfile_open_read( path );
+
+    ck_assert(block_deflate_file( bd, fd, FILE_SIZE, _write, &out ) == 0);
+    free( out.data );
+    out.data = NULL;
+    out.calls_left = -1;
+    ck_assert(block_deflate_file( bd, fd, FILE_SIZE + BLOCK_SIZE, _write, &out ) == 0);
+    free( out.data );
+    cfile_close( fd );
+    block_deflate_free( bd );
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *block_deflate_test_suite( void )
+{
+    Suite *s = suite_create ("BlockDeflate");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test (tc_core, block_deflate_roundtrip);
+    tcase_add_test (tc_core, block_deflate_errors);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = block_deflate_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
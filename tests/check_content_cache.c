@@ -0,0 +1,164 @@
+/*
+ * check_content_cache.c
+ *  content cache TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfile.h"
+#include "content_cache.h"
+
+#define NUM_FILES 64
+#define FILE_SIZE 1024
+
+static char tmpdir[64];
+
+static void _path( char *buf, int i )
+{
+    sprintf( buf, "%s/file%d.txt", tmpdir, i );
+}
+
+static void setup( void )
+{
+    char path[128], content[FILE_SIZE];
+    int i;
+    strcpy( tmpdir, "/tmp/check_content_cache_XXXXXX" );
+    ck_assert(mkdtemp( tmpdir ) != NULL);
+    for( i = 0; i < NUM_FILES; ++i ) {
+        FILE *f;
+        _path( path, i );
+        memset( content, 'a' + i % 26, sizeof(content) );
+        ck_assert((f = fopen( path, "wb" )) != NULL);
+        fwrite( content, 1, sizeof(content), f );
+        fclose( f );
+    }
+}
+
+static void teardown( void )
+{
+    char path[128];
+    int i;
+    for( i = 0; i < NUM_FILES; ++i ) {
+        _path( path, i );
+        unlink( path );
+    }
+    rmdir( tmpdir );
+}
+
+static content_cache_entry_t * _add( void *cache, int i, time_t mtime )
+{
+    content_cache_entry_t *entry;
+    char path[128];
+    int fd;
+    _path( path, i );
+    ck_assert((fd = cfile_open_read( path )) != -1);
+    entry = content_cache_add( cache, path, fd, mtime, FILE_SIZE, "\r\nX: y", 6 );
+    cfile_close( fd );
+    return entry;
+}
+
+/* Cached content is returned as long as modification time and size match */
+START_TEST (content_cache_hit_and_revalidate)
+{
+    void *cache = content_cache_init( 1024 * 1024, 4096 );
+    content_cache_entry_t *a, *b;
+    char path[128];
+
+    ck_assert(cache != NULL);
+    _path( path, 1 );
+    ck_assert(content_cache_get( cache, path, 100, FILE_SIZE ) == NULL);
+    a = _add( cache, 1, 100 );
+    ck_assert(a != NULL && a->size == FILE_SIZE && a->data[FILE_SIZE-1] == 'b');
+    ck_assert(a->fields_len == 6 && memcmp( a->fields, "\r\nX: y", 6 ) == 0);
+    b = content_cache_get( cache, path, 100, FILE_SIZE );
+    ck_assert(a == b);
+    content_cache_release( cache, b );
+    ck_assert(content_cache_contains( cache, path, 100, FILE_SIZE ));
+    ck_assert(!content_cache_contains( cache, path, 101, FILE_SIZE ));
+
+    /* a modified file is dropped, the old content stays valid for its user */
+    ck_assert(content_cache_get( cache, path, 101, FILE_SIZE ) == NULL);
+    ck_assert(content_cache_get( cache, path, 100, FILE_SIZE ) == NULL);
+    ck_assert(a->data[0] == 'b');
+    content_cache_release( cache, a );
+
+    /* content made from a file is revalidated against the file */
+    a = content_cache_put( cache, path, 100, FILE_SIZE, "", 0, "compressed", 10 );
+    ck_assert(a != NULL && a->size == 10 && a->file_size == FILE_SIZE);
+    b = content_cache_get( cache, path, 100, FILE_SIZE );
+    ck_assert(a == b && memcmp( b->data, "compressed", 10 ) == 0);
+    content_cache_release( cache, b );
+    ck_assert(content_cache_get( cache, path, 100, 10 ) == NULL);
+    content_cache_release( cache, a );
+
+    /* too large files are not cached */
+    ck_assert(!content_cache_fits( cache, 4097 ));
+    content_cache_free( cache );
+}
+END_TEST
+
+/* The cached content never exceeds the memory limit, disabled caches don't cache */
+START_TEST (content_cache_bounds)
+{
+    /* 16 stripes with room for 2 files each */
+    void *cache = content_cache_init( 32 * FILE_SIZE, FILE_SIZE );
+    content_cache_entry_t *entry;
+    char path[128];
+    int i, cached = 0;
+
+    for( i = 0; i < NUM_FILES; ++i ) {
+        entry = _add( cache, i, 100 );
+        ck_assert(entry != NULL && entry->data[0] == 'a' + i % 26);
+        content_cache_release( cache, entry );
+    }
+    for( i = 0; i < NUM_FILES; ++i ) {
+        _path( path, i );
+        if( (entry = content_cache_get( cache, path, 100, FILE_SIZE )) ) {
+            ++cached;
+            content_cache_release( cache, entry );
+        }
+    }
+    ck_assert(cached > 0 && cached <= 32);
+    content_cache_free( cache );
+
+    cache = content_cache_init( 0, FILE_SIZE );
+    ck_assert(cache != NULL);
+    ck_assert(!content_cache_fits( cache, 0 ));
+    ck_assert(_add( cache, 0, 100 ) == NULL);
+    content_cache_free( cache );
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *content_cache_test_suite( void )
+{
+    Suite *s = suite_create ("ContentCache");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test (tc_core, content_cache_hit_and_revalidate);
+    tcase_add_test (tc_core, content_cache_bounds);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = content_cache_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
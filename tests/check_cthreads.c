@@ -21,6 +21,9 @@
 #define SEMAPHORE_INIT_VALUE 10
 #define INITIAL_PROTECTED_DATA_VALUE 268435455
 #define RWTEST_MAX_READER 9
+#define RING_CAPACITY 100
+#define RING_THREADS 4
+#define RING_ITEMS_PER_THREAD 20000
 
 typedef struct {
     int id;
@@ -211,6 +214,200 @@ START_TEST(cthread_sleep_test)
 }
 END_TEST
 
+START_TEST (cthread_ring_basic)
+{
+    c_ring ring; size_t i;
+    size_t values[128];
+
+    ck_assert(cthread_ring_init( &ring, RING_CAPACITY ));
+    /* capacity is rounded up to the next power of two */
+    ck_assert(cthread_ring_capacity( &ring ) == 128);
+    ck_assert(cthread_ring_pop( &ring ) == NULL);
+
+    for( i = 0; i < 128; ++i ) {
+        values[i] = i;
+        ck_assert(cthread_ring_push( &ring, &values[i] ));
+    }
+    /* full */
+    ck_assert(cthread_ring_push( &ring, &values[0] ) == 0);
+
+    /* first in, first out */
+    for( i = 0; i < 128; ++i ) {
+        ck_assert(cthread_ring_pop( &ring ) == &values[i]);
+    }
+    ck_assert(cthread_ring_pop( &ring ) == NULL);
+
+    /* wrap around */
+    for( i = 0; i < 1000; ++i ) {
+        ck_assert(cthread_ring_push( &ring, &values[i % 128] ));
+        ck_assert(cthread_ring_pop( &ring ) == &values[i % 128]);
+    }
+    ck_assert(cthread_ring_pop( &ring ) == NULL);
+    cthread_ring_destroy( &ring );
+}
+END_TEST
+
+typedef struct {
+    c_ring *ring;
+    size_t sum;
+} ring_thread_data;
+
+CTHREAD_RET ring_producer(CTHREAD_ARG data)
+{
+    ring_thread_data *mydata = (ring_thread_data*) data;
+    size_t i;
+    for( i = 1; i <= RING_ITEMS_PER_THREAD; ++i ) {
+        while( !cthread_ring_push( mydata->ring, (void*)i ) )
+            cthread_sleep( 1 ); /* full, give the consumers some time */
+        mydata->sum += i;
+    }
+    return (CTHREAD_RET) 0;
+}
+
+CTHREAD_RET ring_consumer(CTHREAD_ARG data)
+{
+    ring_thread_data *mydata = (ring_thread_data*) data;
+    size_t i;
+    void *item;
+    for( i = 0; i < RING_ITEMS_PER_THREAD; ++i ) {
+        while( !(item = cthread_ring_pop( mydata->ring )) )
+            cthread_sleep( 1 ); /* empty, give the producers some time */
+        mydata->sum += (size_t)item;
+    }
+    return (CTHREAD_RET) 0;
+}
+
+START_TEST (cthread_ring_threads)
+{
+    c_ring ring; int i;
+    c_thread producers[RING_THREADS], consumers[RING_THREADS];
+    ring_thread_data pdata[RING_THREADS], cdata[RING_THREADS];
+    size_t produced = 0, consumed = 0;
+
+    ck_assert(cthread_ring_init( &ring, 16 ));
+    for( i = 0; i < RING_THREADS; ++i ) {
+        pdata[i].ring = cdata[i].ring = &ring;
+        pdata[i].sum = cdata[i].sum = 0;
+        ck_assert(cthread_create( &consumers[i], ring_consumer, &cdata[i] ));
+        ck_assert(cthread_create( &producers[i], ring_producer, &pdata[i] ));
+    }
+    for( i = 0; i < RING_THREADS; ++i ) {
+        ck_assert(cthread_join( &producers[i] ));
+        ck_assert(cthread_join( &consumers[i] ));
+        produced += pdata[i].sum;
+        consumed += cdata[i].sum;
+    }
+    /* every item was consumed exactly once */
+    ck_assert(produced == consumed);
+    ck_assert(cthread_ring_pop( &ring ) == NULL);
+    cthread_ring_destroy( &ring );
+}
+END_TEST
+
+START_TEST (cthread_affinity_test)
+{
+    c_thread self = cthread_self();
+    const unsigned int count = cthread_cpu_count();
+    unsigned int *cpus = (unsigned int*)malloc( count * sizeof(unsigned int) ), i, first;
+
+    ck_assert(count >= 1);
+    ck_assert(cpus != NULL);
+    /* the list holds the cpus of the affinity mask in ascending order */
+    ck_assert(cthread_cpu_list( cpus, count ) == count);
+    for( i = 1; i < count; ++i )
+        ck_assert(cpus[i] > cpus[i - 1]);
+    ck_assert(cthread_cpu_list( &first, 1 ) == 1 && first == cpus[0]);
+    #ifdef __linux__
+    ck_assert(cthread_set_affinity( &self, cpus[count - 1] ));
+    /* the thread may run on that cpu only now */
+    ck_assert(cthread_cpu_count() == 1);
+    ck_assert(cthread_cpu_list( &first, 1 ) == 1 && first == cpus[count - 1]);
+    #endif
+    free( cpus );
+    /* cpus that do not exist are rejected */
+    ck_assert(!cthread_set_affinity( &self, 1u << 20 ));
+}
+END_TEST
+
+static volatile long atomic_counter = 0;
+
+static CTHREAD_RET _atomic_add_thread( CTHREAD_ARG data )
+{
+    int i;
+    for( i = 0; i < 10000; ++i ) {
+        cthread_atomic_add( &atomic_counter, 2 );
+        cthread_atomic_add( &atomic_counter, -1 );
+    }
+    return (CTHREAD_RET) 0;
+}
+
+START_TEST (cthread_atomic_add_test)
+{
+    c_thread threads[4];
+    int i;
+
+    ck_assert(cthread_atomic_add( &atomic_counter, 5 ) == 5);
+    ck_assert(cthread_atomic_add( &atomic_counter, -5 ) == 0);
+    for( i = 0; i < 4; ++i )
+        ck_assert(cthread_create( &threads[i], _atomic_add_thread, NULL ));
+    for( i = 0; i < 4; ++i )
+        cthread_join( &threads[i] );
+    ck_assert(atomic_counter == 40000);
+}
+END_TEST
+
+static volatile long pool_sum = 0;
+static volatile long pool_discarded = 0;
+
+static void _pool_worker( c_pool *pool )
+{
+    void *item;
+    while( (item = cthread_pool_pop( pool )) )
+        cthread_atomic_add( &pool_sum, (long)(size_t)item );
+}
+
+static void _pool_idle( c_pool *pool )
+{
+    /* returns right away, queued items are left to the discard function */
+    (void)pool;
+}
+
+static void _pool_discard( void *item )
+{
+    cthread_atomic_add( &pool_discarded, (long)(size_t)item );
+}
+
+START_TEST (cthread_pool_test)
+{
+    c_pool pool;
+    size_t i;
+    long expected = 0;
+
+    ck_assert(cthread_pool_init( &pool, 4, 16, _pool_worker, NULL ));
+    ck_assert(pool.num_workers == 4);
+    for( i = 1; i <= 1000; ++i ) {
+        while( !cthread_pool_push( &pool, (void*)i ) )
+            cthread_sleep( 1 ); /* full, give the workers some time */
+        expected += (long)i;
+    }
+    while( cthread_atomic_add( &pool_sum, 0 ) != expected )
+        cthread_sleep( 1 );
+    cthread_pool_destroy( &pool, _pool_discard );
+    ck_assert(pool_discarded == 0);
+    ck_assert(pool.workers == NULL);
+
+    /* items that no worker took are discarded */
+    ck_assert(cthread_pool_init( &pool, 1, 16, _pool_idle, NULL ));
+    ck_assert(cthread_pool_push( &pool, (void*)1 ));
+    ck_assert(cthread_pool_push( &pool, (void*)2 ));
+    cthread_pool_destroy( &pool, _pool_discard );
+    ck_assert(pool_discarded == 3);
+    /* destroying it again does nothing */
+    cthread_pool_destroy( &pool, _pool_discard );
+    ck_assert(pool_discarded == 3);
+}
+END_TEST
+
 /*  function that returns the test suite */
 Suite *cthread_test_suite( void )
 {
@@ -224,6 +421,11 @@ Suite *cthread_test_suite( void )
     tcase_add_test (tc_core, cthread_rwlock_basic);
     tcase_add_test (tc_core, cthread_semaphore_basic);
     tcase_add_test (tc_core, cthread_sleep_test);
+    tcase_add_test (tc_core, cthread_ring_basic);
+    tcase_add_test (tc_core, cthread_ring_threads);
+    tcase_add_test (tc_core, cthread_affinity_test);
+    tcase_add_test (tc_core, cthread_atomic_add_test);
+    tcase_add_test (tc_core, cthread_pool_test);
     suite_add_tcase (s, tc_core);
 
     return s;
@@ -0,0 +1,160 @@
+/*
+ * check_file_cache.c
+ *  file cache TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file_cache.h"
+
+#define NUM_FILES 64
+
+static char tmpdir[64];
+
+static void _path( char *buf, int i )
+{
+    sprintf( buf, "%s/file%d.txt", tmpdir, i );
+}
+
+static void _write_file( const char *path, const char *content )
+{
+    FILE *f = fopen( path, "wb" );
+    ck_assert(f != NULL);
+    fputs( content, f );
+    fclose( f );
+}
+
+static void setup( void )
+{
+    char path[128];
+    int i;
+    strcpy( tmpdir, "/tmp/check_file_cache_XXXXXX" );
+    ck_assert(mkdtemp( tmpdir ) != NULL);
+    for( i = 0; i < NUM_FILES; ++i ) {
+        _path( path, i );
+        _write_file( path, "cranberry" );
+    }
+}
+
+static void teardown( void )
+{
+    char path[128];
+    int i;
+    for( i = 0; i < NUM_FILES; ++i ) {
+        _path( path, i );
+        unlink( path );
+    }
+    _path( path, NUM_FILES );
+    unlink( path );
+    rmdir( tmpdir );
+}
+
+/* Hits return the cached entry, missing files are cached as well */
+START_TEST (file_cache_hit_and_miss)
+{
+    void *cache = file_cache_init( 128, 32, 60 );
+    file_cache_entry_t *a, *b;
+    char path[128], buf[16];
+
+    ck_assert(cache != NULL);
+    _path( path, 0 );
+    a = file_cache_get( cache, path );
+    ck_assert(a != NULL && a->status == CFILE_SUCCESS);
+    ck_assert(a->st.type == CFILE_TYPE_REGULAR && a->st.size == 9);
+    ck_assert(a->fd != -1);
+    ck_assert(cfile_pread( a->fd, buf, sizeof(buf), 4 ) == 5);
+    ck_assert(memcmp( buf, "berry", 5 ) == 0);
+    b = file_cache_get( cache, path );
+    ck_assert(a == b);
+    file_cache_release( cache, a );
+    file_cache_release( cache, b );
+
+    /* peeking never loads a file */
+    b = file_cache_peek( cache, path );
+    ck_assert(a == b);
+    file_cache_release( cache, b );
+    _path( path, 1 );
+    ck_assert(file_cache_peek( cache, path ) == NULL);
+    _path( path, 0 );
+
+    /* a file that is created after a failed lookup stays missing until the ttl passes */
+    _path( path, NUM_FILES );
+    a = file_cache_get( cache, path );
+    ck_assert(a != NULL && a->status == CFILE_DOES_NOT_EXIST && a->fd == -1);
+    file_cache_release( cache, a );
+    _write_file( path, "new" );
+    a = file_cache_get( cache, path );
+    ck_assert(a->status == CFILE_DOES_NOT_EXIST);
+    file_cache_release( cache, a );
+
+    file_cache_free( cache );
+}
+END_TEST
+
+/* Dropped entries stay usable until they are released, disabled caches don't cache */
+START_TEST (file_cache_bounds)
+{
+    void *cache = file_cache_init( 16, 16, 60 );
+    file_cache_entry_t *first, *entry;
+    char path[128], buf[16];
+    int i;
+
+    _path( path, 0 );
+    first = file_cache_get( cache, path );
+    ck_assert(first != NULL && first->fd != -1);
+    /* a lot more files than the cache holds */
+    for( i = 1; i < NUM_FILES; ++i ) {
+        _path( path, i );
+        entry = file_cache_get( cache, path );
+        ck_assert(entry != NULL && entry->fd != -1);
+        file_cache_release( cache, entry );
+    }
+    ck_assert(cfile_pread( first->fd, buf, sizeof(buf), 0 ) == 9);
+    file_cache_release( cache, first );
+    file_cache_free( cache );
+
+    cache = file_cache_init( 0, 0, 60 );
+    ck_assert(cache != NULL);
+    _path( path, 1 );
+    first = file_cache_get( cache, path );
+    entry = file_cache_get( cache, path );
+    ck_assert(first != entry && first->fd != -1 && entry->fd != -1);
+    file_cache_release( cache, first );
+    file_cache_release( cache, entry );
+    file_cache_free( cache );
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *file_cache_test_suite( void )
+{
+    Suite *s = suite_create ("FileCache");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_checked_fixture (tc_core, setup, teardown);
+    tcase_add_test (tc_core, file_cache_hit_and_miss);
+    tcase_add_test (tc_core, file_cache_bounds);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = file_cache_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+/*
+ * check_http_parser.c
+ *  http request header parser TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_parser.h"
+
+static const char request[] =
+    "GET /index.html?a=1 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent:  cranberry-test \t\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "X-Empty:\r\n"
+    "\r\n"
+    "next";
+
+static int _slice_is( const char *buf, http_slice_t slice, const char *str )
+{
+    return slice.len == strlen( str ) && memcmp( &buf[slice.off], str, slice.len ) == 0;
+}
+
+static void _check_request( const http_parser_t *parser, const char *buf )
+{
+    ck_assert(_slice_is( buf, parser->method, "GET" ));
+    ck_assert(_slice_is( buf, parser->target, "/index.html?a=1" ));
+    ck_assert(_slice_is( buf, parser->version, "HTTP/1.1" ));
+    ck_assert_int_eq(parser->num_fields, 4);
+    ck_assert(_slice_is( buf, parser->fields[0].name, "Host" ));
+    ck_assert(_slice_is( buf, parser->fields[0].value, "localhost:8080" ));
+    ck_assert(_slice_is( buf, parser->fields[1].name, "User-Agent" ));
+    ck_assert(_slice_is( buf, parser->fields[1].value, "cranberry-test" ));
+    ck_assert(_slice_is( buf, parser->fields[2].value, "gzip, deflate" ));
+    ck_assert(_slice_is( buf, parser->fields[3].name, "X-Empty" ));
+    ck_assert_int_eq(parser->fields[3].value.len, 0);
+    ck_assert(memcmp( &buf[parser->pos], "next", 4 ) == 0);
+}
+
+/* Header in one piece, the bytes behind it are not parsed */
+START_TEST (http_parser_complete)
+{
+    http_parser_t parser;
+    http_parser_init( &parser );
+    ck_assert_int_eq(http_parser_execute( &parser, request, sizeof(request) - 1 ), HTTP_PARSER_DONE);
+    _check_request( &parser, request );
+}
+END_TEST
+
+/* Header that is received byte by byte into a buffer that moves */
+START_TEST (http_parser_partial)
+{
+    http_parser_t parser;
+    size_t len;
+    int ret = HTTP_PARSER_AGAIN;
+    char *buf = NULL;
+
+    http_parser_init( &parser );
+    for( len = 1; len < sizeof(request) && ret == HTTP_PARSER_AGAIN; ++len ) {
+        char *moved = (char*)malloc( len );
+        memcpy( moved, request, len );
+        free( buf );
+        buf = moved;
+        ret = http_parser_execute( &parser, buf, len );
+        ck_assert_int_eq(http_parser_line_done( &parser ), memchr( request, '\n', len ) != NULL);
+    }
+    ck_assert_int_eq(ret, HTTP_PARSER_DONE);
+    ck_assert_int_eq(len - 1, sizeof(request) - 5);
+    free( buf );
+
+    _check_request( &parser, request );
+}
+END_TEST
+
+/* Leading empty lines, bare LF line ends and requests without version */
+START_TEST (http_parser_lenient)
+{
+    static const char lf[] = "\r\n\nPOST /form HTTP/1.0\nContent-Length: 3\n\nabc";
+    static const char old[] = "GET /\r\n\r\n";
+    http_parser_t parser;
+
+    http_parser_init( &parser );
+    ck_assert_int_eq(http_parser_execute( &parser, lf, sizeof(lf) - 1 ), HTTP_PARSER_DONE);
+    ck_assert(_slice_is( lf, parser.method, "POST" ));
+    ck_assert(_slice_is( lf, parser.version, "HTTP/1.0" ));
+    ck_assert(_slice_is( lf, parser.fields[0].value, "3" ));
+    ck_assert_int_eq(parser.pos, sizeof(lf) - 4);
+
+    http_parser_init( &parser );
+    ck_assert_int_eq(http_parser_execute( &parser, old, sizeof(old) - 1 ), HTTP_PARSER_DONE);
+    ck_assert(_slice_is( old, parser.target, "/" ));
+    ck_assert_int_eq(parser.version.len, 0);
+    ck_assert_int_eq(parser.num_fields, 0);
+}
+END_TEST
+
+/* Malformed requests and too many header fields */
+START_TEST (http_parser_errors)
+{
+    static const char *malformed[] = {
+        "GET\r\n\r\n",
+        "GET  / HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\rX\n\r\n",
+        "GET / HTTP/1.1\r\nHost : localhost\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: localhost\r\n folded\r\n\r\n",
+        "GET / HTTP/1.1\r\n: empty\r\n\r\n",
+        "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+        "GET / HTTP/1.1\r\n\rX",
+        NULL
+    };
+    http_parser_t parser;
+    char buf[2048];
+    size_t len;
+    int i;
+
+    for( i = 0; malformed[i]; ++i ) {
+        http_parser_init( &parser );
+        ck_assert_int_eq(http_parser_execute( &parser, malformed[i], strlen( malformed[i] ) ),
+                         HTTP_PARSER_MALFORMED);
+    }
+
+    len = (size_t)sprintf( buf, "GET / HTTP/1.1\r\n" );
+    for( i = 0; i <= HTTP_PARSER_MAX_FIELDS; ++i )
+        len += (size_t)sprintf( &buf[len], "X-%d: %d\r\n", i, i );
+    len += (size_t)sprintf( &buf[len], "\r\n" );
+    http_parser_init( &parser );
+    ck_assert_int_eq(http_parser_execute( &parser, buf, len ), HTTP_PARSER_TOO_MANY_FIELDS);
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *http_parser_test_suite( void )
+{
+    Suite *s = suite_create ("HttpParser");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_test (tc_core, http_parser_complete);
+    tcase_add_test (tc_core, http_parser_partial);
+    tcase_add_test (tc_core, http_parser_lenient);
+    tcase_add_test (tc_core, http_parser_errors);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = http_parser_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
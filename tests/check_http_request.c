@@ -0,0 +1,225 @@
+/*
+ * check_http_request.c
+ *  http request receive TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+
+/* for _recv_data_timed */
+#define HTTP_REQUEST_IMPL_
+#include "http_request.h"
+
+/* the event loop is not part of this test */
+void event_loop_deadline( thread_arg_t *conn, int deadline )
+{
+    (void)conn; (void)deadline;
+}
+
+/* descriptor number above FD_SETSIZE, select() cannot handle it */
+#define HIGH_FD (FD_SETSIZE + 976)
+
+/* create a connected socket pair, the first socket is moved to HIGH_FD */
+static void _high_fd_socketpair( int sv[2] )
+{
+    struct rlimit rl;
+    ck_assert(getrlimit( RLIMIT_NOFILE, &rl ) == 0);
+    if( rl.rlim_cur <= HIGH_FD ) {
+        rl.rlim_cur = HIGH_FD + 1;
+        ck_assert(setrlimit( RLIMIT_NOFILE, &rl ) == 0);
+    }
+    ck_assert(socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) == 0);
+    ck_assert(dup2( sv[0], HIGH_FD ) == HIGH_FD);
+    close( sv[0] );
+    sv[0] = HIGH_FD;
+}
+
+/* Receive with timeout on a descriptor above FD_SETSIZE */
+START_TEST (recv_timed_high_fd)
+{
+    int sv[2];
+    char buf[64];
+    static const char request[] = "GET / HTTP/1.1\r\n\r\n";
+
+    _high_fd_socketpair( sv );
+    ck_assert(write( sv[1], request, sizeof(request)-1 ) == sizeof(request)-1);
+    ck_assert(_recv_data_timed( sv[0], buf, sizeof(buf), 1 ) == sizeof(request)-1);
+    ck_assert(memcmp( buf, request, sizeof(request)-1 ) == 0);
+
+    /* nothing more to receive */
+    ck_assert(_recv_data_timed( sv[0], buf, sizeof(buf), 1 ) == RECV_SELECT_TIMEOUT);
+
+    /* closed by the peer */
+    close( sv[1] );
+    ck_assert(_recv_data_timed( sv[0], buf, sizeof(buf), 1 ) == 0);
+    close( sv[0] );
+}
+END_TEST
+
+/* Bytes received in advance are used as the next request */
+START_TEST (pending_append)
+{
+    thread_arg_t args;
+    memset( &args, 0, sizeof(args) );
+
+    ck_assert(http_request_pending_append( &args, "GET / HTTP/1.1\r\n", 16 ));
+    ck_assert(!http_request_pending( &args ));
+    ck_assert(http_request_pending_append( &args, "\r\nGET", 5 ));
+    ck_assert(http_request_pending( &args ));
+    ck_assert(args.pending_len == 21);
+    ck_assert_str_eq(args.pending, "GET / HTTP/1.1\r\n\r\nGET");
+    free( args.pending );
+}
+END_TEST
+
+/* Pipelined requests with bare LF line ends are complete once their empty line is received */
+START_TEST (pending_bare_lf)
+{
+    static const char requests[] = "GET /a HTTP/1.1\nHost: x\n\nGET /b HTTP/1.1\nHost: x\n\n";
+    thread_arg_t args;
+    http_req_info_t *ri;
+    char buf[512];
+    int err;
+    memset( &args, 0, sizeof(args) );
+    args.fd = -1;
+
+    ck_assert(http_request_pending_append( &args, requests, 16 ));
+    ck_assert(!http_request_pending( &args ));
+    ck_assert(http_request_pending_append( &args, &requests[16], sizeof(requests) - 17 ));
+    ck_assert(http_request_pending( &args ));
+
+    ri = http_request_read( &args, REQ_FILL_ALL, &err, buf, sizeof(buf) );
+    ck_assert(ri != NULL && err == RRT_OKAY);
+    ck_assert_str_eq(ri->filename, "a");
+    free_req_info( ri );
+    ck_assert(http_request_pending( &args ));
+
+    ri = http_request_read( &args, REQ_FILL_ALL, &err, buf, sizeof(buf) );
+    ck_assert(ri != NULL && err == RRT_OKAY);
+    ck_assert_str_eq(ri->filename, "b");
+    free_req_info( ri );
+    ck_assert(!http_request_pending( &args ));
+    free( args.pending );
+}
+END_TEST
+
+/* Too many header fields and header fields that do not fit into the buffer
+ * are reported as such, not as a too long request line */
+START_TEST (too_many_fields)
+{
+    thread_arg_t args;
+    http_req_info_t *ri;
+    char req[2048], buf[4096], small[512];
+    int i, err, len = sprintf( req, "GET / HTTP/1.1\r\n" );
+    memset( &args, 0, sizeof(args) );
+    args.fd = -1;
+
+    for( i = 0; i < 70; ++i )
+        len += sprintf( &req[len], "X-%d: %d\r\n", i, i );
+    len += sprintf( &req[len], "\r\n" );
+    ck_assert(http_request_pending_append( &args, req, (size_t)len ));
+    ck_assert(http_request_pending( &args ));
+
+    ri = http_request_read( &args, REQ_FILL_ALL, &err, buf, sizeof(buf) );
+    ck_assert(ri != NULL && err == RRT_TOO_MANY_HEADER_FIELDS);
+    free_req_info( ri );
+    free( args.pending );
+
+    /* few fields, but too large for the buffer */
+    memset( &args, 0, sizeof(args) );
+    args.fd = -1;
+    len = sprintf( req, "GET / HTTP/1.1\r\nX-Long: " );
+    memset( &req[len], 'x', 1000 );
+    len += 1000;
+    len += sprintf( &req[len], "\r\n\r\n" );
+    ck_assert(http_request_pending_append( &args, req, (size_t)len ));
+    ri = http_request_read( &args, REQ_FILL_ALL, &err, small, sizeof(small) );
+    ck_assert(ri != NULL && err == RRT_TOO_MANY_HEADER_FIELDS);
+    free_req_info( ri );
+    free( args.pending );
+
+    /* a request line that does not fit stays a too long uri */
+    memset( &args, 0, sizeof(args) );
+    args.fd = -1;
+    len = sprintf( req, "GET /" );
+    memset( &req[len], 'a', 1000 );
+    len += 1000;
+    len += sprintf( &req[len], " HTTP/1.1\r\n\r\n" );
+    ck_assert(http_request_pending_append( &args, req, (size_t)len ));
+    ri = http_request_read( &args, REQ_FILL_ALL, &err, small, sizeof(small) );
+    ck_assert(ri != NULL && err == RRT_HEADER_LINE_SIZE_EXCEEDED);
+    free_req_info( ri );
+    free( args.pending );
+}
+END_TEST
+
+/* Range header parsing, positions are clipped to the file size */
+START_TEST (parse_range)
+{
+    http_range_t r[4];
+
+    ck_assert(http_request_parse_range( "bytes=0-499", 1000, r, 4 ) == 1);
+    ck_assert(r[0].first == 0 && r[0].last == 499);
+    ck_assert(http_request_parse_range( "bytes=500-", 1000, r, 4 ) == 1);
+    ck_assert(r[0].first == 500 && r[0].last == 999);
+    ck_assert(http_request_parse_range( "bytes=-200", 1000, r, 4 ) == 1);
+    ck_assert(r[0].first == 800 && r[0].last == 999);
+    ck_assert(http_request_parse_range( "bytes=-2000", 1000, r, 4 ) == 1);
+    ck_assert(r[0].first == 0 && r[0].last == 999);
+    ck_assert(http_request_parse_range( "bytes=900-99999999999999999999", 1000, r, 4 ) == 1);
+    ck_assert(r[0].first == 900 && r[0].last == 999);
+
+    /* several ranges, unsatisfiable ones are left out */
+    ck_assert(http_request_parse_range( "bytes=0-0, 2000-3000 ,-1", 1000, r, 4 ) == 2);
+    ck_assert(r[0].first == 0 && r[0].last == 0);
+    ck_assert(r[1].first == 999 && r[1].last == 999);
+    ck_assert(http_request_parse_range( "bytes=1000-", 1000, r, 4 ) == 0);
+    ck_assert(http_request_parse_range( "bytes=-0", 1000, r, 4 ) == 0);
+
+    /* invalid headers and too many ranges are ignored */
+    ck_assert(http_request_parse_range( "bytes=", 1000, r, 4 ) == -1);
+    ck_assert(http_request_parse_range( "bytes=5-1", 1000, r, 4 ) == -1);
+    ck_assert(http_request_parse_range( "bytes=a-b", 1000, r, 4 ) == -1);
+    ck_assert(http_request_parse_range( "items=0-1", 1000, r, 4 ) == -1);
+    ck_assert(http_request_parse_range( "bytes=0-1,2-3,4-5,6-7,8-9", 1000, r, 4 ) == -1);
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *http_request_test_suite( void )
+{
+    Suite *s = suite_create ("HttpRequest");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_test (tc_core, recv_timed_high_fd);
+    tcase_add_test (tc_core, pending_append);
+    tcase_add_test (tc_core, pending_bare_lf);
+    tcase_add_test (tc_core, too_many_fields);
+    tcase_add_test (tc_core, parse_range);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = http_request_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
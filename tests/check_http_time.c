@@ -0,0 +1,59 @@
+/*
+ * check_http_time.c
+ *  http time TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_time.h"
+
+/* Formatted dates are parsed back to the same time, independent of the local time zone */
+START_TEST (http_time_round_trip)
+{
+    static const time_t times[] = { 0, 784111777, 951782400, 1700000000 };
+    char buf[32];
+    time_t t;
+    int i;
+
+    setenv( "TZ", "America/New_York", 1 );
+    tzset();
+    for( i = 0; i < (int)(sizeof(times) / sizeof(times[0])); ++i ) {
+        http_time( buf, times[i] );
+        ck_assert(http_time_mktime( buf, &t ) == 0);
+        ck_assert(t == times[i]);
+    }
+    ck_assert_str_eq(http_time( buf, 784111777 ), "Sun, 06 Nov 1994 08:49:37 GMT");
+    ck_assert(http_time_mktime( "Sun Nov  6 08:49:37 1994", &t ) == 0 && t == 784111777);
+    ck_assert(http_time_mktime( "yesterday", &t ) != 0);
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *http_time_test_suite( void )
+{
+    Suite *s = suite_create ("HttpTime");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_test (tc_core, http_time_round_trip);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = http_time_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,130 @@
+/*
+ * check_timer_wheel.c
+ *  timer wheel TEST
+ */
+
+/* include header for 'check' unit testing */
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define RESOLUTION 10
+#define NUM_TIMERS 512
+
+/* count the expired entries and check that none expired too early or too late */
+static int _check_expired( timer_entry_t *expired, unsigned long now, unsigned long *deadlines )
+{
+    int count = 0;
+    for( ; expired; expired = expired->next, ++count ) {
+        const unsigned long deadline = deadlines[(size_t)expired->data];
+        ck_assert(!TIMER_ENTRY_ARMED(expired));
+        ck_assert(deadline <= now);
+        ck_assert(now - deadline < 2 * RESOLUTION);
+    }
+    return count;
+}
+
+/* Timers on all levels expire at their deadline */
+START_TEST (timer_wheel_deadlines)
+{
+    timer_wheel_t wheel;
+    timer_entry_t *entries = (timer_entry_t*)malloc( NUM_TIMERS * sizeof(timer_entry_t) );
+    unsigned long deadlines[NUM_TIMERS];
+    unsigned long now = 123457;
+    int i, expired = 0;
+
+    ck_assert(entries != NULL);
+    timer_wheel_init( &wheel, now, RESOLUTION );
+    srand( 42 );
+    for( i = 0; i < NUM_TIMERS; ++i ) {
+        /* from a few ticks up to several hours ahead, i.e. on all levels */
+        const unsigned long ahead = (i % 4 == 0) ? (unsigned long)(rand() % 1000)
+                                  : (i % 4 == 1) ? (unsigned long)(rand() % 50000)
+                                  : (i % 4 == 2) ? (unsigned long)(rand() % 3000000)
+                                  : 1000UL * (unsigned long)(rand() % 20000);
+        deadlines[i] = now + ahead;
+        timer_entry_init( &entries[i], (void*)(size_t)i );
+        timer_wheel_add( &wheel, &entries[i], deadlines[i] );
+    }
+    ck_assert(wheel.count == NUM_TIMERS);
+
+    /* step through time like an event loop would */
+    while( expired < NUM_TIMERS ) {
+        long next = timer_wheel_next( &wheel, now );
+        ck_assert(next >= 0);
+        now += next ? (unsigned long)next : 1;
+        expired += _check_expired( timer_wheel_expire( &wheel, now ), now, deadlines );
+    }
+    ck_assert(wheel.count == 0);
+    ck_assert(timer_wheel_next( &wheel, now ) == -1);
+    free( entries );
+}
+END_TEST
+
+/* Removed timers don't expire, moved timers expire at the new deadline */
+START_TEST (timer_wheel_remove_move)
+{
+    timer_wheel_t wheel;
+    timer_entry_t a, b, c;
+    timer_entry_t *expired;
+    unsigned long now = 1000;
+
+    timer_wheel_init( &wheel, now, RESOLUTION );
+    timer_entry_init( &a, &a );
+    timer_entry_init( &b, &b );
+    timer_entry_init( &c, &c );
+
+    timer_wheel_add( &wheel, &a, now + 100 );
+    timer_wheel_add( &wheel, &b, now + 100 );
+    timer_wheel_add( &wheel, &c, now + 100 );
+    timer_wheel_remove( &wheel, &b );
+    timer_wheel_remove( &wheel, &b );
+    ck_assert(!TIMER_ENTRY_ARMED(&b));
+    timer_wheel_add( &wheel, &c, now + 5000 );
+    ck_assert(wheel.count == 2);
+
+    ck_assert(timer_wheel_expire( &wheel, now + 99 ) == NULL);
+    expired = timer_wheel_expire( &wheel, now + 100 );
+    ck_assert(expired == &a && expired->next == NULL);
+
+    ck_assert(timer_wheel_expire( &wheel, now + 4999 ) == NULL);
+    expired = timer_wheel_expire( &wheel, now + 5000 );
+    ck_assert(expired == &c && expired->next == NULL);
+
+    /* deadlines in the past expire with the next call */
+    timer_wheel_add( &wheel, &b, now );
+    ck_assert(timer_wheel_next( &wheel, now + 6000 ) == 0);
+    ck_assert(timer_wheel_expire( &wheel, now + 6000 ) == &b);
+    ck_assert(wheel.count == 0);
+}
+END_TEST
+
+/*  function that returns the test suite */
+Suite *timer_wheel_test_suite( void )
+{
+    Suite *s = suite_create ("TimerWheel");
+
+    /* Core test cases */
+    TCase *tc_core = tcase_create ("Core");
+
+    tcase_add_test (tc_core, timer_wheel_deadlines);
+    tcase_add_test (tc_core, timer_wheel_remove_move);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+/* Test runner main */
+int main (void)
+{
+    int number_failed;
+    Suite *s = timer_wheel_test_suite();
+    SRunner *sr = srunner_create( s );
+
+    srunner_run_all( sr, CK_NORMAL );
+    number_failed = srunner_ntests_failed( sr );
+    srunner_free( sr );
+    return( number_failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}